@@ -0,0 +1,260 @@
+/*
+ * cgen.c
+ * C code generation of bytecode programs
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "derivative.h"
+#include "struct.h"
+#include "vm.h"
+
+/*
+ * Writes a program as a C translation unit of its own, with one function per output. Each
+ * instruction becomes one assignment, constants are written in hexadecimal so that they keep
+ * every bit, and functions are the same libm calls deriv_eval() makes. Compiled without
+ * -ffast-math, without contracting a * b + c into fma and without builtins (gcc turns pow(x, -1)
+ * into 1 / x, which can differ in the last bit), the functions return what deriv_eval() does, but
+ * for the sign of a NaN, as the compiler may swap the operands of + and *. They need nothing of
+ * this library at run time.
+ */
+
+/* The libm function of op; inv is set when the reciprocal is taken afterwards. */
+static const char *cg_fn(vm_op op, int *inv) {
+    static const char *name[] = {"sin", "cos", "tan", "sin", "cos", "tan",
+                                 "sinh", "cosh", "tanh", "sinh", "cosh", "tanh", "log", "log10"};
+    *inv = (op == vm_csc) || (op == vm_sec) || (op == vm_cot) || (op == vm_csch) || (op == vm_sech) || (op == vm_coth);
+    return name[op - vm_sin];
+}
+
+/* Writes register r of the program as an operand. */
+static void cg_reg(FILE *fp, const deriv_prog *prog, int r) {
+    if (r == prog->n_cst) {
+        fputs("x", fp);
+    } else if (r > prog->n_cst) {
+        fprintf(fp, "r%d", r);
+    } else if (isfinite(prog->cst[r])) {
+        fprintf(fp, "%a", prog->cst[r]);
+    } else {
+        unsigned long long u;                              // inf and nan have no literal of their own
+        memcpy(&u, &prog->cst[r], 8);
+        fprintf(fp, "cst_bits(0x%llxULL)", u);
+    }
+}
+
+/* Writes the function name computing output out. */
+static void cg_out(FILE *fp, const deriv_prog *prog, int out, const char *name, char *live, char *need) {
+    int ind;
+    int n_tmp = 0;
+    vm_live(prog, out, live, need);
+
+    fprintf(fp, "\ndouble %s(double x) {\n", name);
+    memset(live, 0, prog->n_reg);                          // now the temporaries to declare
+    for (ind = 0; ind < prog->n_ins; ind++) {
+        if (need[ind] && !live[prog->ins[ind].dst]) {
+            live[prog->ins[ind].dst] = 1;
+            fprintf(fp, (n_tmp++ == 0) ? "    double r%d" : ", r%d", prog->ins[ind].dst);
+        }
+    }
+    fputs((n_tmp > 0) ? ";\n\n" : "", fp);
+
+    for (ind = 0; ind < prog->n_ins; ind++) {
+        const vm_ins *ins = prog->ins + ind;
+        int inv;
+        if (!need[ind]) {
+            continue;
+        }
+
+        fprintf(fp, "    r%d = ", ins->dst);
+        if (ins->op <= vm_div) {
+            cg_reg(fp, prog, ins->a);
+            fprintf(fp, " %c ", "+-*/"[ins->op - vm_add]);
+            cg_reg(fp, prog, ins->b);
+        } else if (ins->op == vm_neg) {
+            fputs("-", fp);
+            cg_reg(fp, prog, ins->a);
+        } else if (ins->op == vm_pow) {
+            fputs("pow(", fp);
+            cg_reg(fp, prog, ins->a);
+            fputs(", ", fp);
+            cg_reg(fp, prog, ins->b);
+            fputs(")", fp);
+        } else {
+            const char *fn = cg_fn(ins->op, &inv);
+            fprintf(fp, inv ? "1 / %s(" : "%s(", fn);
+            cg_reg(fp, prog, ins->a);
+            fputs(")", fp);
+        }
+        fputs(";\n", fp);
+    }
+
+    fputs("    return ", fp);
+    cg_reg(fp, prog, out);
+    fputs(";\n}\n", fp);
+}
+
+/* Writes the translation unit of the program, its functions named prefix df and prefix f. */
+static int cg_unit(FILE *fp, const deriv_prog *prog, const char *prefix) {
+    char *live = (char *) malloc(prog->n_reg + prog->n_ins + 1);
+    char *name = (char *) malloc(strlen(prefix) + 3);
+    if ((live == NULL) || (name == NULL)) {
+        free(live);
+        free(name);
+        return DERIV_ENOMEM;
+    }
+
+    fputs("/* Generated by derivative; compile with -fno-builtin -ffp-contract=off. */\n\n", fp);
+    fputs("#include <math.h>\n", fp);
+
+    int ind;
+    for (ind = 0; ind < prog->n_cst; ind++) {
+        if (!isfinite(prog->cst[ind])) {
+            fputs("#include <string.h>\n\nstatic double cst_bits(unsigned long long u) {\n"
+                  "    double d;\n    memcpy(&d, &u, sizeof(d));\n    return d;\n}\n", fp);
+            break;
+        }
+    }
+
+    sprintf(name, "%sdf", prefix);
+    cg_out(fp, prog, prog->out[0], name, live, live + prog->n_reg);
+    if (prog->out[1] >= 0) {
+        sprintf(name, "%sf", prefix);
+        cg_out(fp, prog, prog->out[1], name, live, live + prog->n_reg);
+    }
+
+    free(live);
+    free(name);
+    return 0;
+}
+
+/*
+ * Writes a C translation unit computing the compiled derivative as double df(double x) and, for a
+ * program compiled with DERIV_FUNC, the function as double f(double x), both names preceded by
+ * prefix (which may be NULL). The text goes to out, truncated to cap - 1 characters and
+ * terminated when cap > 0. Returns its full length, or DERIV_ENOMEM.
+ */
+long deriv_emit(const deriv_prog *prog, const char *prefix, char *out, size_t cap) {
+    char *text;
+    size_t len;
+    FILE *fp = open_memstream(&text, &len);
+    if (fp == NULL) {
+        return DERIV_ENOMEM;
+    }
+
+    int rc = cg_unit(fp, prog, (prefix != NULL) ? prefix : "");
+    if ((fclose(fp) != 0) || (rc < 0)) {
+        free(text);
+        return DERIV_ENOMEM;
+    }
+
+    if (cap > 0) {
+        size_t n = (len < cap) ? len : cap - 1;
+        memcpy(out, text, n);
+        out[n] = 0;
+    }
+    free(text);
+    return (long) len;
+}
+
+/*
+ * Builds the shared object path from the translation unit of deriv_emit(), with the compiler in
+ * $CC or gcc, whose messages go to stderr. Returns 0 or DERIV_EBUILD.
+ */
+int deriv_build(const deriv_prog *prog, const char *prefix, const char *path) {
+    char src[] = "/tmp/derivXXXXXX.c";
+    int fd = mkstemps(src, 2);
+    if (fd < 0) {
+        return DERIV_EBUILD;
+    }
+
+    FILE *fp = fdopen(fd, "w");
+    if (fp == NULL) {
+        close(fd);
+        unlink(src);
+        return DERIV_EBUILD;
+    }
+    int rc = cg_unit(fp, prog, (prefix != NULL) ? prefix : "");
+    if ((fclose(fp) != 0) || (rc < 0)) {
+        unlink(src);
+        return DERIV_EBUILD;
+    }
+
+    char *cc = getenv("CC");
+    char *argv[] = {(cc != NULL) && (*cc != 0) ? cc : "gcc", "-O2", "-fno-builtin", "-ffp-contract=off", "-fPIC", "-shared",
+                    "-o", (char *) path, src, "-lm", NULL};
+    int status = -1;
+    pid_t pid = fork();
+    if (pid == 0) { // child
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+    if (pid > 0) {
+        while ((waitpid(pid, &status, 0) < 0) && (errno == EINTR)) {
+        }
+    }
+
+    unlink(src);
+    return (WIFEXITED(status) && (WEXITSTATUS(status) == 0)) ? 0 : DERIV_EBUILD;
+}
+
+/*
+ * Loads a shared object made by deriv_build(), with no parsing nor compiling, and sets df and f
+ * (NULL if the program had no DERIV_FUNC) to its functions. path needs a slash to name a file
+ * rather than a library on the search path. Returns the handle for dlclose(), or NULL.
+ */
+void *deriv_load(const char *path, const char *prefix, deriv_fn *df, deriv_fn *f) {
+    void *dl = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (dl == NULL) {
+        return NULL;
+    }
+
+    if (prefix == NULL) {
+        prefix = "";
+    }
+    char *name = (char *) malloc(strlen(prefix) + 3);
+    if (name == NULL) {
+        dlclose(dl);
+        return NULL;
+    }
+
+    sprintf(name, "%sdf", prefix);
+    *df = (deriv_fn) dlsym(dl, name);
+    sprintf(name, "%sf", prefix);
+    *f = (deriv_fn) dlsym(dl, name);
+    free(name);
+
+    if (*df == NULL) {
+        dlclose(dl);
+        return NULL;
+    }
+    return dl;
+}
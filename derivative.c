@@ -0,0 +1,331 @@
+/*
+ * derivative.c
+ * Library interface of the differentiation engine
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <setjmp.h>
+#include <stdlib.h>
+#include <string.h>
+#include "derivative.h"
+#include "diff.h"
+#include "gov.h"
+#include "mem.h"
+#include "node.h"
+#include "parse.h"
+#include "simplify.h"
+#include "struct.h"
+#include "utility.h"
+#include "vm.h"
+
+#define DERIV_SHARE (4 * 1024 * 1024)                      // arena bytes a bulk call lets its caches grow to
+
+struct deriv_ctx {
+    mem_arena *ar;                                         // memory of the request in progress
+    int flags;
+    char *buf;                                             // results of deriv_bulk() when the caller gives no buffer
+    size_t cap;
+    double sec;                                            // limits of each request, 0 for none
+    size_t bytes;
+    int cancel;                                            // bumped by deriv_cancel()
+};
+
+static double deriv_sec = 0;                               // limits of deriv_str() and of new contexts
+static size_t deriv_bytes = 0;
+static int deriv_cancels = 0;                              // deriv_cancel() of requests without a context
+
+static int deriv_nodes(char *str, node **nd, node **df);
+static char *deriv_run(char *str, int flags, double sec, size_t bytes, int *cancel, int *err);
+
+/*
+ * Differentiates the n expressions packed in input, item i being the bytes from off[i] to
+ * off[i + 1]. The derivatives are packed into *out, each terminated and starting at out_off[i];
+ * stat[i] is the length of item i or its DERIV_E* code, with an empty string in *out for an
+ * error. When *out is NULL the results go to a buffer owned by the context, valid until its next
+ * bulk call, and *out is set to it; otherwise *out holds cap bytes and items that do not fit get
+ * DERIV_ESPACE. Returns the bytes all results need. The items share the arena, the interned
+ * nodes and the memo, so a subexpression repeated across the batch is differentiated once; with
+ * DERIV_STRING, only the memo is shared, keyed on the text of each subexpression.
+ */
+long deriv_bulk(deriv_ctx *ctx, const char *input, const size_t *off, size_t n,
+                char **out, size_t cap, size_t *out_off, long *stat) {
+    if (ctx == NULL) {
+        return DERIV_ENOMEM;
+    }
+    mem_arena *prev = mem_use(ctx->ar);
+
+    bool own = (*out == NULL);
+    if (own) {
+        *out = ctx->buf;
+        cap = ctx->cap;
+    }
+
+    size_t at = 0, ind;
+    for (ind = 0; ind < n; ind++) {
+        int err = 0;
+        char *derv = deriv_run(wo_nspace((char *) input + off[ind], off[ind + 1] - off[ind]), ctx->flags,
+                               ctx->sec, ctx->bytes, &ctx->cancel, &err);
+        if (derv == NULL) {
+            derv = "";
+        }
+        size_t len = strlen(derv);
+
+        if (own && (at + len + 1 > cap)) {
+            size_t grow = (2 * cap > at + len + 1) ? 2 * cap : at + len + 1;
+            char *buf = (char *) realloc(*out, grow);
+            if (buf != NULL) {
+                *out = buf;
+                cap = grow;
+            }
+        }
+
+        out_off[ind] = at;
+        if (at + len + 1 > cap) {
+            stat[ind] = own ? DERIV_ENOMEM : DERIV_ESPACE;
+        } else {
+            memcpy(*out + at, derv, len + 1);
+            stat[ind] = (err != 0) ? err : (long) len;
+        }
+        at += len + 1;
+
+        if ((err != 0) || (mem_used() > DERIV_SHARE)) {    // the caches start over rather than grow,
+            mem_reset();                                   // or than outlive a request cut short
+        }
+    }
+
+    if (own) {
+        ctx->buf = *out;
+        ctx->cap = cap;
+    }
+
+    mem_reset();
+    mem_use(prev);
+    return (long) at;
+}
+
+/*
+ * Makes the request in progress on ctx, or with ctx NULL every deriv_str() in progress, fail with
+ * DERIV_ECANCEL. Can be called from another thread or from a signal handler.
+ */
+void deriv_cancel(deriv_ctx *ctx) {
+    __atomic_add_fetch((ctx != NULL) ? &ctx->cancel : &deriv_cancels, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * Compiles the derivative of input, and with DERIV_FUNC input itself, for deriv_eval(). The
+ * derivative is always taken on the expression tree, under the limits of deriv_str(). Returns the program, to be freed with deriv_prog_free(), or NULL with the DERIV_E*
+ * code in err.
+ */
+deriv_prog *deriv_compile(const char *input, size_t len, int flags, int *err) {
+    mem_arena *ar = mem_new();
+    if (ar == NULL) {
+        *err = DERIV_ENOMEM;
+        return NULL;
+    }
+    mem_arena *prev = mem_use(ar);
+
+    node *nd, *df;
+    deriv_prog *prog = NULL;
+    *err = deriv_nodes(wo_nspace((char *) input, len), &nd, &df);
+    if ((*err == 0) && ((prog = vm_build(df, (flags & DERIV_FUNC) ? nd : NULL)) == NULL)) {
+        *err = DERIV_ENOMEM;
+    }
+
+    mem_use(prev);
+    mem_free(ar);
+    return prog;
+}
+
+/*
+ * Differentiates input and writes the derivative to out, truncated to cap - 1 characters
+ * and terminated when cap > 0. Returns the full length of the derivative, so a result of cap or
+ * more means out was too small, or a negative DERIV_E* code for invalid input.
+ */
+long deriv_differentiate(deriv_ctx *ctx, const char *input, size_t len, char *out, size_t cap) {
+    if (ctx == NULL) {
+        return DERIV_ENOMEM;
+    }
+    mem_arena *prev = mem_use(ctx->ar);
+
+    int err;
+    char *derv = deriv_run(wo_nspace((char *) input, len), ctx->flags, ctx->sec, ctx->bytes, &ctx->cancel, &err);
+
+    long rc = err;
+    if (derv != NULL) {
+        size_t n = strlen(derv);
+        rc = (long) n;
+        if (cap > 0) {
+            n = (n < cap) ? n : cap - 1;
+            memcpy(out, derv, n);
+            out[n] = 0;
+        }
+    }
+
+    mem_reset();                                           // keeps the chunks for the next call
+    mem_use(prev);
+    return rc;
+}
+
+/* Frees a context and all of its memory. */
+void deriv_free(deriv_ctx *ctx) {
+    if (ctx != NULL) {
+        mem_free(ctx->ar);
+        free(ctx->buf);
+        free(ctx);
+    }
+}
+
+/*
+ * Limits each request on ctx to sec seconds of CPU time and bytes of working memory, 0 meaning no
+ * limit; a request over a limit fails with DERIV_ETIME or DERIV_ELIMIT. With ctx NULL, sets the
+ * limits of deriv_str() and of contexts made afterwards, before any thread uses them.
+ */
+void deriv_limit(deriv_ctx *ctx, double sec, size_t bytes) {
+    if (ctx != NULL) {
+        ctx->sec = sec;
+        ctx->bytes = bytes;
+    } else {
+        deriv_sec = sec;
+        deriv_bytes = bytes;
+    }
+}
+
+/* Makes a context; flags is 0 or DERIV_STRING. Returns NULL when out of memory. */
+deriv_ctx *deriv_new(int flags) {
+    deriv_ctx *ctx = (deriv_ctx *) malloc(sizeof(deriv_ctx));
+    if (ctx == NULL) {
+        return NULL;
+    }
+    if ((ctx->ar = mem_new()) == NULL) {
+        free(ctx);
+        return NULL;
+    }
+    ctx->flags = flags;
+    ctx->buf = NULL;
+    ctx->cap = 0;
+    ctx->sec = deriv_sec;
+    ctx->bytes = deriv_bytes;
+    ctx->cancel = 0;
+
+    return ctx;
+}
+
+/* Parses str into nd and differentiates it into df, both simplified; returns 0 or a DERIV_E* code. */
+static int deriv_nodes(char *str, node **nd, node **df) {
+    if (!par_paired(str, strlen(str))) {
+        return DERIV_EPAREN;
+    }
+
+    jmp_buf jb;
+    int code = setjmp(jb);
+    if (code != 0) {
+        return code;
+    }
+    gov_enter(&jb, deriv_sec, deriv_bytes, &deriv_cancels);
+
+    *nd = into_node(str);
+    if (*nd != NULL) {
+        *nd = simp_node(*nd);
+        *df = simp_node(diff_node(*nd));
+    }
+    gov_leave();
+
+    return (*nd != NULL) ? 0 : DERIV_EINVAL;
+}
+
+/* Differentiates str under the given limits; see deriv_str(). */
+static char *deriv_run(char *str, int flags, double sec, size_t bytes, int *cancel, int *err) {
+    if (!par_paired(str, strlen(str))) {
+        *err = DERIV_EPAREN;
+        return NULL;
+    }
+
+    jmp_buf jb;
+    int code = setjmp(jb);
+    if (code != 0) {                                       // gov_check() gave up on the request
+        *err = code;
+        return NULL;
+    }
+    gov_enter(&jb, sec, bytes, cancel);
+
+    char *derv;
+    if (!(flags & DERIV_STRING)) {
+        node *nd = into_node(str);
+        if (nd == NULL) {
+            gov_leave();
+            *err = DERIV_EINVAL;
+            return NULL;
+        }
+        derv = node_str(simp_node(diff_node(simp_node(nd))));
+    } else {
+        derv = differentiate(simp_input(str), 1);
+        derv = simp_output(derv);
+        derv = strip_par(derv);
+    }
+    gov_leave();
+
+    if (strcmp(derv, "") == 0) {
+        return "0";
+    } else if (*derv == '+') {
+        return derv + 1;
+    } else {
+        return derv;
+    }
+}
+
+/*
+ * Differentiates str, which has no spaces, in the arena in use, under the limits set with
+ * deriv_limit(NULL, ...). Returns the derivative, valid until the next mem_reset(), or NULL with
+ * the DERIV_E* code in err.
+ */
+char *deriv_str(char *str, int flags, int *err) {
+    return deriv_run(str, flags, deriv_sec, deriv_bytes, &deriv_cancels, err);
+}
+
+/* Describes a DERIV_E* code. */
+const char *deriv_strerror(long code) {
+    if (code == DERIV_EPAREN) {
+        return "uneven number of open/closed parentheses";
+    } else if (code == DERIV_EINVAL) {
+        return "invalid input";
+    } else if (code == DERIV_ENOMEM) {
+        return "out of memory";
+    } else if (code == DERIV_ESPACE) {
+        return "output buffer too small";
+    } else if (code == DERIV_ESHUT) {
+        return "ring server has quit";
+    } else if (code == DERIV_ETIME) {
+        return "time limit exceeded";
+    } else if (code == DERIV_ELIMIT) {
+        return "memory limit exceeded";
+    } else if (code == DERIV_ECANCEL) {
+        return "cancelled";
+    } else if (code == DERIV_EDEEP) {
+        return "expression nested too deeply";
+    } else if (code == DERIV_EBUILD) {
+        return "could not build the shared object";
+    } else {
+        return "no error";
+    }
+}
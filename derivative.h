@@ -0,0 +1,85 @@
+/*
+ * derivative.h
+ * Library interface of the differentiation engine
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef DERIVATIVE_H
+#define DERIVATIVE_H
+
+#include <stddef.h>
+
+#define DERIV_TREE 1                                       // deriv_new() flag: the expression tree, now the default
+#define DERIV_STRING 4                                     // deriv_new() flag: the string engine that rescans the text
+#define DERIV_FUNC 2                                       // deriv_compile() flag: compile the function as well
+
+#define DERIV_EPAREN (-1)                                  // uneven number of open/closed parentheses
+#define DERIV_EINVAL (-2)                                  // input the expression tree cannot represent
+#define DERIV_ENOMEM (-3)                                  // no context, or no memory for the results
+#define DERIV_ESPACE (-4)                                  // result past the end of the output buffer
+#define DERIV_ESHUT (-5)                                   // the ring server has quit
+#define DERIV_ETIME (-6)                                   // past the CPU time limit of the request
+#define DERIV_ELIMIT (-7)                                  // past the memory limit of the request
+#define DERIV_ECANCEL (-8)                                 // stopped by deriv_cancel()
+#define DERIV_EDEEP (-9)                                   // nested too deeply for the stack
+#define DERIV_EBUILD (-10)                                 // the C compiler of deriv_build() failed
+
+/*
+ * A context owns the memory of the requests made through it. Different contexts can be used
+ * from different threads at the same time; one context serves one call at a time.
+ */
+typedef struct deriv_ctx deriv_ctx;
+
+/* A compiled derivative, evaluated with deriv_eval(). */
+typedef struct deriv_prog deriv_prog;
+
+/* A compiled derivative at one point, from deriv_jit(). */
+typedef double (*deriv_fn)(double x);
+
+/* A client's view of the shared-memory ring of a server started with -r; usable from any thread. */
+typedef struct deriv_ring deriv_ring;
+
+int deriv_build(const deriv_prog *prog, const char *prefix, const char *path);
+long deriv_bulk(deriv_ctx *ctx, const char *input, const size_t *off, size_t n,
+                char **out, size_t cap, size_t *out_off, long *stat);
+void deriv_cancel(deriv_ctx *ctx);
+deriv_prog *deriv_compile(const char *input, size_t len, int flags, int *err);
+long deriv_differentiate(deriv_ctx *ctx, const char *input, size_t len, char *out, size_t cap);
+long deriv_emit(const deriv_prog *prog, const char *prefix, char *out, size_t cap);
+void deriv_eval(const deriv_prog *prog, const double *x, size_t n, double *df, double *f);
+void deriv_evalf(const deriv_prog *prog, const float *x, size_t n, float *df, float *f);
+void deriv_free(deriv_ctx *ctx);
+long deriv_grid(const deriv_prog *prog, double a, double b, double step, size_t n, int n_thr, double *df, double *f);
+deriv_fn deriv_jit(deriv_prog *prog, int out);
+void deriv_limit(deriv_ctx *ctx, double sec, size_t bytes);
+void *deriv_load(const char *path, const char *prefix, deriv_fn *df, deriv_fn *f);
+deriv_ctx *deriv_new(int flags);
+void deriv_prog_free(deriv_prog *prog);
+long deriv_ring_call(deriv_ring *ring, const char *input, size_t len, char *out, size_t cap);
+void deriv_ring_close(deriv_ring *ring);
+deriv_ring *deriv_ring_open(const char *name);
+char *deriv_str(char *str, int flags, int *err);
+const char *deriv_strerror(long code);
+
+#endif
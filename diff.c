@@ -28,40 +28,153 @@
 #include <stdlib.h>
 #include <string.h>
 #include "diff.h"
+#include "gov.h"
+#include "lex.h"
+#include "mem.h"
+#include "node.h"
 #include "parse.h"
 #include "struct.h"
 #include "utility.h"
 
+/*
+ * Per-request memo of differentiate(), keyed on the mode and on str without its enclosing
+ * parentheses, so that a subexpression repeated across terms, factors or components is only
+ * differentiated once. Results are never written to by the callers, so they can be shared.
+ * Like the arena it lives in, the memo is per thread.
+ */
+typedef struct df_memo {
+    char *key;
+    int mode;
+    char *val;
+} df_memo;
+
+static _Thread_local struct {
+    unsigned long epoch;                                   // mem_epoch() the table was allocated in
+    df_memo *slot;
+    int cap;
+    int cnt;
+    long hit;
+    long miss;
+} memo = {0, NULL, 0, 0, 0, 0};
+
+static unsigned long df_hash(char *str, int mode) {
+    unsigned long h = 1469598103934665603UL ^ mode;
+    for (; *str != 0; str++) {
+        h = (h ^ (unsigned char) *str) * 1099511628211UL;
+    }
+    return h ^ (h >> 29);
+}
+
+/*
+ * Starts the table for a new request, or doubles it. The memo only changes once the new table is
+ * filled, so a request failing over its memory limit in mem_alloc() leaves it as it was.
+ */
+static void memo_grow(void) {
+    df_memo *old = memo.slot;
+    int old_cap = memo.cap, ind;
+    bool fresh = (memo.epoch != mem_epoch());              // the old table went with mem_reset()
+
+    if (fresh) {
+        old = NULL;
+        old_cap = 0;
+    }
+    int cap = (old_cap == 0) ? 64 : old_cap * 2;
+    df_memo *slot = (df_memo *) mem_alloc(sizeof(df_memo) * cap);
+
+    for (ind = 0; (old != NULL) && (ind < old_cap); ind++) {
+        if (old[ind].key != NULL) {
+            unsigned long h = df_hash(old[ind].key, old[ind].mode);
+            while (slot[h & (cap - 1)].key != NULL) {
+                h++;
+            }
+            slot[h & (cap - 1)] = old[ind];
+        }
+    }
+
+    if (fresh) {
+        memo.cnt = 0;
+        memo.hit = 0;
+        memo.miss = 0;
+    }
+    memo.epoch = mem_epoch();
+    memo.slot = slot;
+    memo.cap = cap;
+}
+
+/* Returns the slot of key, empty if it has not been differentiated yet. */
+static df_memo *memo_find(char *key, int mode) {
+    if ((memo.slot == NULL) || (memo.epoch != mem_epoch()) || (2 * (memo.cnt + 1) > memo.cap)) {
+        memo_grow();
+    }
+
+    unsigned long h = df_hash(key, mode);
+    df_memo *slot;
+    for (slot = memo.slot + (h & (memo.cap - 1)); slot->key != NULL; slot = memo.slot + (++h & (memo.cap - 1))) {
+        if ((slot->mode == mode) && (strcmp(slot->key, key) == 0)) {
+            break;
+        }
+    }
+    return slot;
+}
+
+/* Reports the memo hits and misses of the current request. */
+void diff_stats(long *hit, long *miss) {
+    bool cur = (memo.epoch == mem_epoch());
+    *hit = cur ? memo.hit : 0;
+    *miss = cur ? memo.miss : 0;
+}
+
+static char *diff_str(char *str, int mode);
+
 char *differentiate(char *str, int mode) {                 // mode determines whether to recurse
+    gov_check();
+
+    char *key = str;
+    key = strip_par(key);
+
+    df_memo *slot = memo_find(key, mode);
+    if (slot->key != NULL) {
+        memo.hit++;
+        return slot->val;
+    }
+    memo.miss++;
+
+    char *val = diff_str(key, mode);
+
+    slot = memo_find(key, mode);                           // the recursion may have grown the table
+    slot->key = str_dup(key);
+    slot->mode = mode;
+    slot->val = val;
+    memo.cnt++;
+
+    return val;
+}
+
+static char *diff_str(char *str, int mode) {
     /* to preserve the original str */
-    char *str_cpy = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-    strcpy(str_cpy, str);
+    char *str_cpy = str_dup(str);
 
     /* counteracts a parentheses-enclosed entity is not composite */
-    while (par_enclosed(str_cpy)) {
-        str_cpy = rm_par(str_cpy);
-    }
+    str_cpy = strip_par(str_cpy);
 
     int num_tm = n_term(str_cpy), num_bl = n_block(str_cpy);
-    char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR);
+    str_bld rt_str = bld_new("");
 
     if ((num_tm == 1) && (num_bl == 1)) {
         if ((mode == 1) && (is_composite(str_cpy))) {
             /* into elements */
             comp *cp = into_comp(str_cpy);
 
-            strcpy(rt_str, "");
+            rt_str = bld_new("");
             while (cp->elem != NULL) {
-                while (par_enclosed(cp->elem->entry)) {
-                    cp->elem->entry = rm_par(cp->elem->entry);
-                }
-                strcat(rt_str, "(");
-                strcat(rt_str, differentiate(cp->elem->entry, 0));
-                strcat(rt_str, ")");
+                cp->elem->entry = strip_par(cp->elem->entry);
+                bld_cat(&rt_str, "(");
+                bld_cat(&rt_str, differentiate(cp->elem->entry, 0));
+                bld_cat(&rt_str, ")");
                 cp->elem = cp->elem->next;
             }
 
-            return rt_str;
+            return rt_str.str;
         } else {
             /* convert into derivative */
             return fn_diff(str_cpy);
@@ -70,24 +183,22 @@ char *differentiate(char *str, int mode) {                 // mode determines wh
         term *tm = into_term(str_cpy);                     // into terms
         bool op = false;
 
-        strcpy(rt_str, "(");
+        rt_str = bld_new("(");
         while (tm->segm != NULL) {
             if (!op) {
                 /* either break it down further or recurse */
-                while (par_enclosed(tm->segm->entry)) {
-                    tm->segm->entry = rm_par(tm->segm->entry);
-                }
-                strcat(rt_str, differentiate(tm->segm->entry, 1));
+                tm->segm->entry = strip_par(tm->segm->entry);
+                bld_cat(&rt_str, differentiate(tm->segm->entry, 1));
                 op = true;
             } else {
-                strcat(rt_str, tm->segm->entry);           // operator stored
+                bld_cat(&rt_str, tm->segm->entry); // operator stored
                 op = false;
             }
             tm->segm = tm->segm->next;
         }
-        strcat(rt_str, ")");
+        bld_cat(&rt_str, ")");
 
-        return rt_str;
+        return rt_str.str;
     } else if (num_bl != 1) {
         block *bl = into_block(str_cpy);
         list *mult_head = bl->mult;                        // to apply product rule
@@ -107,41 +218,35 @@ char *differentiate(char *str, int mode) {                 // mode determines wh
 
         /* remove all enclosing parentheses */
         while (mult_curr != NULL) {
-            while (par_enclosed(mult_curr->entry)) {
-                mult_curr->entry = rm_par(mult_curr->entry);
-            }
+            mult_curr->entry = strip_par(mult_curr->entry);
             mult_curr = mult_curr->next;
         }
         mult_curr = mult_head;
         while (divi_curr != NULL) {
-            while (par_enclosed(divi_curr->entry)) {
-                divi_curr->entry = rm_par(divi_curr->entry);
-            }
+            divi_curr->entry = strip_par(divi_curr->entry);
             divi_curr = divi_curr->next;
         }
         divi_curr = divi_head;
 
         if (n_divi == 0) {                                 // without division rule
-            strcpy(rt_str, "(");
+            rt_str = bld_new("(");
             int targ_ind, curr_ind;
-            char *df_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            char *df_str = str_dup("");
 
             for (targ_ind = 0; targ_ind < n_mult; targ_ind++) {
                 mult_curr = mult_head;
 
                 for (curr_ind = 0; curr_ind < n_mult; curr_ind++) {
                     if (targ_ind == curr_ind) {
-                        strcpy(df_str, differentiate(mult_curr->entry, 1));
-                        while (par_enclosed(df_str)) {
-                            df_str = rm_par(df_str);
-                        }
-                        strcat(rt_str, "(");
-                        strcat(rt_str, df_str);
-                        strcat(rt_str, ")");
+                        df_str = str_dup(differentiate(mult_curr->entry, 1));
+                        df_str = strip_par(df_str);
+                        bld_cat(&rt_str, "(");
+                        bld_cat(&rt_str, df_str);
+                        bld_cat(&rt_str, ")");
                     } else {
-                        strcat(rt_str, "(");
-                        strcat(rt_str, mult_curr->entry);
-                        strcat(rt_str, ")");
+                        bld_cat(&rt_str, "(");
+                        bld_cat(&rt_str, mult_curr->entry);
+                        bld_cat(&rt_str, ")");
                     }
 
                     if (curr_ind != (n_mult - 1)) {
@@ -150,36 +255,34 @@ char *differentiate(char *str, int mode) {                 // mode determines wh
                 }
                 
                 if (targ_ind != (n_mult - 1)) {
-                    strcat(rt_str, "+");
+                    bld_cat(&rt_str, "+");
                 }
             }
-            strcat(rt_str, ")");
+            bld_cat(&rt_str, ")");
 
-            return rt_str;
+            return rt_str.str;
         } else {
             if (has_var(divi_curr)) {
                 /* with division rule */
                 int targ_ind, curr_ind;
-                char *df_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                char *df_hi_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                char *df_lo_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+                char *df_str = str_dup("");
+                str_bld df_hi = bld_new("");
+                str_bld df_lo = bld_new("");
 
                 for (targ_ind = 0; targ_ind < n_mult; targ_ind++) {
                     mult_curr = mult_head;
 
                     for (curr_ind = 0; curr_ind < n_mult; curr_ind++) {
                         if (targ_ind == curr_ind) {
-                            strcpy(df_str, differentiate(mult_curr->entry, 1));
-                            while (par_enclosed(df_str)) {
-                                df_str = rm_par(df_str);
-                            } 
-                            strcat(df_hi_str, "(");
-                            strcat(df_hi_str, df_str);
-                            strcat(df_hi_str, ")");
+                            df_str = str_dup(differentiate(mult_curr->entry, 1));
+                            df_str = strip_par(df_str); 
+                            bld_cat(&df_hi, "(");
+                            bld_cat(&df_hi, df_str);
+                            bld_cat(&df_hi, ")");
                         } else {
-                            strcat(df_hi_str, "(");
-                            strcat(df_hi_str, mult_curr->entry);
-                            strcat(df_hi_str, ")");
+                            bld_cat(&df_hi, "(");
+                            bld_cat(&df_hi, mult_curr->entry);
+                            bld_cat(&df_hi, ")");
                         }
 
                         if (curr_ind != (n_mult - 1)) {
@@ -188,7 +291,7 @@ char *differentiate(char *str, int mode) {                 // mode determines wh
                     }
                 
                     if (targ_ind != (n_mult - 1)) {
-                        strcat(df_hi_str, "+");
+                        bld_cat(&df_hi, "+");
                     }
                 }
                 mult_curr = mult_head;
@@ -198,17 +301,15 @@ char *differentiate(char *str, int mode) {                 // mode determines wh
 
                     for (curr_ind = 0; curr_ind < n_divi; curr_ind++) {
                         if (targ_ind == curr_ind) {
-                            strcpy(df_str, differentiate(divi_curr->entry, 1));
-                            while (par_enclosed(df_str)) {
-                                df_str = rm_par(df_str);
-                            } 
-                            strcat(df_lo_str, "(");
-                            strcat(df_lo_str, df_str);
-                            strcat(df_lo_str, ")");
+                            df_str = str_dup(differentiate(divi_curr->entry, 1));
+                            df_str = strip_par(df_str); 
+                            bld_cat(&df_lo, "(");
+                            bld_cat(&df_lo, df_str);
+                            bld_cat(&df_lo, ")");
                         } else {
-                            strcat(df_lo_str, "(");
-                            strcat(df_lo_str, divi_curr->entry);
-                            strcat(df_lo_str, ")");
+                            bld_cat(&df_lo, "(");
+                            bld_cat(&df_lo, divi_curr->entry);
+                            bld_cat(&df_lo, ")");
                         }
 
                         if (curr_ind != (n_divi - 1)) {
@@ -217,106 +318,101 @@ char *differentiate(char *str, int mode) {                 // mode determines wh
                     }
                 
                     if (targ_ind != (n_divi - 1)) {
-                        strcat(df_lo_str, "+");
+                        bld_cat(&df_lo, "+");
                     }
                 }
                 divi_curr = divi_head;
 
-                while (par_enclosed(df_hi_str)) {
-                    df_hi_str = rm_par(df_hi_str);
-                }
-                while (par_enclosed(df_lo_str)) {
-                    df_lo_str = rm_par(df_lo_str);
-                }
+                char *df_hi_str = df_hi.str, *df_lo_str = df_lo.str;
+                df_hi_str = strip_par(df_hi_str);
+                df_lo_str = strip_par(df_lo_str);
 
                 /* derivative of the top */
-                strcpy(rt_str, "((");
+                rt_str = bld_new("((");
            
-                strcat(rt_str, "(");
-                strcat(rt_str, df_hi_str);
-                strcat(rt_str, ")");
+                bld_cat(&rt_str, "(");
+                bld_cat(&rt_str, df_hi_str);
+                bld_cat(&rt_str, ")");
 
                 while (divi_curr != NULL) {
-                    strcat(rt_str, "(");
-                    strcat(rt_str, divi_curr->entry);
-                    strcat(rt_str, ")");
+                    bld_cat(&rt_str, "(");
+                    bld_cat(&rt_str, divi_curr->entry);
+                    bld_cat(&rt_str, ")");
 
                     divi_curr = divi_curr->next;
                 }
                 divi_curr = divi_head;
-                strcat(rt_str, "-");
+                bld_cat(&rt_str, "-");
 
                 /* derivative of the bottom */
                 while (mult_curr != NULL) {
-                    strcat(rt_str, "(");
-                    strcat(rt_str, mult_curr->entry);
-                    strcat(rt_str, ")");
+                    bld_cat(&rt_str, "(");
+                    bld_cat(&rt_str, mult_curr->entry);
+                    bld_cat(&rt_str, ")");
 
                     mult_curr = mult_curr->next;
                 }
                 mult_curr = mult_head;
                 
-                strcat(rt_str, "(");
-                strcat(rt_str, df_lo_str);
-                strcat(rt_str, ")");
+                bld_cat(&rt_str, "(");
+                bld_cat(&rt_str, df_lo_str);
+                bld_cat(&rt_str, ")");
 
                 if (n_divi == 1) {
                     if (n_block(divi_curr->entry) == 1) {
-                        strcat(rt_str, ")/(");
+                        bld_cat(&rt_str, ")/(");
                         while (divi_curr != NULL) {
-                            strcat(rt_str, divi_curr->entry);
+                            bld_cat(&rt_str, divi_curr->entry);
                         
                             divi_curr = divi_curr->next;
                         }
                         divi_curr = divi_head;
-                        strcat(rt_str, "^2))");
+                        bld_cat(&rt_str, "^2))");
                     } else {
-                        strcat(rt_str, ")/((");
+                        bld_cat(&rt_str, ")/((");
                         while (divi_curr != NULL) {
-                            strcat(rt_str, divi_curr->entry);
+                            bld_cat(&rt_str, divi_curr->entry);
                             
                             divi_curr = divi_curr->next;
                         }
                         divi_curr = divi_head;
-                        strcat(rt_str, ")^2))");
+                        bld_cat(&rt_str, ")^2))");
                     }
                 } else {
-                    strcat(rt_str, ")/((");
+                    bld_cat(&rt_str, ")/((");
                     while (divi_curr != NULL) {
-                        strcat(rt_str, "(");
-                        strcat(rt_str, divi_curr->entry);
-                        strcat(rt_str, ")");
+                        bld_cat(&rt_str, "(");
+                        bld_cat(&rt_str, divi_curr->entry);
+                        bld_cat(&rt_str, ")");
 
                         divi_curr = divi_curr->next;
                     }
                     divi_curr = divi_head;
-                    strcat(rt_str, ")^2))");
+                    bld_cat(&rt_str, ")^2))");
                 }
 
-                return rt_str;
+                return rt_str.str;
             } else {
                 /* simply divide */
-                strcpy(rt_str, "(");
+                rt_str = bld_new("(");
                 int targ_ind, curr_ind;
-                char *df_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+                char *df_str = str_dup("");
 
                 for (targ_ind = 0; targ_ind < n_mult; targ_ind++) {
                     mult_curr = mult_head;
 
                     for (curr_ind = 0; curr_ind < n_mult; curr_ind++) {
                         if (targ_ind == curr_ind) {
-                            strcpy(df_str, differentiate(mult_curr->entry, 1));
-
-                            while (par_enclosed(df_str)) {
-                                df_str = rm_par(df_str);
-                            }
-                            strcat(rt_str, "(");
-                            strcat(rt_str, df_str);
-                            strcat(rt_str, ")");
+                            df_str = str_dup(differentiate(mult_curr->entry, 1));
+
+                            df_str = strip_par(df_str);
+                            bld_cat(&rt_str, "(");
+                            bld_cat(&rt_str, df_str);
+                            bld_cat(&rt_str, ")");
                         } else {
-                            strcat(rt_str, "(");
-                            strcat(rt_str, mult_curr->entry);
-                            strcat(rt_str, ")");
+                            bld_cat(&rt_str, "(");
+                            bld_cat(&rt_str, mult_curr->entry);
+                            bld_cat(&rt_str, ")");
                         }
 
                         if (curr_ind != (n_mult - 1)) {
@@ -325,15 +421,13 @@ char *differentiate(char *str, int mode) {                 // mode determines wh
                     }
                 
                     if (targ_ind != (n_mult - 1)) {
-                        strcat(rt_str, "+");
+                        bld_cat(&rt_str, "+");
                     }
                 }
 
                 bool dec = false;
                 while (divi_curr != NULL) {
-                    while (par_enclosed(divi_curr->entry)) {
-                        divi_curr->entry = rm_par(divi_curr->entry);
-                    }
+                    divi_curr->entry = strip_par(divi_curr->entry);
 
                     if (has_dec(divi_curr->entry)) {
                         dec = true;
@@ -348,395 +442,372 @@ char *differentiate(char *str, int mode) {                 // mode determines wh
                         prod *= str_int(divi_curr->entry);
                         divi_curr = divi_curr->next;
                     }
-                    strcat(rt_str, "/(");
-                    strcat(rt_str, int_str(prod));
-                    strcat(rt_str, ")");
+                    bld_cat(&rt_str, "/(");
+                    bld_cat(&rt_str, int_str(prod));
+                    bld_cat(&rt_str, ")");
                 } else if (n_divi == 1) {
-                    strcat(rt_str, "/");
+                    bld_cat(&rt_str, "/");
                     while (divi_curr != NULL) {
-                        strcat(rt_str, "(");
-                        strcat(rt_str, divi_curr->entry);
-                        strcat(rt_str, ")");
+                        bld_cat(&rt_str, "(");
+                        bld_cat(&rt_str, divi_curr->entry);
+                        bld_cat(&rt_str, ")");
                         divi_curr = divi_curr->next;
                     }
-                    strcat(rt_str, ")");
+                    bld_cat(&rt_str, ")");
                 } else {
-                    strcat(rt_str, "/(");
+                    bld_cat(&rt_str, "/(");
                     while (divi_curr != NULL) {
-                        strcat(rt_str, "(");
-                        strcat(rt_str, divi_curr->entry);
-                        strcat(rt_str, ")");
+                        bld_cat(&rt_str, "(");
+                        bld_cat(&rt_str, divi_curr->entry);
+                        bld_cat(&rt_str, ")");
                         divi_curr = divi_curr->next;
                     }
-                    strcat(rt_str, "))");
+                    bld_cat(&rt_str, "))");
                 }
-                strcat(rt_str, ")");
+                bld_cat(&rt_str, ")");
 
-                return rt_str;
+                return rt_str.str;
             }
         }
     }
 }
 
 char *fn_diff(char *str) {
-    char *str_cpy = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-    strcpy(str_cpy, str);
+    gov_check();
+
+    char *str_cpy = str_dup(str);
 
     fn_type fn_tp = id_fn_tp(str_cpy);
 
     if (fn_tp == cnst) {
         return "(0)";
     } else if (fn_tp == expo) {
-        while (par_enclosed(str_cpy)) {
-            str_cpy = rm_par(str_cpy);
-        }
+        str_cpy = strip_par(str_cpy);
 
         /* (d/dx)(a^x) = (a^x)ln(a) */
-        char *pt = strpbrk(str_cpy, "^");
-        while (!par_paired(str_cpy, pt - str_cpy)) {
-           pt = strpbrk(pt + 1, "^");
-        }
+        char *pt = top_pbrk(str_cpy, "^");
 
-        char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-        char *bef_ast = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-        char *aft_ast = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-        strncpy(bef_ast, str_cpy, pt - str_cpy);
-        strcpy(aft_ast, pt + 1);
+        str_bld rt_str = bld_new("");
+        char *bef_ast = str_ndup(str_cpy, pt - str_cpy);
+        char *aft_ast = str_dup(pt + 1);
         
-        while (par_enclosed(bef_ast)) {
-            bef_ast = rm_par(bef_ast);
-        }
-        while (par_enclosed(aft_ast)) {
-            aft_ast = rm_par(aft_ast);
-        }
+        bef_ast = strip_par(bef_ast);
+        aft_ast = strip_par(aft_ast);
 
         /* (d/dx)(e^x) = e^x */
         if (strcmp(bef_ast, "e") == 0) {
             return str_cpy;
         }
 
-        strcpy(rt_str, "(");
+        rt_str = bld_new("(");
         if ((n_term(bef_ast) != 1) || (n_block(bef_ast) != 1)) {
-            strcat(rt_str, "(");
-            strcat(rt_str, bef_ast);
-            strcat(rt_str, ")");
+            bld_cat(&rt_str, "(");
+            bld_cat(&rt_str, bef_ast);
+            bld_cat(&rt_str, ")");
         } else {
-            strcat(rt_str, bef_ast);
+            bld_cat(&rt_str, bef_ast);
         }
-        strcat(rt_str, "^");
+        bld_cat(&rt_str, "^");
 
         if ((n_term(aft_ast) != 1) || (n_block(aft_ast) != 1)) {
-            strcat(rt_str, "(");
-            strcat(rt_str, aft_ast);
-            strcat(rt_str, ")");
+            bld_cat(&rt_str, "(");
+            bld_cat(&rt_str, aft_ast);
+            bld_cat(&rt_str, ")");
         } else {
-            strcat(rt_str, aft_ast);
+            bld_cat(&rt_str, aft_ast);
         }
 
-        strcat(rt_str, ")");
-        strcat(rt_str, "ln(");
-        strcat(rt_str, bef_ast);
-        strcat(rt_str, ")");
+        bld_cat(&rt_str, ")");
+        bld_cat(&rt_str, "ln(");
+        bld_cat(&rt_str, bef_ast);
+        bld_cat(&rt_str, ")");
         
-        return rt_str;
+        return rt_str.str;
     } else if (fn_tp == hypl) {
-        while (par_enclosed(str_cpy)) {
-            str_cpy = rm_par(str_cpy);
-        }
+        str_cpy = strip_par(str_cpy);
 
-        char *pt = strpbrk(str_cpy, "sct");
-        while (!par_paired(str_cpy, pt - str_cpy)) {
-            pt = strpbrk(pt + 1, "sct");
-        }
+        char *pt = top_pbrk(str_cpy, "sct");
+
+        fn_name nm;
+        nm_len(pt, &nm);
 
-        if (strncmp(pt, "sinh", 4) == 0) {
+        if (nm == nm_sinh) {
             /* (d/dx)(sinh(x)) = cosh(x) */
             pt[0] = 'c';
             pt[1] = 'o';
             pt[2] = 's';
 
             if (!par_enclosed(pt + 4)) {
-                char *temp_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                strcpy(temp_str, pt + 4);
-
-                strcpy(pt + 4, "(");
-                strcat(pt + 4, temp_str);
-                strcat(pt + 4, ")");
-            }
-            while (par_enclosed(rm_par(pt + 4))) {
-                strcpy(pt + 4, rm_par(pt + 4));
+                int at = (pt - str_cpy) + 4;
+                char *temp_str = str_dup(pt + 4);
+
+                str_cpy[at] = 0;                           // str_cpy grows by the parentheses
+                str_cpy = str_cat(str_cpy, "(");
+                str_cpy = str_cat(str_cpy, temp_str);
+                str_cpy = str_cat(str_cpy, ")");
+                pt = str_cpy + at - 4;
             }
+            trim_par(pt + 4);
             
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            str_bld rt_str = bld_new("");
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 if (str_cpy[0] == '-') {
-                    strcpy(rt_str, "(");
-                    strcat(rt_str, str_cpy);
-                    strcat(rt_str, ")");
+                    rt_str = bld_new("(");
+                    bld_cat(&rt_str, str_cpy);
+                    bld_cat(&rt_str, ")");
 
-                    return rt_str;
+                    return rt_str.str;
                 } else if (str_cpy[0] == '+') {
-                    strcpy(rt_str, ++str_cpy);
+                    rt_str = bld_new(++str_cpy);
 
-                    return rt_str;
+                    return rt_str.str;
                 }
             } else {
-                strcpy(rt_str, str_cpy);
+                rt_str = bld_new(str_cpy);
 
-                return rt_str;
+                return rt_str.str;
             }
-        } else if (strncmp(pt, "cosh", 4) == 0) {
+        } else if (nm == nm_cosh) {
             /* (d/dx)(cosh(x)) = sinh(x) */
             pt[0] = 's';
             pt[1] = 'i';
             pt[2] = 'n';
 
             if (!par_enclosed(pt + 4)) {
-                char *temp_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                strcpy(temp_str, pt + 4);
-
-                strcpy(pt + 4, "(");
-                strcat(pt + 4, temp_str);
-                strcat(pt + 4, ")");
-            }
-            while (par_enclosed(rm_par(pt + 4))) {
-                strcpy(pt + 4, rm_par(pt + 4));
+                int at = (pt - str_cpy) + 4;
+                char *temp_str = str_dup(pt + 4);
+
+                str_cpy[at] = 0;                           // str_cpy grows by the parentheses
+                str_cpy = str_cat(str_cpy, "(");
+                str_cpy = str_cat(str_cpy, temp_str);
+                str_cpy = str_cat(str_cpy, ")");
+                pt = str_cpy + at - 4;
             }
+            trim_par(pt + 4);
 
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            str_bld rt_str = bld_new("");
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 if (str_cpy[0] == '-') {
-                    strcpy(rt_str, "(");
-                    strcat(rt_str, str_cpy);
-                    strcat(rt_str, ")");
+                    rt_str = bld_new("(");
+                    bld_cat(&rt_str, str_cpy);
+                    bld_cat(&rt_str, ")");
 
-                    return rt_str;
+                    return rt_str.str;
                 } else if (str_cpy[0] == '+') {
-                    strcpy(rt_str, ++str_cpy);
+                    rt_str = bld_new(++str_cpy);
 
-                    return rt_str;
+                    return rt_str.str;
                 }
             } else {
-                strcpy(rt_str, str_cpy);
+                rt_str = bld_new(str_cpy);
 
-                return rt_str;
+                return rt_str.str;
             }
-        } else if (strncmp(pt, "tanh", 4) == 0) {
+        } else if (nm == nm_tanh) {
             /* (d/dx)(tanh(x)) = (sech(x))^2 */
             pt[0] = 's';
             pt[1] = 'e';
             pt[2] = 'c';
 
             if (!par_enclosed(pt + 4)) {
-                char *temp_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                strcpy(temp_str, pt + 4);
-
-                strcpy(pt + 4, "(");
-                strcat(pt + 4, temp_str);
-                strcat(pt + 4, ")");
-            }
-            while (par_enclosed(rm_par(pt + 4))) {
-                strcpy(pt + 4, rm_par(pt + 4));
+                int at = (pt - str_cpy) + 4;
+                char *temp_str = str_dup(pt + 4);
+
+                str_cpy[at] = 0;                           // str_cpy grows by the parentheses
+                str_cpy = str_cat(str_cpy, "(");
+                str_cpy = str_cat(str_cpy, temp_str);
+                str_cpy = str_cat(str_cpy, ")");
+                pt = str_cpy + at - 4;
             }
+            trim_par(pt + 4);
 
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            str_bld rt_str = bld_new("");
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 if (str_cpy[0] == '-') {
-                    strcpy(rt_str, "(");
-                    strcat(rt_str, str_cpy);
-                    strcat(rt_str, "^2)");
+                    rt_str = bld_new("(");
+                    bld_cat(&rt_str, str_cpy);
+                    bld_cat(&rt_str, "^2)");
 
-                    return rt_str;
+                    return rt_str.str;
                 } else if (str_cpy[0] == '+') {
-                    strcpy(rt_str, "(");
-                    strcat(rt_str, ++str_cpy);
-                    strcat(rt_str, "^2)");
+                    rt_str = bld_new("(");
+                    bld_cat(&rt_str, ++str_cpy);
+                    bld_cat(&rt_str, "^2)");
 
-                    return rt_str;
+                    return rt_str.str;
                 }
             } else {
-                strcpy(rt_str, "(");
-                strcat(rt_str, str_cpy);
-                strcat(rt_str, "^2)");
+                rt_str = bld_new("(");
+                bld_cat(&rt_str, str_cpy);
+                bld_cat(&rt_str, "^2)");
 
-                return rt_str;
+                return rt_str.str;
             }
-        } else if (strncmp(pt, "csch", 4) == 0) {
+        } else if (nm == nm_csch) {
             /* (d/dx)(csch(x)) = -csch(x)coth(x) */
             if (!par_enclosed(pt + 4)) {
-                char *temp_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                strcpy(temp_str, pt + 4);
-
-                strcpy(pt + 4, "(");
-                strcat(pt + 4, temp_str);
-                strcat(pt + 4, ")");
-            }
-            while (par_enclosed(rm_par(pt + 4))) {
-                strcpy(pt + 4, rm_par(pt + 4));
+                int at = (pt - str_cpy) + 4;
+                char *temp_str = str_dup(pt + 4);
+
+                str_cpy[at] = 0;                           // str_cpy grows by the parentheses
+                str_cpy = str_cat(str_cpy, "(");
+                str_cpy = str_cat(str_cpy, temp_str);
+                str_cpy = str_cat(str_cpy, ")");
+                pt = str_cpy + at - 4;
             }
+            trim_par(pt + 4);
    
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            str_bld rt_str = bld_new("");
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 if (str_cpy[0] == '-') {
-                    strcpy(rt_str, ++str_cpy);
+                    rt_str = bld_new(++str_cpy);
                 } else if (str_cpy[0] == '+') {
-                    strcpy(rt_str, "(-");
-                    strcat(rt_str, ++str_cpy);
+                    rt_str = bld_new("(-");
+                    bld_cat(&rt_str, ++str_cpy);
                 }
             } else {
-                strcpy(rt_str, "(-");
-                strcat(rt_str, str_cpy);
+                rt_str = bld_new("(-");
+                bld_cat(&rt_str, str_cpy);
             }
 
             pt[0] = 'c';
             pt[1] = 'o';
             pt[2] = 't';
 
-            strcat(rt_str, str_cpy);
-            if (rt_str[0] == '(') {
-                strcat(rt_str, ")");
+            bld_cat(&rt_str, str_cpy);
+            if (rt_str.str[0] == '(') {
+                bld_cat(&rt_str, ")");
             }
 
-            return rt_str;
-        } else if (strncmp(pt, "sech", 4) == 0) {
+            return rt_str.str;
+        } else if (nm == nm_sech) {
             /* (d/dx)(sech(x)) = -sech(x)tanh(x) */
             if (!par_enclosed(pt + 4)) {
-                char *temp_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                strcpy(temp_str, pt + 4);
-
-                strcpy(pt + 4, "(");
-                strcat(pt + 4, temp_str);
-                strcat(pt + 4, ")");
-            }
-            while (par_enclosed(rm_par(pt + 4))) {
-                strcpy(pt + 4, rm_par(pt + 4));
+                int at = (pt - str_cpy) + 4;
+                char *temp_str = str_dup(pt + 4);
+
+                str_cpy[at] = 0;                           // str_cpy grows by the parentheses
+                str_cpy = str_cat(str_cpy, "(");
+                str_cpy = str_cat(str_cpy, temp_str);
+                str_cpy = str_cat(str_cpy, ")");
+                pt = str_cpy + at - 4;
             }
+            trim_par(pt + 4);
 
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            str_bld rt_str = bld_new("");
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 if (str_cpy[0] == '-') {
-                    strcpy(rt_str, ++str_cpy);
+                    rt_str = bld_new(++str_cpy);
                 } else if (str_cpy[0] == '+') {
-                    strcpy(rt_str, "(-");
-                    strcat(rt_str, ++str_cpy);
+                    rt_str = bld_new("(-");
+                    bld_cat(&rt_str, ++str_cpy);
                 }
             } else {
-                strcpy(rt_str, "(-");
-                strcat(rt_str, str_cpy);
+                rt_str = bld_new("(-");
+                bld_cat(&rt_str, str_cpy);
             }
 
             pt[0] = 't';
             pt[1] = 'a';
             pt[2] = 'n';
 
-            strcat(rt_str, str_cpy);
-            if (rt_str[0] == '(') {
-                strcat(rt_str, ")");
+            bld_cat(&rt_str, str_cpy);
+            if (rt_str.str[0] == '(') {
+                bld_cat(&rt_str, ")");
             }
 
-            return rt_str;
-        } else if (strncmp(pt, "coth", 4) == 0) {
+            return rt_str.str;
+        } else if (nm == nm_coth) {
             /* (d/dx)(coth(x)) = -(csch(x))^2 */
             pt[0] = 'c';
             pt[1] = 's';
             pt[2] = 'c';
 
             if (!par_enclosed(pt + 4)) {
-                char *temp_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                strcpy(temp_str, pt + 4);
-
-                strcpy(pt + 4, "(");
-                strcat(pt + 4, temp_str);
-                strcat(pt + 4, ")");
-            }
-            while (par_enclosed(rm_par(pt + 4))) {
-                strcpy(pt + 4, rm_par(pt + 4));
+                int at = (pt - str_cpy) + 4;
+                char *temp_str = str_dup(pt + 4);
+
+                str_cpy[at] = 0;                           // str_cpy grows by the parentheses
+                str_cpy = str_cat(str_cpy, "(");
+                str_cpy = str_cat(str_cpy, temp_str);
+                str_cpy = str_cat(str_cpy, ")");
+                pt = str_cpy + at - 4;
             }
+            trim_par(pt + 4);
            
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            str_bld rt_str = bld_new("");
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 if (str_cpy[0] == '-') {
-                    strcpy(rt_str, "(");
-                    strcat(rt_str, ++str_cpy);
-                    strcat(rt_str, "^2)");
+                    rt_str = bld_new("(");
+                    bld_cat(&rt_str, ++str_cpy);
+                    bld_cat(&rt_str, "^2)");
 
-                    return rt_str;
+                    return rt_str.str;
                 } else if (str_cpy[0] == '+') {
-                    strcpy(rt_str, "(-");
-                    strcat(rt_str, ++str_cpy);
-                    strcat(rt_str, "^2)");
+                    rt_str = bld_new("(-");
+                    bld_cat(&rt_str, ++str_cpy);
+                    bld_cat(&rt_str, "^2)");
 
-                    return rt_str;
+                    return rt_str.str;
                 }
             } else {
-                strcpy(rt_str, "(-");
-                strcat(rt_str, str_cpy);
-                strcat(rt_str, "^2)");
+                rt_str = bld_new("(-");
+                bld_cat(&rt_str, str_cpy);
+                bld_cat(&rt_str, "^2)");
 
-                return rt_str;
+                return rt_str.str;
             }
         }
     } else if (fn_tp == loga) {
-        while (par_enclosed(str_cpy)) {
-            str_cpy = rm_par(str_cpy);
-        }
+        str_cpy = strip_par(str_cpy);
 
-        char *pt = strpbrk(str_cpy, "l");
-        while (!par_paired(str_cpy, pt - str_cpy)) {
-            pt = strpbrk(pt + 1, "l");
-        }
+        char *pt = top_pbrk(str_cpy, "l");
 
-        if (strncmp(pt, "ln", 2) == 0) {
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+        fn_name nm;
+        nm_len(pt, &nm);
+
+        if (nm == nm_ln) {
+            str_bld rt_str = bld_new("");
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 if (str_cpy[0] == '-') {
-                    strcpy(rt_str, "(-1)");
+                    rt_str = bld_new("(-1)");
                 } else {
-                    strcpy(rt_str, "(1)");
+                    rt_str = bld_new("(1)");
                 }
                 str_cpy++;
             } else {
-                strcpy(rt_str, "(1)");
+                rt_str = bld_new("(1)");
             }
 
-            while ((par_enclosed(pt + 2)) && (par_enclosed(rm_par(pt + 2)))) {
-                strcpy(pt + 2, rm_par(pt + 2));
-            }
-            strcat(rt_str, "/");
-            strcat(rt_str, pt + 2);
+            trim_par(pt + 2);
+            bld_cat(&rt_str, "/");
+            bld_cat(&rt_str, pt + 2);
 
-            return rt_str;
-        } else if (strncmp(pt, "log", 3) == 0) {
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            return rt_str.str;
+        } else if (nm == nm_log) {
+            str_bld rt_str = bld_new("");
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 if (str_cpy[0] == '-') {
-                    strcpy(rt_str, "(-1)");
+                    rt_str = bld_new("(-1)");
                 } else {
-                    strcpy(rt_str, "(1)");
+                    rt_str = bld_new("(1)");
                 }
                 str_cpy++;
             } else {
-                strcpy(rt_str, "(1)");
+                rt_str = bld_new("(1)");
             }
 
-            while ((par_enclosed(pt + 3)) && (par_enclosed(rm_par(pt + 3)))) {
-                strcpy(pt + 3, rm_par(pt + 3));
-            }
-            strcat(rt_str, "/(");
-            strcat(rt_str, pt + 3);
-            strcat(rt_str, "ln(10))");
+            trim_par(pt + 3);
+            bld_cat(&rt_str, "/(");
+            bld_cat(&rt_str, pt + 3);
+            bld_cat(&rt_str, "ln(10))");
 
-            return rt_str;
+            return rt_str.str;
         }
     } else if (fn_tp == poly) {
-        while (par_enclosed(str_cpy)) {
-            str_cpy = rm_par(str_cpy);
-        }
+        str_cpy = strip_par(str_cpy);
 
-        char *pt = strpbrk(str_cpy, "^");
-        while (!par_paired(str_cpy, pt - str_cpy)) {
-            pt = strpbrk(pt + 1, "^");
-        }
+        char *pt = top_pbrk(str_cpy, "^");
 
         if (pt == NULL) {
             pt = strpbrk(str_cpy, "x");
@@ -750,42 +821,40 @@ char *fn_diff(char *str) {
         }
 
         *(pt++) = 0;
-        while (par_enclosed(pt)) {
-            pt = rm_par(pt);
-        }
+        pt = strip_par(pt);
 
         int exp = str_int(pt);
-        char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+        str_bld rt_str = bld_new("");
         if (id_ch_tp(str_cpy[0]) == pt_sig) {
             if (str_cpy[0] == '-') {                       // has a '-' sign
                 if (exp < 0) {
-                    strcpy(rt_str, "(");
+                    rt_str = bld_new("(");
                     if ((exp * -1) != 1) {                 // no need for a coefficient of 1
-                        strcat(rt_str, int_str(exp * -1));
+                        bld_cat(&rt_str, int_str(exp * -1));
                     }
-                    strcat(rt_str, "x^");
-                    strcat(rt_str, int_str(exp - 1));
-                    strcat(rt_str, ")");
+                    bld_cat(&rt_str, "x^");
+                    bld_cat(&rt_str, int_str(exp - 1));
+                    bld_cat(&rt_str, ")");
 
-                    return rt_str;
+                    return rt_str.str;
                 } else if (exp == 0) {
                     return "(0)";
                 } else if (exp == 1) {
                     return "(-1)";
                 } else if (exp == 2) {
-                    strcpy(rt_str, "(-");
-                    strcat(rt_str, int_str(exp));
-                    strcat(rt_str, "x)");
+                    rt_str = bld_new("(-");
+                    bld_cat(&rt_str, int_str(exp));
+                    bld_cat(&rt_str, "x)");
 
-                    return rt_str;
+                    return rt_str.str;
                 } else if (exp > 0) {
-                    strcpy(rt_str, "(-");
-                    strcat(rt_str, int_str(exp));
-                    strcat(rt_str, "x^");
-                    strcat(rt_str, int_str(exp - 1));
-                    strcat(rt_str, ")");
+                    rt_str = bld_new("(-");
+                    bld_cat(&rt_str, int_str(exp));
+                    bld_cat(&rt_str, "x^");
+                    bld_cat(&rt_str, int_str(exp - 1));
+                    bld_cat(&rt_str, ")");
                     
-                    return rt_str;
+                    return rt_str.str;
                 }
             } else if (str_cpy[0] == '+') {                // has a '+' sign
                 if (exp == 0) {
@@ -793,34 +862,34 @@ char *fn_diff(char *str) {
                 } else if (exp == 1) {
                     return "(1)";
                 } else if (exp == 2) {
-                    strcpy(rt_str, "(");
-                    strcat(rt_str, int_str(exp));
-                    strcat(rt_str, "x");
-                    strcat(rt_str, ")");
+                    rt_str = bld_new("(");
+                    bld_cat(&rt_str, int_str(exp));
+                    bld_cat(&rt_str, "x");
+                    bld_cat(&rt_str, ")");
 
-                    return rt_str;
+                    return rt_str.str;
                 } else if (exp > 0) {
-                    strcpy(rt_str, "(");
-                    strcat(rt_str, int_str(exp));
-                    strcat(rt_str, "x^");
-                    strcat(rt_str, int_str(exp - 1));
-                    strcat(rt_str, ")");
+                    rt_str = bld_new("(");
+                    bld_cat(&rt_str, int_str(exp));
+                    bld_cat(&rt_str, "x^");
+                    bld_cat(&rt_str, int_str(exp - 1));
+                    bld_cat(&rt_str, ")");
 
-                    return rt_str;
+                    return rt_str.str;
                 } else if (exp == -1) {
-                    strcpy(rt_str, "(-x^");
-                    strcat(rt_str, int_str(exp - 1));
-                    strcat(rt_str, ")");
+                    rt_str = bld_new("(-x^");
+                    bld_cat(&rt_str, int_str(exp - 1));
+                    bld_cat(&rt_str, ")");
 
-                    return rt_str;
+                    return rt_str.str;
                 } else if (exp < 0) {
-                    strcpy(rt_str, "(");
-                    strcat(rt_str, int_str(exp));
-                    strcat(rt_str, "x^");
-                    strcat(rt_str, int_str(exp - 1));
-                    strcat(rt_str, ")");
+                    rt_str = bld_new("(");
+                    bld_cat(&rt_str, int_str(exp));
+                    bld_cat(&rt_str, "x^");
+                    bld_cat(&rt_str, int_str(exp - 1));
+                    bld_cat(&rt_str, ")");
 
-                    return rt_str;
+                    return rt_str.str;
                 }
             }
         } else {                                           // has no sign
@@ -829,53 +898,44 @@ char *fn_diff(char *str) {
             } else if (exp == 1) {
                 return "(1)";
             } else if (exp == 2) {
-                strcpy(rt_str, "(");
-                strcat(rt_str, int_str(exp));
-                strcat(rt_str, "x");
-                strcat(rt_str, ")");
+                rt_str = bld_new("(");
+                bld_cat(&rt_str, int_str(exp));
+                bld_cat(&rt_str, "x");
+                bld_cat(&rt_str, ")");
 
-                return rt_str;
+                return rt_str.str;
             } else if (exp > 0) {
-                strcpy(rt_str, "(");
-                strcat(rt_str, int_str(exp));
-                strcat(rt_str, "x^");
-                strcat(rt_str, int_str(exp - 1));
-                strcat(rt_str, ")");
+                rt_str = bld_new("(");
+                bld_cat(&rt_str, int_str(exp));
+                bld_cat(&rt_str, "x^");
+                bld_cat(&rt_str, int_str(exp - 1));
+                bld_cat(&rt_str, ")");
 
-                return rt_str;
+                return rt_str.str;
             } else if (exp == -1) {
-                strcpy(rt_str, "(-x^");
-                strcat(rt_str, int_str(exp - 1));
-                strcat(rt_str, ")");
+                rt_str = bld_new("(-x^");
+                bld_cat(&rt_str, int_str(exp - 1));
+                bld_cat(&rt_str, ")");
 
-                return rt_str;
+                return rt_str.str;
             } else if (exp < 0) {
-                strcpy(rt_str, "(");
-                strcat(rt_str, int_str(exp));
-                strcat(rt_str, "x^");
-                strcat(rt_str, int_str(exp - 1));
-                strcat(rt_str, ")");
+                rt_str = bld_new("(");
+                bld_cat(&rt_str, int_str(exp));
+                bld_cat(&rt_str, "x^");
+                bld_cat(&rt_str, int_str(exp - 1));
+                bld_cat(&rt_str, ")");
 
-                return rt_str;
+                return rt_str.str;
             }
         }
     } else if (fn_tp == powr) {
-        while (par_enclosed(str_cpy)) {
-            str_cpy = rm_par(str_cpy);
-        }
+        str_cpy = strip_par(str_cpy);
 
-        char *pt = strpbrk(str_cpy, "^");
-        while (!par_paired(str_cpy, pt - str_cpy)) {
-            pt = strpbrk(pt + 1, "^");
-        }
+        char *pt = top_pbrk(str_cpy, "^");
 
         *(pt++) = 0;
-        while (par_enclosed(str_cpy)) {
-            str_cpy = rm_par(str_cpy);
-        }
-        while (par_enclosed(pt)) {
-            pt = rm_par(pt);
-        }
+        str_cpy = strip_par(str_cpy);
+        pt = strip_par(pt);
 
         if (strcmp(pt, "1") == 0) {
             if (strcmp(str_cpy, "x") == 0) {               // not composite
@@ -886,271 +946,360 @@ char *fn_diff(char *str) {
         } else if (strcmp(pt, "0") == 0) {
             return "(0)";
         } else {
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            str_bld rt_str = bld_new("");
             if (strcmp(pt, "2") == 0) {
-                strcpy(rt_str, "(2)(");
-                strcat(rt_str, str_cpy);
-                strcat(rt_str, ")");
+                rt_str = bld_new("(2)(");
+                bld_cat(&rt_str, str_cpy);
+                bld_cat(&rt_str, ")");
 
-                return rt_str;
+                return rt_str.str;
             } else if ((id_fn_tp(pt) == cnst) && (!has_dec(pt))) {
                 int exp = str_int(pt);
-                strcpy(rt_str, "(");
-                strcat(rt_str, pt);
-                strcat(rt_str, ")(");
-                strcat(rt_str, str_cpy);
-                strcat(rt_str, ")^(");
-                strcat(rt_str, int_str(exp - 1));
-                strcat(rt_str, ")");
+                rt_str = bld_new("(");
+                bld_cat(&rt_str, pt);
+                bld_cat(&rt_str, ")(");
+                bld_cat(&rt_str, str_cpy);
+                bld_cat(&rt_str, ")^(");
+                bld_cat(&rt_str, int_str(exp - 1));
+                bld_cat(&rt_str, ")");
                 
-                return rt_str;
+                return rt_str.str;
             } else {
-                strcpy(rt_str, "(");
-                strcat(rt_str, pt);
-                strcat(rt_str, ")(");
-                strcat(rt_str, str_cpy);
-                strcat(rt_str, ")^(");
-                strcat(rt_str, pt);
-                strcat(rt_str, "-1)");
-
-                return rt_str;
+                rt_str = bld_new("(");
+                bld_cat(&rt_str, pt);
+                bld_cat(&rt_str, ")(");
+                bld_cat(&rt_str, str_cpy);
+                bld_cat(&rt_str, ")^(");
+                bld_cat(&rt_str, pt);
+                bld_cat(&rt_str, "-1)");
+
+                return rt_str.str;
             }
         }
     } else if (fn_tp == trig) {
-        while (par_enclosed(str_cpy)) {
-            str_cpy = rm_par(str_cpy);
-        }
+        str_cpy = strip_par(str_cpy);
 
-        char *pt = strpbrk(str_cpy, "sct");
-        while (!par_paired(str_cpy, pt - str_cpy)) {
-            pt = strpbrk(pt + 1, "sct");
-        }
+        char *pt = top_pbrk(str_cpy, "sct");
+
+        fn_name nm;
+        nm_len(pt, &nm);
 
-        if (strncmp(pt, "sin", 3) == 0) {
+        if (nm == nm_sin) {
             /* (d/dx)(sin(x)) = cos(x) */
             pt[0] = 'c';
             pt[1] = 'o';
             pt[2] = 's';
 
             if (!par_enclosed(pt + 3)) {
-                char *temp_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                strcpy(temp_str, pt + 3);
-
-                strcpy(pt + 3, "(");
-                strcat(pt + 3, temp_str);
-                strcat(pt + 3, ")");
-            }
-            while (par_enclosed(rm_par(pt + 3))) {
-                strcpy(pt + 3, rm_par(pt + 3));
+                int at = (pt - str_cpy) + 3;
+                char *temp_str = str_dup(pt + 3);
+
+                str_cpy[at] = 0;                           // str_cpy grows by the parentheses
+                str_cpy = str_cat(str_cpy, "(");
+                str_cpy = str_cat(str_cpy, temp_str);
+                str_cpy = str_cat(str_cpy, ")");
+                pt = str_cpy + at - 3;
             }
+            trim_par(pt + 3);
 
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            str_bld rt_str = bld_new("");
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 if (str_cpy[0] == '-') {
-                    strcpy(rt_str, "(");
-                    strcat(rt_str, str_cpy);
-                    strcat(rt_str, ")");
+                    rt_str = bld_new("(");
+                    bld_cat(&rt_str, str_cpy);
+                    bld_cat(&rt_str, ")");
 
-                    return rt_str;
+                    return rt_str.str;
                 } else {
-                    strcpy(rt_str, ++str_cpy);
+                    rt_str = bld_new(++str_cpy);
 
-                    return rt_str;
+                    return rt_str.str;
                 }
             } else {
-                strcpy(rt_str, str_cpy);
+                rt_str = bld_new(str_cpy);
 
-                return rt_str;
+                return rt_str.str;
             }
-        } else if (strncmp(pt, "cos", 3) == 0) {
+        } else if (nm == nm_cos) {
             /* (d/dx)(cos(x)) = -sin(x) */
             pt[0] = 's';
             pt[1] = 'i';
             pt[2] = 'n';
             
             if (!par_enclosed(pt + 3)) {
-                char *temp_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                strcpy(temp_str, pt + 3);
-
-                strcpy(pt + 3, "(");
-                strcat(pt + 3, temp_str);
-                strcat(pt + 3, ")");
-            }
-            while (par_enclosed(rm_par(pt + 3))) {
-                strcpy(pt + 3, rm_par(pt + 3));
+                int at = (pt - str_cpy) + 3;
+                char *temp_str = str_dup(pt + 3);
+
+                str_cpy[at] = 0;                           // str_cpy grows by the parentheses
+                str_cpy = str_cat(str_cpy, "(");
+                str_cpy = str_cat(str_cpy, temp_str);
+                str_cpy = str_cat(str_cpy, ")");
+                pt = str_cpy + at - 3;
             }
+            trim_par(pt + 3);
 
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            str_bld rt_str = bld_new("");
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 if (str_cpy[0] == '-') {
                     return str_cpy + 1;
                 } else if (str_cpy[0] == '+') {
-                    strcpy(rt_str, "(-");
-                    strcat(rt_str, ++str_cpy);
-                    strcat(rt_str, ")");
+                    rt_str = bld_new("(-");
+                    bld_cat(&rt_str, ++str_cpy);
+                    bld_cat(&rt_str, ")");
 
-                    return rt_str;
+                    return rt_str.str;
                 }
             } else {
-                strcpy(rt_str, "(-");
-                strcat(rt_str, str_cpy);
-                strcat(rt_str, ")");
+                rt_str = bld_new("(-");
+                bld_cat(&rt_str, str_cpy);
+                bld_cat(&rt_str, ")");
 
-                return rt_str;
+                return rt_str.str;
             }
-        } else if (strncmp(pt, "tan", 3) == 0) {
+        } else if (nm == nm_tan) {
             /* (d/dx)(tan(x)) = (sec(x))^2 */
             pt[0] = 's';
             pt[1] = 'e';
             pt[2] = 'c';
 
             if (!par_enclosed(pt + 3)) {
-                char *temp_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                strcpy(temp_str, pt + 3);
-
-                strcpy(pt + 3, "(");
-                strcat(pt + 3, temp_str);
-                strcat(pt + 3, ")");
-            }
-            while (par_enclosed(rm_par(pt + 3))) {
-                strcpy(pt + 3, rm_par(pt + 3));
+                int at = (pt - str_cpy) + 3;
+                char *temp_str = str_dup(pt + 3);
+
+                str_cpy[at] = 0;                           // str_cpy grows by the parentheses
+                str_cpy = str_cat(str_cpy, "(");
+                str_cpy = str_cat(str_cpy, temp_str);
+                str_cpy = str_cat(str_cpy, ")");
+                pt = str_cpy + at - 3;
             }
+            trim_par(pt + 3);
 
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            str_bld rt_str = bld_new("");
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 if (str_cpy[0] == '-') {
-                    strcpy(rt_str, "(");
-                    strcat(rt_str, str_cpy);
-                    strcat(rt_str, "^2)");
+                    rt_str = bld_new("(");
+                    bld_cat(&rt_str, str_cpy);
+                    bld_cat(&rt_str, "^2)");
 
-                    return rt_str;
+                    return rt_str.str;
                 } else if (str_cpy[0] == '+') {
-                    strcpy(rt_str, "(");
-                    strcat(rt_str, ++str_cpy);
-                    strcat(rt_str, "^2)");
+                    rt_str = bld_new("(");
+                    bld_cat(&rt_str, ++str_cpy);
+                    bld_cat(&rt_str, "^2)");
 
-                    return rt_str;
+                    return rt_str.str;
                 }
             } else {
-                strcpy(rt_str, "(");
-                strcat(rt_str, str_cpy);
-                strcat(rt_str, "^2)");
+                rt_str = bld_new("(");
+                bld_cat(&rt_str, str_cpy);
+                bld_cat(&rt_str, "^2)");
 
-                return rt_str;
+                return rt_str.str;
             }
-        } else if (strncmp(pt, "csc", 3) == 0) {
+        } else if (nm == nm_csc) {
             /* (d/dx)(csc(x)) = -csc(x)cot(x) */
             if (!par_enclosed(pt + 3)) {
-                char *temp_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                strcpy(temp_str, pt + 3);
-
-                strcpy(pt + 3, "(");
-                strcat(pt + 3, temp_str);
-                strcat(pt + 3, ")");
-            }
-            while (par_enclosed(rm_par(pt + 3))) {
-                strcpy(pt + 3, rm_par(pt + 3));
+                int at = (pt - str_cpy) + 3;
+                char *temp_str = str_dup(pt + 3);
+
+                str_cpy[at] = 0;                           // str_cpy grows by the parentheses
+                str_cpy = str_cat(str_cpy, "(");
+                str_cpy = str_cat(str_cpy, temp_str);
+                str_cpy = str_cat(str_cpy, ")");
+                pt = str_cpy + at - 3;
             }
+            trim_par(pt + 3);
 
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            str_bld rt_str = bld_new("");
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 if (str_cpy[0] == '-') {
-                    strcpy(rt_str, ++str_cpy);
+                    rt_str = bld_new(++str_cpy);
                 } else if (str_cpy[0] == '+') {
-                    strcpy(rt_str, "(-");
-                    strcat(rt_str, ++str_cpy);
+                    rt_str = bld_new("(-");
+                    bld_cat(&rt_str, ++str_cpy);
                 }
             } else {
-                strcpy(rt_str, "(-");
-                strcat(rt_str, str_cpy);
+                rt_str = bld_new("(-");
+                bld_cat(&rt_str, str_cpy);
             }
 
             pt[0] = 'c';
             pt[1] = 'o';
             pt[2] = 't';
 
-            strcat(rt_str, str_cpy);
-            if (rt_str[0] == '(') {
-                strcat(rt_str, ")");
+            bld_cat(&rt_str, str_cpy);
+            if (rt_str.str[0] == '(') {
+                bld_cat(&rt_str, ")");
             }
 
-            return rt_str;
-        } else if (strncmp(pt, "sec", 3) == 0) {
+            return rt_str.str;
+        } else if (nm == nm_sec) {
             /* (d/dx)(sec(x)) = sec(x)tan(x) */
             if (!par_enclosed(pt + 3)) {
-                char *temp_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                strcpy(temp_str, pt + 3);
-
-                strcpy(pt + 3, "(");
-                strcat(pt + 3, temp_str);
-                strcat(pt + 3, ")");
-            }
-            while (par_enclosed(rm_par(pt + 3))) {
-                strcpy(pt + 3, rm_par(pt + 3));
+                int at = (pt - str_cpy) + 3;
+                char *temp_str = str_dup(pt + 3);
+
+                str_cpy[at] = 0;                           // str_cpy grows by the parentheses
+                str_cpy = str_cat(str_cpy, "(");
+                str_cpy = str_cat(str_cpy, temp_str);
+                str_cpy = str_cat(str_cpy, ")");
+                pt = str_cpy + at - 3;
             }
+            trim_par(pt + 3);
 
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            str_bld rt_str = bld_new("");
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 if (str_cpy[0] == '-') {
-                    strcpy(rt_str, "(");
-                    strcat(rt_str, str_cpy++);
+                    rt_str = bld_new("(");
+                    bld_cat(&rt_str, str_cpy++);
                 } else if (str_cpy[0] == '+') {
-                    strcpy(rt_str, ++str_cpy);
+                    rt_str = bld_new(++str_cpy);
                 }
             } else {
-                strcpy(rt_str, str_cpy);
+                rt_str = bld_new(str_cpy);
             }
 
             pt[0] = 't';
             pt[1] = 'a';
             pt[2] = 'n';
 
-            strcat(rt_str, str_cpy);
-            if (rt_str[0] == '(') {
-                strcat(rt_str, ")");
+            bld_cat(&rt_str, str_cpy);
+            if (rt_str.str[0] == '(') {
+                bld_cat(&rt_str, ")");
             }
 
-            return rt_str;
-        } else if (strncmp(pt, "cot", 3) == 0) {
+            return rt_str.str;
+        } else if (nm == nm_cot) {
             /* (d/dx)(cot(x)) = -(csc(x))^2 */
             pt[0] = 'c';
             pt[1] = 's';
             pt[2] = 'c';
 
             if (!par_enclosed(pt + 3)) {
-                char *temp_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                strcpy(temp_str, pt + 3);
-
-                strcpy(pt + 3, "(");
-                strcat(pt + 3, temp_str);
-                strcat(pt + 3, ")");
-            }
-            while (par_enclosed(rm_par(pt + 3))) {
-                strcpy(pt + 3, rm_par(pt + 3));
+                int at = (pt - str_cpy) + 3;
+                char *temp_str = str_dup(pt + 3);
+
+                str_cpy[at] = 0;                           // str_cpy grows by the parentheses
+                str_cpy = str_cat(str_cpy, "(");
+                str_cpy = str_cat(str_cpy, temp_str);
+                str_cpy = str_cat(str_cpy, ")");
+                pt = str_cpy + at - 3;
             }
+            trim_par(pt + 3);
 
-            char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            str_bld rt_str = bld_new("");
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 if (str_cpy[0] == '-') {
-                    strcpy(rt_str, "(");
-                    strcat(rt_str, ++str_cpy);
-                    strcat(rt_str, "^2)");
+                    rt_str = bld_new("(");
+                    bld_cat(&rt_str, ++str_cpy);
+                    bld_cat(&rt_str, "^2)");
                     
-                    return rt_str;
+                    return rt_str.str;
                 } else if (str[0] == '+') {
-                    strcpy(rt_str, "(-");
-                    strcat(rt_str, ++str_cpy);
-                    strcat(rt_str, "^2)");
+                    rt_str = bld_new("(-");
+                    bld_cat(&rt_str, ++str_cpy);
+                    bld_cat(&rt_str, "^2)");
                     
-                    return rt_str;
+                    return rt_str.str;
                 }
             } else {
-                strcpy(rt_str, "(-");
-                strcat(rt_str, str_cpy);
-                strcat(rt_str, "^2)");
+                rt_str = bld_new("(-");
+                bld_cat(&rt_str, str_cpy);
+                bld_cat(&rt_str, "^2)");
 
-                return rt_str;
+                return rt_str.str;
             }
         }
     }
 }
+
+/* Derivative of a function with respect to its argument u, as fn_diff() writes it. */
+static node *fn_prime(fn_name nm, node *u) {
+    switch (nm) {
+        case nm_sin:                                       // cos(u)
+            return mk_fn(nm_cos, u);
+        case nm_cos:                                       // -sin(u)
+            return mk_op(nd_neg, mk_fn(nm_sin, u), NULL);
+        case nm_tan:                                       // sec(u)^2
+            return mk_op(nd_pow, mk_fn(nm_sec, u), mk_val(2));
+        case nm_csc:                                       // -csc(u)cot(u)
+            return mk_op(nd_neg, mk_op(nd_mul, mk_fn(nm_csc, u), mk_fn(nm_cot, u)), NULL);
+        case nm_sec:                                       // sec(u)tan(u)
+            return mk_op(nd_mul, mk_fn(nm_sec, u), mk_fn(nm_tan, u));
+        case nm_cot:                                       // -csc(u)^2
+            return mk_op(nd_neg, mk_op(nd_pow, mk_fn(nm_csc, u), mk_val(2)), NULL);
+        case nm_sinh:                                      // cosh(u)
+            return mk_fn(nm_cosh, u);
+        case nm_cosh:                                      // sinh(u)
+            return mk_fn(nm_sinh, u);
+        case nm_tanh:                                      // sech(u)^2
+            return mk_op(nd_pow, mk_fn(nm_sech, u), mk_val(2));
+        case nm_csch:                                      // -csch(u)coth(u)
+            return mk_op(nd_neg, mk_op(nd_mul, mk_fn(nm_csch, u), mk_fn(nm_coth, u)), NULL);
+        case nm_sech:                                      // -sech(u)tanh(u)
+            return mk_op(nd_neg, mk_op(nd_mul, mk_fn(nm_sech, u), mk_fn(nm_tanh, u)), NULL);
+        case nm_coth:                                      // -csch(u)^2
+            return mk_op(nd_neg, mk_op(nd_pow, mk_fn(nm_csch, u), mk_val(2)), NULL);
+        case nm_ln:                                        // 1/u
+            return mk_op(nd_div, mk_val(1), u);
+        default:                                           // log: 1/(u ln(10))
+            return mk_op(nd_div, mk_val(1), mk_op(nd_mul, u, mk_fn(nm_ln, mk_val(10))));
+    }
+}
+
+static node *diff_once(node *nd);
+
+/* Differentiates an expression tree with the same rules as fn_diff(), once per distinct node. */
+node *diff_node(node *nd) {
+    gov_check();
+
+    if ((memo.slot == NULL) || (memo.epoch != mem_epoch())) {
+        memo_grow();                                       // resets the counters
+    }
+
+    if (nd->diff != NULL) {
+        memo.hit++;
+    } else {
+        memo.miss++;
+        nd->diff = diff_once(nd);
+    }
+    return nd->diff;
+}
+
+static node *diff_once(node *nd) {
+    node *lhs = nd->lhs, *rhs = nd->rhs;
+
+    switch (nd->type) {
+        case nd_num:
+        case nd_cst:
+            return mk_val(0);
+        case nd_var:
+            return mk_val(1);
+        case nd_add:
+        case nd_sub:
+            return mk_op(nd->type, diff_node(lhs), diff_node(rhs));
+        case nd_neg:
+            return mk_op(nd_neg, diff_node(lhs), NULL);
+        case nd_mul:                                       // product rule
+            return mk_op(nd_add, mk_op(nd_mul, diff_node(lhs), rhs), mk_op(nd_mul, lhs, diff_node(rhs)));
+        case nd_div:
+            if (!dep_x(rhs)) {
+                return mk_op(nd_div, diff_node(lhs), rhs);
+            }                                              // quotient rule
+            return mk_op(nd_div,
+                         mk_op(nd_sub, mk_op(nd_mul, diff_node(lhs), rhs), mk_op(nd_mul, lhs, diff_node(rhs))),
+                         mk_op(nd_pow, rhs, mk_val(2)));
+        case nd_pow:
+            if (!dep_x(rhs)) {                             // poly, powr: (d/dx)(u^n) = n u^(n-1) u'
+                return mk_op(nd_mul, mk_op(nd_mul, rhs, mk_op(nd_pow, lhs, mk_op(nd_sub, rhs, mk_val(1)))),
+                             diff_node(lhs));
+            } else if (!dep_x(lhs)) {                      // expo: (d/dx)(a^u) = a^u ln(a) u'
+                node *ln = ((lhs->type == nd_cst) && (lhs->nm == nm_none)) ? mk_val(1) : mk_fn(nm_ln, lhs);
+                return mk_op(nd_mul, mk_op(nd_mul, nd, ln), diff_node(rhs));
+            }                                              // u^v = e^(v ln(u))
+            return mk_op(nd_mul, nd, mk_op(nd_add, mk_op(nd_mul, diff_node(rhs), mk_fn(nm_ln, lhs)),
+                                                   mk_op(nd_div, mk_op(nd_mul, rhs, diff_node(lhs)), lhs)));
+        default:                                           // chain rule
+            return mk_op(nd_mul, fn_prime(nd->nm, lhs), diff_node(lhs));
+    }
+}
@@ -28,7 +28,11 @@
 #ifndef DIFF_H
 #define DIFF_H
 
+#include "struct.h"
+
 char *differentiate(char *str, int mode);
+node *diff_node(node *nd);
+void diff_stats(long *hit, long *miss);
 char *fn_diff(char *str);
 
 #endif
@@ -35,6 +35,16 @@ void debug_list(list *ls) {
     }
 }
 
+void debug_seq(char *str, tk_seq *seq) {
+    printf("--- tokens ---\n");
+    int ind;
+    for (ind = 0; ind < seq->n; ind++) {
+        token *tk = seq->tk + ind;
+        printf("%.*s\ttype %d\tdepth %d\tbd %d\tdelim %d\n",
+               tk->len, str + tk->pos, tk->type, tk->depth, tk->bd, tk->delim);
+    }
+}
+
 void debug_term(term *tm) {
     printf("--- term segm ---\n");
     debug_list(tm->segm);
@@ -33,6 +33,7 @@
 void debug_block(block *bl);
 void debug_comp(comp *cp);
 void debug_list(list *ls);
+void debug_seq(char *str, tk_seq *seq);
 void debug_term(term *tm);
 
 #endif
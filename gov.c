@@ -0,0 +1,152 @@
+/*
+ * gov.c
+ * Per-request resource governor
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE                                        // pthread_getattr_np()
+
+#include <pthread.h>
+#include <setjmp.h>
+#include <stddef.h>
+#include <time.h>
+#include "derivative.h"
+#include "gov.h"
+#include "mem.h"
+
+#define GOV_STACK (4 * 1024 * 1024)                        // stack a request may use if the bottom is unknown
+#define GOV_SLACK (256 * 1024)                             // stack left for the C library below the deepest check
+
+/*
+ * The recursive functions of parse.c, diff.c, simplify.c and node.c and the scans of the string
+ * engine call gov_check(). Once the request set up with gov_enter() runs out of CPU time or stack,
+ * or is cancelled, the check jumps back to the caller's setjmp() with the DERIV_E* code; the arena
+ * byte limit is enforced by mem_alloc() itself, which calls gov_over() instead of growing past it.
+ * Everything the request allocated is in the arena, so unwinding leaks nothing. Reading the CPU
+ * clock costs a system call, so a check reads it only once the coarse wall clock has ticked, at
+ * most every few milliseconds. The stack runs out GOV_SLACK bytes above the bottom of the thread's
+ * own stack. Like the arena, the governor is per thread.
+ */
+static _Thread_local struct {
+    jmp_buf *jb;                                           // NULL outside a request
+    double end;                                            // CPU deadline in seconds, 0 for none
+    long wall;                                             // coarse clock at the last CPU reading
+    int *cancel;                                           // bumped by deriv_cancel()
+    int seen;                                              // *cancel when the request started
+    char *floor;                                           // a check below this address fails
+} gov = {NULL, 0, 0, NULL, 0, NULL};
+
+static _Thread_local char *gov_low = NULL;                 // lowest address of this thread's stack
+
+/* Returns the CPU time of the calling thread in seconds. */
+static double gov_cpu(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Returns the coarse monotonic clock in nanoseconds, which is cheap to read. */
+static long gov_wall(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* Abandons the request in progress with code. */
+static void gov_fail(int code) {
+    jmp_buf *jb = gov.jb;
+    gov.jb = NULL;
+    mem_limit(0, NULL);
+    longjmp(*jb, code);
+}
+
+/* Fails the request in progress for going over its arena bytes; called by the arena. */
+static void gov_over(void) {
+    if (gov.jb != NULL) {
+        gov_fail(DERIV_ELIMIT);
+    }
+}
+
+/* Returns the lowest address of the calling thread's stack, or NULL if it cannot tell. */
+static char *gov_bottom(void) {
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+        return NULL;
+    }
+
+    void *addr;
+    size_t size;
+    int code = pthread_attr_getstack(&attr, &addr, &size);
+    pthread_attr_destroy(&attr);
+
+    return (code == 0) ? (char *) addr : NULL;
+}
+
+/* Fails the request in progress if it is over one of its limits or was cancelled. */
+void gov_check(void) {
+    if (gov.jb == NULL) {
+        return;
+    }
+
+    char here;
+    if (&here < gov.floor) {
+        gov_fail(DERIV_EDEEP);
+    }
+    if (__atomic_load_n(gov.cancel, __ATOMIC_RELAXED) != gov.seen) {
+        gov_fail(DERIV_ECANCEL);
+    }
+    if (gov.end > 0) {
+        long wall = gov_wall();
+        if (wall != gov.wall) {
+            gov.wall = wall;
+            if (gov_cpu() > gov.end) {
+                gov_fail(DERIV_ETIME);
+            }
+        }
+    }
+}
+
+/*
+ * Starts a request on this thread which jumps to jb when it fails: sec seconds of CPU time and
+ * bytes of arena, 0 meaning no limit, and cancelled when *cancel changes.
+ */
+void gov_enter(jmp_buf *jb, double sec, size_t bytes, int *cancel) {
+    char here;
+    gov.jb = jb;
+    gov.end = (sec > 0) ? gov_cpu() + sec : 0;
+    gov.wall = gov_wall();
+    gov.cancel = cancel;
+    gov.seen = __atomic_load_n(cancel, __ATOMIC_RELAXED);
+    if (gov_low == NULL) {
+        gov_low = gov_bottom();
+    }
+    gov.floor = (gov_low != NULL) ? gov_low + GOV_SLACK : &here - GOV_STACK;
+    mem_limit((bytes > 0) ? mem_used() + bytes : 0, gov_over);
+}
+
+/* Ends the request on this thread. */
+void gov_leave(void) {
+    gov.jb = NULL;
+    mem_limit(0, NULL);
+}
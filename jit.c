@@ -0,0 +1,338 @@
+/*
+ * jit.c
+ * x86-64 compiler of bytecode programs
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "derivative.h"
+#include "jit.h"
+#include "struct.h"
+#include "vm.h"
+
+/*
+ * Translates a program into SSE2 code, one function per output, in a page of its own. Each
+ * temporary register gets a stack slot and each instruction becomes a load, the operation and a
+ * store, with constants read straight from a pool at the start of the page; functions are calls
+ * into libm. Operands keep the order of the vector kernels, so the native code returns exactly
+ * what deriv_eval() does. The page is written first and only then made executable.
+ */
+#define JIT_INS 48                                         // bytes the longest instruction compiles to
+#define JIT_SLOTS 64                                       // programs evaluated through a trampoline at once
+
+typedef struct jit_buf {
+    unsigned char *base;                                   // start of the page
+    size_t at;                                             // next byte to write
+    size_t pool;                                           // offset of the constants of the program
+} jit_buf;
+
+static void jb_put(jit_buf *jb, const void *src, size_t len) {
+    memcpy(jb->base + jb->at, src, len);
+    jb->at += len;
+}
+
+static void jb_u8(jit_buf *jb, unsigned char b) {
+    jb->base[jb->at++] = b;
+}
+
+static void jb_u32(jit_buf *jb, uint32_t v) {
+    jb_put(jb, &v, 4);
+}
+
+/* ModRM and displacement of [rsp + 8 * r] for a temporary, or [rip + pool] for a constant. */
+static void jb_mem(jit_buf *jb, const deriv_prog *prog, int xmm, int r) {
+    if (r < prog->n_cst) {
+        jb_u8(jb, 0x05 | (xmm << 3));
+        size_t to = jb->pool + 16 + 8 * (size_t) r;        // past the sign mask and 1
+        jb_u32(jb, (uint32_t) (to - (jb->at + 4)));
+    } else {
+        jb_u8(jb, 0x84 | (xmm << 3));
+        jb_u8(jb, 0x24);
+        jb_u32(jb, 8 * (uint32_t) r);
+    }
+}
+
+/* An SSE2 instruction prefix 0f op between xmm and register r of the program. */
+static void jb_sse(jit_buf *jb, unsigned char prefix, unsigned char op, int xmm, const deriv_prog *prog, int r) {
+    jb_u8(jb, prefix);
+    jb_u8(jb, 0x0f);
+    jb_u8(jb, op);
+    jb_mem(jb, prog, xmm, r);
+}
+
+/* Calls the libm function at addr through rax, with the arguments in xmm0 and xmm1. */
+static void jb_call(jit_buf *jb, uintptr_t addr) {
+    jb_u8(jb, 0x48);
+    jb_u8(jb, 0xb8);                                       // mov rax, imm64
+    jb_put(jb, &addr, 8);
+    jb_u8(jb, 0xff);
+    jb_u8(jb, 0xd0);                                       // call rax
+}
+
+/* Address of the libm function of op; inv is set when the reciprocal is taken afterwards. */
+static uintptr_t jit_fn(vm_op op, int *inv) {
+    *inv = (op == vm_csc) || (op == vm_sec) || (op == vm_cot) || (op == vm_csch) || (op == vm_sech) || (op == vm_coth);
+    switch (op) {
+        case vm_sin:
+        case vm_csc:
+            return (uintptr_t) sin;
+        case vm_cos:
+        case vm_sec:
+            return (uintptr_t) cos;
+        case vm_tan:
+        case vm_cot:
+            return (uintptr_t) tan;
+        case vm_sinh:
+        case vm_csch:
+            return (uintptr_t) sinh;
+        case vm_cosh:
+        case vm_sech:
+            return (uintptr_t) cosh;
+        case vm_tanh:
+        case vm_coth:
+            return (uintptr_t) tanh;
+        case vm_ln:
+            return (uintptr_t) log;
+        case vm_log:
+            return (uintptr_t) log10;
+        default:
+            return (uintptr_t) pow;
+    }
+}
+
+/* Compiles the instructions output out depends on into a function at jb->at. */
+static void jit_out(jit_buf *jb, const deriv_prog *prog, int out, char *live, char *need) {
+    int ind;
+    vm_live(prog, out, live, need);
+
+    uint32_t frame = ((8 * (uint32_t) prog->n_reg + 15) & ~15u) + 8;   // keeps calls 16-byte aligned
+    jb_u8(jb, 0x48);
+    jb_u8(jb, 0x81);
+    jb_u8(jb, 0xec);                                       // sub rsp, frame
+    jb_u32(jb, frame);
+    jb_sse(jb, 0xf2, 0x11, 0, prog, prog->n_cst);          // the argument x is register n_cst
+
+    for (ind = 0; ind < prog->n_ins; ind++) {
+        const vm_ins *ins = prog->ins + ind;
+        int inv;
+        if (!need[ind]) {
+            continue;
+        }
+
+        jb_sse(jb, 0xf2, 0x10, 0, prog, ins->a);           // movsd xmm0, a
+        switch (ins->op) {
+            case vm_add:
+                jb_sse(jb, 0xf2, 0x58, 0, prog, ins->b);
+                break;
+            case vm_sub:
+                jb_sse(jb, 0xf2, 0x5c, 0, prog, ins->b);
+                break;
+            case vm_mul:
+                jb_sse(jb, 0xf2, 0x59, 0, prog, ins->b);
+                break;
+            case vm_div:
+                jb_sse(jb, 0xf2, 0x5e, 0, prog, ins->b);
+                break;
+            case vm_neg:                                   // xorpd xmm0, [sign mask]
+                jb_u8(jb, 0x66);
+                jb_u8(jb, 0x0f);
+                jb_u8(jb, 0x57);
+                jb_u8(jb, 0x05);
+                jb_u32(jb, (uint32_t) (jb->pool - (jb->at + 4)));
+                break;
+            case vm_pow:
+                jb_sse(jb, 0xf2, 0x10, 1, prog, ins->b);   // movsd xmm1, b
+                jb_call(jb, jit_fn(ins->op, &inv));
+                break;
+            default:
+                jb_call(jb, jit_fn(ins->op, &inv));
+                if (inv) {                                 // 1 / xmm0, dividing in the order C does
+                    jb_u8(jb, 0x66);
+                    jb_u8(jb, 0x0f);
+                    jb_u8(jb, 0x28);
+                    jb_u8(jb, 0xc8);                       // movapd xmm1, xmm0
+                    jb_u8(jb, 0xf2);
+                    jb_u8(jb, 0x0f);
+                    jb_u8(jb, 0x10);
+                    jb_u8(jb, 0x05);                       // movsd xmm0, [1]
+                    jb_u32(jb, (uint32_t) (jb->pool + 8 - (jb->at + 4)));
+                    jb_u8(jb, 0xf2);
+                    jb_u8(jb, 0x0f);
+                    jb_u8(jb, 0x5e);
+                    jb_u8(jb, 0xc1);                       // divsd xmm0, xmm1
+                }
+                break;
+        }
+        jb_sse(jb, 0xf2, 0x11, 0, prog, ins->dst);         // movsd dst, xmm0
+    }
+
+    jb_sse(jb, 0xf2, 0x10, 0, prog, out);                  // the result goes back in xmm0
+    jb_u8(jb, 0x48);
+    jb_u8(jb, 0x81);
+    jb_u8(jb, 0xc4);                                       // add rsp, frame
+    jb_u32(jb, frame);
+    jb_u8(jb, 0xc3);
+}
+
+/* Writes the native code of both outputs of prog into a page of its own; false if it cannot. */
+static bool jit_native(deriv_prog *prog) {
+#ifdef __x86_64__
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t pool = 16 + 8 * (size_t) prog->n_cst;
+    size_t size = ((pool + 15) & ~(size_t) 15) + 2 * (JIT_INS * (size_t) prog->n_ins + 2 * JIT_INS);
+    size = (size + page - 1) & ~(page - 1);
+
+    void *code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        return false;
+    }
+
+    jit_buf jb = {(unsigned char *) code, 0, 0};
+    uint64_t sign = (uint64_t) 1 << 63;
+    double one = 1;
+    jb_put(&jb, &sign, 8);
+    jb_put(&jb, &one, 8);
+    jb_put(&jb, prog->cst, 8 * (size_t) prog->n_cst);
+
+    char *live = (char *) malloc(prog->n_reg + prog->n_ins);
+    if (live == NULL) {
+        munmap(code, size);
+        return false;
+    }
+
+    deriv_fn fn[2] = {NULL, NULL};
+    int ind;
+    for (ind = 0; ind < 2; ind++) {
+        if (prog->out[ind] >= 0) {
+            jb.at = (jb.at + 15) & ~(size_t) 15;
+            fn[ind] = (deriv_fn) (uintptr_t) (jb.base + jb.at);
+            jit_out(&jb, prog, prog->out[ind], live, live + prog->n_reg);
+        }
+    }
+    free(live);
+
+    if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, size);
+        return false;
+    }
+    prog->code = code;
+    prog->code_size = size;
+    for (ind = 0; ind < 2; ind++) {
+        __atomic_store_n(&prog->jit[ind], fn[ind], __ATOMIC_RELEASE);
+    }
+
+    return true;
+#else
+    (void) prog;
+    return false;
+#endif
+}
+
+/*
+ * Without native code, deriv_jit() hands out one of a fixed set of trampolines, each bound to the
+ * program in its slot and evaluating it with deriv_eval() at one point. The slots are taken and
+ * given back under jit_lock, which also makes the first deriv_jit() of a program build it once.
+ */
+static pthread_mutex_t jit_lock = PTHREAD_MUTEX_INITIALIZER;
+static deriv_prog *jit_slot[JIT_SLOTS];                    // program bound to each trampoline, or NULL
+
+/* Evaluates output out of the program in slot at x. */
+static double jit_slow(int slot, int out, double x) {
+    double val[2];
+    deriv_eval(jit_slot[slot], &x, 1, val, val + 1);
+    return val[out];
+}
+
+#define JIT_ROW(hi, X) X(hi##0) X(hi##1) X(hi##2) X(hi##3) X(hi##4) X(hi##5) X(hi##6) X(hi##7) \
+                       X(hi##8) X(hi##9) X(hi##a) X(hi##b) X(hi##c) X(hi##d) X(hi##e) X(hi##f)
+#define JIT_ALL(X) JIT_ROW(0, X) JIT_ROW(1, X) JIT_ROW(2, X) JIT_ROW(3, X)
+#define JIT_TRAMP(n) static double jit_df_##n(double x) { return jit_slow(0x##n, 0, x); } \
+                     static double jit_f_##n(double x) { return jit_slow(0x##n, 1, x); }
+#define JIT_PAIR(n) {jit_df_##n, jit_f_##n},
+
+JIT_ALL(JIT_TRAMP)
+static const deriv_fn jit_tramp[JIT_SLOTS][2] = {JIT_ALL(JIT_PAIR)};
+
+/* Binds prog to a free trampoline; false if all JIT_SLOTS are taken. */
+static bool jit_bind(deriv_prog *prog) {
+    int slot, ind;
+    for (slot = 0; slot < JIT_SLOTS; slot++) {
+        if (jit_slot[slot] == NULL) {
+            jit_slot[slot] = prog;
+            for (ind = 0; ind < 2; ind++) {
+                __atomic_store_n(&prog->jit[ind], (prog->out[ind] >= 0) ? jit_tramp[slot][ind] : NULL,
+                                 __ATOMIC_RELEASE);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Returns a function computing f' (out 0) or, for a program compiled with DERIV_FUNC, f (out 1)
+ * at one point, with the same results as deriv_eval(). Both functions are built on the first call,
+ * which may race with others, and live until deriv_prog_free(). On x86-64 they are native code;
+ * elsewhere, or where executable memory is refused, they call deriv_eval(), which allows up to
+ * JIT_SLOTS such programs at once. Returns NULL for an output the program lacks, or once those
+ * slots run out.
+ */
+deriv_fn deriv_jit(deriv_prog *prog, int out) {
+    if ((out < 0) || (out > 1) || (prog->out[out] < 0)) {
+        return NULL;
+    }
+
+    deriv_fn fn = __atomic_load_n(&prog->jit[out], __ATOMIC_ACQUIRE);
+    if (fn == NULL) {
+        pthread_mutex_lock(&jit_lock);
+        if ((prog->jit[out] != NULL) || jit_native(prog) || jit_bind(prog)) {
+            fn = prog->jit[out];
+        }
+        pthread_mutex_unlock(&jit_lock);
+    }
+    return fn;
+}
+
+/* Unmaps the native code of a program, if any, and frees its trampoline. */
+void jit_free(deriv_prog *prog) {
+    if (prog->code != NULL) {
+        munmap(prog->code, prog->code_size);
+        prog->code = NULL;
+    }
+
+    int slot;
+    pthread_mutex_lock(&jit_lock);
+    for (slot = 0; slot < JIT_SLOTS; slot++) {
+        if (jit_slot[slot] == prog) {
+            jit_slot[slot] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&jit_lock);
+}
@@ -0,0 +1,227 @@
+/*
+ * json.c
+ * JSON lines request and response helpers
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "derivative.h"
+#include "json.h"
+#include "mem.h"
+#include "struct.h"
+#include "utility.h"
+
+/*
+ * Just enough JSON for the request lines of the machine mode: one object per line, of which
+ * only "id" (any value, echoed back verbatim) and "expr" (a string) are used.
+ */
+
+static char *js_ws(char *pt, char *end) {
+    while ((pt < end) && ((*pt == ' ') || (*pt == '\t') || (*pt == '\r') || (*pt == '\n'))) {
+        pt++;
+    }
+    return pt;
+}
+
+/* Skips the string starting at pt, which is a '"'; returns the character after it, or NULL. */
+static char *js_skip_str(char *pt, char *end) {
+    for (pt++; pt < end; pt++) {
+        if (*pt == '\\') {
+            pt++;
+        } else if (*pt == '"') {
+            return pt + 1;
+        }
+    }
+    return NULL;
+}
+
+/* Skips any value starting at pt; returns the character after it, or NULL. */
+static char *js_skip_val(char *pt, char *end) {
+    if ((pt < end) && (*pt == '"')) {
+        return js_skip_str(pt, end);
+    }
+
+    int depth = 0;
+    while (pt < end) {
+        if (*pt == '"') {
+            if ((pt = js_skip_str(pt, end)) == NULL) {
+                return NULL;
+            }
+            continue;
+        }
+        if ((*pt == '{') || (*pt == '[')) {
+            depth++;
+        } else if ((*pt == '}') || (*pt == ']')) {
+            if (depth == 0) {
+                break;
+            }
+            depth--;
+        } else if ((depth == 0) && ((*pt == ',') || (*pt == ' ') || (*pt == '\t') || (*pt == '\r'))) {
+            break;
+        }
+        pt++;
+    }
+    return (depth == 0) ? pt : NULL;
+}
+
+/* Decodes the string from pt, a '"', to end, just past the closing '"'; \u escapes keep ASCII only. */
+static char *js_dec(char *pt, char *end) {
+    char *rt_str = (char *) mem_alloc(sizeof(char) * (end - pt));
+    int fill = 0;
+
+    for (pt++; pt < end - 1; pt++) {
+        if (*pt != '\\') {
+            rt_str[fill++] = *pt;
+            continue;
+        }
+
+        char ch = *++pt;
+        if (ch == 'n') {
+            rt_str[fill++] = '\n';
+        } else if (ch == 't') {
+            rt_str[fill++] = '\t';
+        } else if ((ch == 'u') && (end - 1 - pt > 4)) {
+            unsigned int code;
+            if ((sscanf(pt + 1, "%4x", &code) == 1) && (code < 128)) {
+                rt_str[fill++] = (char) code;
+            }
+            pt += 4;
+        } else if ((ch == 'b') || (ch == 'f') || (ch == 'r')) {
+            continue;
+        } else {
+            rt_str[fill++] = ch;                           // '"', '\\' and '/'
+        }
+    }
+
+    return rt_str;
+}
+
+/*
+ * Reads a request line of len characters. Returns false unless it is an object with a string
+ * "expr"; *id is the verbatim "id" value, or "null" without one.
+ */
+bool js_req(char *str, size_t len, char **id, char **expr) {
+    char *pt = str, *end = str + len;
+    *id = "null";
+    *expr = NULL;
+
+    pt = js_ws(pt, end);
+    if ((pt == end) || (*pt != '{')) {
+        return false;
+    }
+    pt = js_ws(pt + 1, end);
+
+    while ((pt < end) && (*pt != '}')) {
+        if (*pt != '"') {
+            return false;
+        }
+        char *key = pt + 1, *val;
+        if ((pt = js_skip_str(pt, end)) == NULL) {
+            return false;
+        }
+        int key_len = (pt - 1) - key;
+
+        pt = js_ws(pt, end);
+        if ((pt == end) || (*pt != ':')) {
+            return false;
+        }
+        val = js_ws(pt + 1, end);
+        if (((pt = js_skip_val(val, end)) == NULL) || (pt == val)) {
+            return false;
+        }
+
+        if ((key_len == 2) && (strncmp(key, "id", 2) == 0)) {
+            *id = str_ndup(val, pt - val);
+        } else if ((key_len == 4) && (strncmp(key, "expr", 4) == 0)) {
+            if (*val != '"') {
+                return false;
+            }
+            *expr = js_dec(val, pt);
+        }
+
+        pt = js_ws(pt, end);
+        if ((pt < end) && (*pt == ',')) {
+            pt = js_ws(pt + 1, end);
+        }
+    }
+
+    return (pt < end) && (*expr != NULL);
+}
+
+/*
+ * Answers the request line of len characters with the derivative, or the error, and the time
+ * spent in microseconds. Returns the response line, '\n' included, allocated with malloc().
+ */
+char *js_rsp(char *str, size_t len, int flags) {
+    struct timespec t_0, t_1;
+    clock_gettime(CLOCK_MONOTONIC, &t_0);
+
+    char *id, *expr, *derv = NULL, *err = "invalid request";
+    int code;
+    if (js_req(str, len, &id, &expr)) {
+        if ((derv = deriv_str(wo_space(expr), flags, &code)) == NULL) {
+            err = (char *) deriv_strerror(code);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t_1);
+    long us = (t_1.tv_sec - t_0.tv_sec) * 1000000L + (t_1.tv_nsec - t_0.tv_nsec) / 1000;
+
+    char *df_js = (derv != NULL) ? js_str(derv) : "null";
+    char *err_js = (derv == NULL) ? js_str(err) : "null";
+    size_t n = strlen(id) + strlen(df_js) + strlen(err_js) + 64;
+    char *rsp = (char *) malloc(n);
+    if (rsp == NULL) {
+        perror("js_rsp");
+        exit(1);
+    }
+    snprintf(rsp, n, "{\"id\":%s,\"derivative\":%s,\"error\":%s,\"us\":%ld}\n", id, df_js, err_js, us);
+
+    return rsp;
+}
+
+/* Quotes str as a JSON string. */
+char *js_str(char *str) {
+    char *rt_str = (char *) mem_alloc(sizeof(char) * (6 * strlen(str) + 3));
+    int fill = 0;
+
+    rt_str[fill++] = '"';
+    for (; *str != 0; str++) {
+        unsigned char ch = (unsigned char) *str;
+        if ((ch == '"') || (ch == '\\')) {
+            rt_str[fill++] = '\\';
+            rt_str[fill++] = ch;
+        } else if (ch < 0x20) {
+            fill += sprintf(rt_str + fill, "\\u%04x", ch);
+        } else {
+            rt_str[fill++] = ch;
+        }
+    }
+    rt_str[fill++] = '"';
+
+    return rt_str;
+}
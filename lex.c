@@ -0,0 +1,270 @@
+/*
+ * lex.c
+ * single-pass lexer classifying the characters of a function
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <string.h>
+#include "lex.h"
+#include "gov.h"
+#include "mem.h"
+#include "struct.h"
+
+/* character classes; 0 is anything not listed, like the default case of id_ch_tp() */
+enum {cl_oth, cl_dig, cl_dot, cl_e, cl_x, cl_alp, cl_opr, cl_pow, cl_sig, cl_lpar, cl_rpar};
+
+static const unsigned char ch_cls[128] = {
+    ['0'] = cl_dig, ['1'] = cl_dig, ['2'] = cl_dig, ['3'] = cl_dig, ['4'] = cl_dig,
+    ['5'] = cl_dig, ['6'] = cl_dig, ['7'] = cl_dig, ['8'] = cl_dig, ['9'] = cl_dig,
+    ['.'] = cl_dot, ['e'] = cl_e, ['x'] = cl_x,
+    ['a'] = cl_alp, ['b'] = cl_alp, ['c'] = cl_alp, ['d'] = cl_alp, ['f'] = cl_alp,
+    ['g'] = cl_alp, ['h'] = cl_alp, ['i'] = cl_alp, ['j'] = cl_alp, ['k'] = cl_alp,
+    ['l'] = cl_alp, ['m'] = cl_alp, ['n'] = cl_alp, ['o'] = cl_alp, ['p'] = cl_alp,
+    ['q'] = cl_alp, ['r'] = cl_alp, ['s'] = cl_alp, ['t'] = cl_alp, ['u'] = cl_alp,
+    ['v'] = cl_alp, ['w'] = cl_alp, ['y'] = cl_alp, ['z'] = cl_alp,
+    ['*'] = cl_opr, ['/'] = cl_opr, ['^'] = cl_pow, ['+'] = cl_sig, ['-'] = cl_sig,
+    ['('] = cl_lpar, [')'] = cl_rpar
+};
+
+/* id_ch_tp() of every class */
+static const ch_type cl_ch_tp[] = {
+    [cl_oth] = pt_fnc, [cl_dig] = pt_cst, [cl_dot] = pt_fnc, [cl_e] = pt_cst,
+    [cl_x] = pt_var, [cl_alp] = pt_fnc, [cl_opr] = pt_opr, [cl_pow] = pt_fnc,
+    [cl_sig] = pt_sig, [cl_lpar] = pt_par, [cl_rpar] = pt_par
+};
+
+/*
+ * Perfect hash of the function names and pi: (length + asso[1st] + asso[2nd] + asso[3rd]) & 15,
+ * the 3rd character counting only for names longer than two. The values were searched offline
+ * so that no two names share a slot; a probe is confirmed with a single strncmp().
+ */
+static const unsigned char asso[128] = {
+    ['a'] = 13, ['c'] = 10, ['e'] = 6, ['g'] = 7, ['i'] = 6, ['l'] = 9,
+    ['n'] = 7, ['o'] = 12, ['p'] = 11, ['s'] = 13, ['t'] = 2
+};
+
+static const struct {
+    char *str;
+    fn_name nm;
+} nm_tab[16] = {
+    {"sec", nm_sec}, {"sech", nm_sech}, {"ln", nm_ln}, {"pi", nm_pi},
+    {"csc", nm_csc}, {"csch", nm_csch}, {"cos", nm_cos}, {"cosh", nm_cosh},
+    {"", nm_none}, {"tan", nm_tan}, {"tanh", nm_tanh}, {"cot", nm_cot},
+    {"coth", nm_coth}, {"sin", nm_sin}, {"sinh", nm_sinh}, {"log", nm_log}
+};
+
+static const fn_type nm_tp[] = {
+    [nm_none] = cnst, [nm_sin] = trig, [nm_cos] = trig, [nm_tan] = trig,
+    [nm_csc] = trig, [nm_sec] = trig, [nm_cot] = trig, [nm_sinh] = hypl,
+    [nm_cosh] = hypl, [nm_tanh] = hypl, [nm_csch] = hypl, [nm_sech] = hypl,
+    [nm_coth] = hypl, [nm_ln] = loga, [nm_log] = loga, [nm_pi] = cnst
+};
+
+static int cls(char ch) {
+    return ((unsigned char) ch < 128) ? ch_cls[(unsigned char) ch] : cl_oth;
+}
+
+static int hash_ch(char ch) {
+    return ((unsigned char) ch < 128) ? asso[(unsigned char) ch] : 0;
+}
+
+/* Identifies the function name or constant spelled by exactly the len first characters of str. */
+fn_name id_fn_nm(char *str, int len) {
+    if ((len < 2) || (len > 4)) {
+        return nm_none;
+    }
+
+    int slot = len + hash_ch(str[0]) + hash_ch(str[1]);
+    if (len > 2) {
+        slot += hash_ch(str[2]);
+    }
+    slot &= 15;
+
+    if ((strlen(nm_tab[slot].str) == (size_t) len) && (strncmp(str, nm_tab[slot].str, len) == 0)) {
+        return nm_tab[slot].nm;
+    } else {
+        return nm_none;
+    }
+}
+
+/* Returns the type of function a name denotes. */
+fn_type id_nm_tp(fn_name nm) {
+    return nm_tp[nm];
+}
+
+/* Determines whether a function name ends right before index i. */
+bool fn_suffix(char *str, int i) {
+    int len;
+    for (len = 2; (len <= 4) && (len <= i); len++) {
+        fn_name nm = id_fn_nm(str + i - len, len);
+        if ((nm != nm_none) && (nm != nm_pi)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Returns the length of the longest function name or constant starting str, or 0. */
+int nm_len(char *str, fn_name *nm) {
+    int len = 0;
+    while ((len < 4) && (cls(str[len]) == cl_alp || str[len] == 'e')) {   // names use letters only
+        len++;
+    }
+
+    for (; len >= 2; len--) {
+        if ((*nm = id_fn_nm(str, len)) != nm_none) {
+            return len;
+        }
+    }
+
+    *nm = nm_none;
+    return 0;
+}
+
+/* Checks whether a boundary falls on index i, with the same rules as is_boundary(). */
+static bool lex_bd(char *str, int i, int par) {
+    if ((i == 0) || (par != 0)) {
+        return false;
+    }
+
+    char ch_0 = str[i], ch_1 = str[i - 1], ch_2 = (i >= 2) ? str[i - 2] : 0;
+    int cl_0 = cls(ch_0), cl_1 = cls(ch_1);
+
+    if (cl_0 == cl_opr) {                                  // explicit boundary
+        return true;
+    } else if (cl_0 == cl_pow) {                           // used as part of exponentiation
+        return false;
+    } else if ((ch_1 == 'i') && (ch_2 == 'p')) {           // pi
+        return true;
+    } else if (cl_1 == cl_e) {                             // e
+        return (ch_2 != 's') && (ch_0 != 'c');
+    } else if ((cl_0 == cl_dot) || (cl_1 == cl_dot)) {     // decimal
+        return false;
+    } else if ((cl_0 == cl_lpar) || (cl_ch_tp[cl_0] != cl_ch_tp[cl_1])) {
+        if ((cl_1 == cl_pow) || (cl_1 == cl_sig)) {        // exponent or sign
+            return false;
+        } else if ((cl_0 == cl_lpar) && ((cl_1 == cl_rpar) || (cl_1 == cl_opr))) {
+            return true;
+        } else if ((cl_0 == cl_e) && (ch_1 == 's')) {      // sec, sech
+            return false;
+        } else {                                           // unless it opens a function argument
+            return !fn_suffix(str, i);
+        }
+    } else {
+        return (cl_0 == cl_x);
+    }
+}
+
+/* Starts lexing str from its first character. */
+void lex_init(lexer *lx, char *str) {
+    gov_check();
+
+    lx->str = str;
+    lx->len = strlen(str);
+    lx->ind = 0;
+    lx->par = 0;
+    lx->last = cl_oth;
+    lx->first = true;
+}
+
+/* Reads the next token into tk, resolving its boundary and delimiter; false once tk_end was read. */
+bool lex_next(lexer *lx, token *tk) {
+    char *str = lx->str;
+    int ind = lx->ind, len = lx->len;
+    if (ind > len) {
+        return false;
+    }
+
+    int cl = cls(str[ind]);
+    tk->pos = ind;
+    tk->len = 1;
+    tk->depth = lx->par;
+    tk->bd = lex_bd(str, ind, lx->par);
+    tk->delim = false;
+
+    if (ind == len) {
+        tk->type = tk_end;
+        tk->len = 0;
+    } else if ((cl == cl_dig) || (cl == cl_dot)) {
+        tk->type = tk_num;
+        while ((cls(str[ind + tk->len]) == cl_dig) || (cls(str[ind + tk->len]) == cl_dot)) {
+            tk->len++;
+        }
+    } else if (cl == cl_e) {
+        tk->type = tk_cst;
+    } else if (cl == cl_x) {
+        tk->type = tk_var;
+    } else if (cl == cl_alp) {
+        fn_name nm;
+        int n_ch = nm_len(str + ind, &nm);
+        if (n_ch == 0) {
+            tk->type = tk_unk;
+        } else if (nm == nm_pi) {
+            tk->type = tk_cst;
+            tk->len = n_ch;
+        } else {
+            tk->type = tk_fnc;
+            tk->len = n_ch;
+        }
+    } else if (cl == cl_opr) {
+        tk->type = tk_opr;
+    } else if (cl == cl_pow) {
+        tk->type = tk_pow;
+    } else if (cl == cl_sig) {
+        tk->type = tk_sig;
+        tk->delim = (lx->par == 0) && (ind != 0) &&
+                    (lx->first || ((lx->last != cl_sig) && (lx->last != cl_pow)));
+    } else if ((cl == cl_lpar) || (cl == cl_rpar)) {
+        tk->type = tk_par;
+        lx->par += (cl == cl_lpar) ? 1 : -1;
+    } else {
+        tk->type = tk_unk;
+    }
+
+    int end = ind + tk->len;
+    for (; ind < end; ind++) {
+        if (cls(str[ind]) != cl_opr) {
+            lx->last = cls(str[ind]);
+            lx->first = false;
+        }
+    }
+    lx->ind = (tk->type == tk_end) ? len + 1 : end;
+
+    return true;
+}
+
+/* Splits str into tokens in a single pass, resolving boundaries and delimiters. */
+tk_seq *lex(char *str) {
+    lexer lx;
+    lex_init(&lx, str);
+
+    tk_seq *seq = (tk_seq *) mem_alloc(sizeof(tk_seq));
+    seq->tk = (token *) mem_alloc(sizeof(token) * (lx.len + 1));
+    seq->n = 0;
+    while (lex_next(&lx, seq->tk + seq->n)) {
+        seq->n++;
+    }
+
+    return seq;
+}
@@ -24,19 +24,34 @@
  * SOFTWARE.
  */
 
+
+#include <errno.h>
+#include <signal.h>   // sigaction()
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>   // fork()
-#include <sys/wait.h> // wait()
+#include <unistd.h>   // getopt(), read()
+#include <sys/mman.h> // mmap()
+#include <sys/stat.h> // fstat()
 
+#include "derivative.h"
 #include "diff.h"
+#include "error.h"
+#include "json.h"
+#include "lex.h"
+#include "mem.h"
+#include "node.h"
 #include "parse.h"
+#include "pool.h"
+#include "proc.h"
+#include "ring.h"
+#include "server.h"
 #include "simplify.h"
 #include "struct.h"
 #include "utility.h"
 
 #define DEBUG 0
+#define DEBUG_TOKEN 1
 #define DEBUG_TERM 1
 #define DEBUG_BLOCK 1
 #define DEBUG_COMP 1
@@ -45,6 +60,19 @@
 #define DEBUG_SMIN 1
 #define DEBUG_SMOUT 1
 
+proc_pool *workers = NULL;                                 // with -f, the processes that derive
+volatile sig_atomic_t deriving = 0;                        // the REPL is waiting for a derivative
+
+/* Ctrl-C cancela a derivação em andamento no REPL; fora dela, encerra o programa */
+void on_sigint(int sig) {
+    if (deriving) {
+        deriv_cancel(NULL);
+    } else {
+        signal(sig, SIG_DFL);
+        raise(sig);
+    }
+}
+
 /* Função para exibir o cabeçalho */
 void print_header(void) {
     printf("===========================================\n");
@@ -73,106 +101,648 @@ void print_help(void) {
     printf("========================\n\n");
 }
 
-int main(int argc, char *argv[]) {
-    char *m_func = (char *) malloc(sizeof(char) * MAX_CHAR);
+/* Função para exibir as opções de linha de comando */
+void print_usage(char *prog) {
+    fprintf(stderr, "uso: %s [-f] [-s] [-S] [-M megabytes] [-T segundos]\n", prog);
+    fprintf(stderr, "uso: %s -b [-f] [-j threads] [-s] [-S] [arquivo]\n", prog);
+    fprintf(stderr, "uso: %s -m [-j threads] [-S]\n", prog);
+    fprintf(stderr, "uso: %s -u socket [-j threads] [-S]\n", prog);
+    fprintf(stderr, "uso: %s -r /nome [-j threads] [-S]\n", prog);
+    fprintf(stderr, "uso: %s -c expressão [-o biblioteca.so]\n", prog);
+    fprintf(stderr, "uso: %s -g a:b:pontos [-j threads] expressão\n", prog);
+    fprintf(stderr, "  -b  modo lote: deriva cada linha do arquivo (ou da entrada padrão), sem prompts\n");
+    fprintf(stderr, "  -c  gera o código C de f(x) e df(x) para a expressão\n");
+    fprintf(stderr, "  -g  avalia f(x) e f'(x) em pontos igualmente espaçados de [a, b]\n");
+    fprintf(stderr, "  -j  número de threads dos modos lote, máquina, servidor e grade\n");
+    fprintf(stderr, "  -M  limite de memória de cada derivação, em todos os modos\n");
+    fprintf(stderr, "  -m  modo máquina: pedidos e respostas em JSON, um objeto por linha\n");
+    fprintf(stderr, "  -o  com -c, compila o código em uma biblioteca compartilhada (gcc)\n");
+    fprintf(stderr, "  -f  avalia as entradas em processos filhos persistentes (isolamento)\n");
+    fprintf(stderr, "  -r  servidor: atende clientes locais em um anel de memória compartilhada\n");
+    fprintf(stderr, "  -s  mostra estatísticas de cada entrada em stderr\n");
+    fprintf(stderr, "  -S  deriva reescrevendo o texto da entrada, sem a árvore de expressão\n");
+    fprintf(stderr, "  -t  deriva sobre a árvore de expressão (o padrão; mantida por compatibilidade)\n");
+    fprintf(stderr, "  -T  limite de tempo de CPU de cada derivação, em todos os modos\n");
+    fprintf(stderr, "  -u  servidor: atende o modo máquina no socket Unix indicado\n");
+}
 
-    print_header();
+/* Lê a próxima linha, de qualquer tamanho, sem espaços; retorna NULL ao fim da entrada */
+char *read_input(char *prompt, char **line, size_t *cap) {
+    printf("%s", prompt);
+    fflush(stdout);
 
-    /* input inicial */
-    printf("Input: ");
-    fgets(m_func, MAX_CHAR, stdin);
-    m_func[strlen(m_func) - 1] = 0;
-    m_func = wo_space(m_func);
+    if (getline(line, cap, stdin) == -1) {
+        return NULL;
+    }
+    (*line)[strcspn(*line, "\n")] = 0;
 
-    pid_t pid;
-    while (strcmp(m_func, "exit") != 0) {
+    return wo_space(*line);
+}
 
-        /* Comando help */
-        if (strcmp(m_func, "help") == 0) {
-            print_help();
-            printf("Input: ");
-            fgets(m_func, MAX_CHAR, stdin);
-            m_func[strlen(m_func) - 1] = 0;
-            m_func = wo_space(m_func);
-            continue;
+/* Deriva m_func; retorna a derivada, ou NULL com a mensagem em err se a entrada for inválida */
+char *derive(char *m_func, bool tree, char **err) {
+    #if DEBUG
+        #if DEBUG_TOKEN
+        debug_seq(m_func, lex(m_func));
+        #endif
+
+        #if DEBUG_TERM
+        printf("n_term: %d\n", n_term(m_func));
+        term *tm = into_term(m_func);
+        debug_term(tm);
+        #endif
+
+        #if DEBUG_BLOCK
+        printf("n_block: %d\n", n_block(m_func));
+        block *bl = into_block(m_func);
+        debug_block(bl);
+        #endif
+
+        #if DEBUG_COMP
+        printf("is_composite(): %d\n", is_composite(m_func));
+        comp *cp = into_comp(m_func);
+        debug_comp(cp);
+        #endif
+
+        #if DEBUG_FN_TP
+        printf("0-cnst.\t1-expo.\t2-hypl.\t3-loga.\t4-poly.\t5-powr.\t6-trig.\n");
+        printf("fn_tp(): %d\n", id_fn_tp(m_func));
+        #endif
+
+        #if DEBUG_FN_DF
+        printf("fn_diff(): %s\n", fn_diff(m_func));
+        #endif
+
+        #if DEBUG_SMIN
+        printf("simp_input(): %s\n", simp_input(m_func));
+        #endif
+
+        #if DEBUG_SMOUT
+        printf("simp_output(): %s\n", simp_output(m_func));
+        #endif
+    #endif
+
+    if (workers != NULL) {
+        return proc_derive(workers, m_func, strlen(m_func), err);
+    }
+
+    int code;
+    char *derv = deriv_str(m_func, tree ? 0 : DERIV_STRING, &code);
+    if (derv == NULL) {
+        *err = (char *) deriv_strerror(code);
+    }
+
+    return derv;
+}
+
+/* Estatísticas da última entrada derivada pela thread, aqui ou em um processo do -f */
+void last_stats(long *hit, long *miss, size_t *used) {
+    if (workers != NULL) {
+        proc_stats(hit, miss, used);
+    } else {
+        diff_stats(hit, miss);
+        *used = mem_used();
+    }
+}
+
+/* Imprime em stderr as estatísticas da entrada atual */
+void print_stats(void) {
+    long hit, miss;
+    size_t used;
+    last_stats(&hit, &miss, &used);
+    fprintf(stderr, "memo: %ld hits, %ld misses; mem: %zu bytes\n", hit, miss, used);
+}
+
+/* Deriva m_func e imprime o resultado; tree usa a árvore de expressão, stat imprime estatísticas */
+void print_derivative(char *m_func, bool tree, bool stat) {
+    char *err;
+    char *derv = derive(m_func, tree, &err);
+    if (derv == NULL) {
+        printf("%s\n", err);
+        return;
+    }
+
+    printf("Output: %s\n", derv);
+    fflush(stdout);
+
+    if (stat) {
+        print_stats();
+    }
+}
+
+/* Deriva m_func em modo lote: uma linha com a derivada, ou com "error: " e o motivo */
+void batch_line(char *m_func, bool tree, bool stat) {
+    char *err;
+    char *derv = derive(m_func, tree, &err);
+    if (derv == NULL) {
+        printf("error: %s\n", err);
+    } else {
+        printf("%s\n", derv);
+    }
+
+    if (stat) {
+        print_stats();
+    }
+}
+
+/* Entrada do modo lote: o arquivo inteiro em memória ou, para pipes no modo serial, linha a linha */
+typedef struct bt_src {
+    FILE *in;
+    char *buf;                                             // whole input, or NULL to use getline()
+    size_t size;
+    size_t at;                                             // offset of the next line in buf
+    bool map;                                              // buf is mapped rather than read
+    char *line;                                            // getline() buffer
+    size_t cap;
+} bt_src;
+
+/* Prepara a leitura de in; um arquivo regular é mapeado, e whole lê também pipes de uma vez */
+void src_open(bt_src *src, FILE *in, bool whole) {
+    struct stat st;
+    memset(src, 0, sizeof(bt_src));
+    src->in = in;
+
+    if ((fstat(fileno(in), &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0)) {
+        void *pt = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(in), 0);
+        if (pt != MAP_FAILED) {
+            madvise(pt, st.st_size, MADV_SEQUENTIAL);
+            src->buf = (char *) pt;
+            src->size = st.st_size;
+            src->map = true;
+            return;
         }
+    }
 
-        if ((pid = fork()) < 0) {
-            perror("fork error");
+    if (whole) {
+        size_t cap = 1 << 16, got;
+        src->buf = (char *) malloc(cap);
+        while ((src->buf != NULL) && ((got = fread(src->buf + src->size, 1, cap - src->size, in)) > 0)) {
+            src->size += got;
+            if (src->size == cap) {
+                src->buf = (char *) realloc(src->buf, cap *= 2);
+            }
+        }
+        if (src->buf == NULL) {
+            perror("src_open");
             exit(1);
         }
+    }
+}
+
+/* Entrega a próxima linha, sem o '\n', como um trecho de len caracteres; false ao fim da entrada */
+bool src_next(bt_src *src, char **str, size_t *len) {
+    if (src->buf == NULL) {
+        if (getline(&src->line, &src->cap, src->in) == -1) {
+            return false;
+        }
+        *str = src->line;
+        *len = strcspn(src->line, "\n");
+        return true;
+    }
+
+    if (src->at >= src->size) {
+        return false;
+    }
+    char *end = (char *) memchr(src->buf + src->at, '\n', src->size - src->at);
+    *str = src->buf + src->at;
+    *len = (end != NULL) ? (size_t) (end - *str) : src->size - src->at;
+    src->at += *len + 1;
+
+    return true;
+}
+
+/* Desfaz o mapeamento e libera os buffers da entrada */
+void src_close(bt_src *src) {
+    if (src->map) {
+        munmap(src->buf, src->size);
+    } else {
+        free(src->buf);
+    }
+    free(src->line);
+}
+
+/* Linha do lote paralelo: o trecho da entrada e, depois de derivada, as saídas já formatadas */
+typedef struct bt_item {
+    char *line;                                            // not terminated; len characters of the input
+    size_t len;
+    char *out;                                             // line for stdout
+    char *stat;                                            // line for stderr, with -s
+} bt_item;
+
+typedef struct bt_ctx {
+    bt_item *item;
+    bool tree;
+    bool stat;
+} bt_ctx;
+
+/* Copia pre seguido de str e de uma quebra de linha para fora da arena */
+char *out_line(char *pre, char *str) {
+    size_t len = strlen(pre) + strlen(str) + 2;
+    char *out = (char *) malloc(len);
+    if (out == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+    snprintf(out, len, "%s%s\n", pre, str);
+
+    return out;
+}
+
+/* Deriva a linha ind do lote em uma thread do pool; a arena da thread é liberada em seguida */
+void batch_work(int ind, void *arg) {
+    bt_ctx *ctx = (bt_ctx *) arg;
+    bt_item *it = ctx->item + ind;
 
-        if (pid == 0) { // child
-            if (!par_paired(m_func, strlen(m_func))) {
-                printf("uneven number of open/closed parentheses\n");
-                exit(0);
+    char *err;
+    char *derv = derive(wo_nspace(it->line, it->len), ctx->tree, &err);
+    it->out = (derv == NULL) ? out_line("error: ", err) : out_line("", derv);
+
+    if (ctx->stat) {
+        char buf[96];
+        long hit, miss;
+        size_t used;
+        last_stats(&hit, &miss, &used);
+        snprintf(buf, sizeof(buf), "memo: %ld hits, %ld misses; mem: %zu bytes", hit, miss, used);
+        it->stat = out_line("", buf);
+    }
+
+    mem_reset();
+}
+
+/* Escreve a linha ind do lote, chamada na ordem da entrada */
+void batch_emit(int ind, void *arg) {
+    bt_ctx *ctx = (bt_ctx *) arg;
+    bt_item *it = ctx->item + ind;
+
+    fputs(it->out, stdout);
+    if (it->stat != NULL) {
+        fputs(it->stat, stderr);
+    }
+
+    free(it->out);
+    free(it->stat);
+}
+
+/* Modo lote com n_thr threads: separa todas as linhas da entrada e as deriva em paralelo */
+int run_batch_mt(FILE *in, int n_thr, bool tree, bool stat) {
+    bt_ctx ctx = {NULL, tree, stat};
+    int n = 0, cap = 0;
+
+    bt_src src;
+    src_open(&src, in, true);
+
+    char *line;
+    size_t len;
+    while (src_next(&src, &line, &len)) {
+        if (n == cap) {
+            cap = (cap == 0) ? 1024 : cap * 2;
+            ctx.item = (bt_item *) realloc(ctx.item, sizeof(bt_item) * cap);
+            if (ctx.item == NULL) {
+                perror("realloc");
+                exit(1);
             }
+        }
+        ctx.item[n].line = line;                           // a slice of the input, not a copy
+        ctx.item[n].len = len;
+        ctx.item[n].out = NULL;
+        ctx.item[n].stat = NULL;
+        n++;
+    }
 
-            #if DEBUG
-                #if DEBUG_TERM
-                printf("n_term: %d\n", n_term(m_func));
-                term *tm = into_term(m_func);
-                debug_term(tm);
-                #endif
-
-                #if DEBUG_BLOCK
-                printf("n_block: %d\n", n_block(m_func));
-                block *bl = into_block(m_func);
-                debug_block(bl);
-                #endif
-
-                #if DEBUG_COMP
-                printf("is_composite(): %d\n", is_composite(m_func));
-                comp *cp = into_comp(m_func);
-                debug_comp(cp);
-                #endif
-
-                #if DEBUG_FN_TP
-                printf("0-cnst.\t1-expo.\t2-hypl.\t3-loga.\t4-poly.\t5-powr.\t6-trig.\n");
-                printf("fn_tp(): %d\n", id_fn_tp(m_func));
-                #endif
-
-                #if DEBUG_FN_DF
-                printf("fn_diff(): %s\n", fn_diff(m_func));
-                #endif
-
-                #if DEBUG_SMIN
-                printf("simp_input(): %s\n", simp_input(m_func));
-                #endif
-
-                #if DEBUG_SMOUT
-                printf("simp_output(): %s\n", simp_output(m_func));
-                #endif
-            #endif
-
-            char *derv = differentiate(simp_input(m_func), 1);
-            derv = simp_output(derv);
-            while (par_enclosed(derv)) {
-                derv = rm_par(derv);
+    pool_run(n, n_thr, batch_work, batch_emit, &ctx);
+
+    fflush(stdout);
+    src_close(&src);
+    free(ctx.item);
+    return 0;
+}
+
+/* Deriva n itens de ctx, em n_thr threads se n_thr > 0, escrevendo-os na ordem */
+void run_items(bt_ctx *ctx, int n, int n_thr, pool_fn work) {
+    if ((n_thr > 0) && (n > 1)) {
+        pool_run(n, n_thr, work, batch_emit, ctx);
+        return;
+    }
+
+    int ind;
+    for (ind = 0; ind < n; ind++) {
+        work(ind, ctx);
+        batch_emit(ind, ctx);
+    }
+}
+
+/* Responde ao pedido JSON da linha ind */
+void json_work(int ind, void *arg) {
+    bt_ctx *ctx = (bt_ctx *) arg;
+    bt_item *it = ctx->item + ind;
+
+    it->out = js_rsp(it->line, it->len, ctx->tree ? 0 : DERIV_STRING);
+    mem_reset();
+}
+
+/*
+ * Modo máquina: lê pedidos JSON da entrada padrão enquanto chegam e responde a todos os pedidos
+ * completos de cada leitura de uma vez, para que o cliente possa manter vários em andamento.
+ */
+int run_json(int n_thr, bool tree) {
+    bt_ctx ctx = {NULL, tree, false};
+    int n_cap = 0;
+    size_t cap = 1 << 16, len = 0;
+    char *buf = (char *) malloc(cap);
+    bool eof = false;
+
+    while (!eof) {
+        if (len == cap) {
+            buf = (char *) realloc(buf, cap *= 2);
+        }
+        if (buf == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+
+        ssize_t got = read(STDIN_FILENO, buf + len, cap - len);
+        if (got > 0) {
+            len += got;
+        } else if ((got == 0) || (errno != EINTR)) {
+            eof = true;                                    // a last line without '\n' still counts
+        }
+
+        int n = 0;
+        size_t at = 0;
+        while (at < len) {
+            char *nl = (char *) memchr(buf + at, '\n', len - at);
+            if ((nl == NULL) && !eof) {
+                break;
             }
+            size_t l = (nl != NULL) ? (size_t) (nl - (buf + at)) : len - at;
 
-            printf("Output: ");
-            if (strcmp(derv, "") == 0) {
-                printf("0");
-            } else if (*derv == '+') {
-                printf("%s\n", derv + 1);
-            } else {
-                printf("%s\n", derv);
+            size_t sp = 0;
+            while ((sp < l) && ((buf[at + sp] == ' ') || (buf[at + sp] == '\t') || (buf[at + sp] == '\r'))) {
+                sp++;
             }
 
-            exit(0);
-        } else { // parent
-            wait(NULL);
+            if (sp < l) {                                  // blank lines get no response
+                if (n == n_cap) {
+                    n_cap = (n_cap == 0) ? 64 : n_cap * 2;
+                    ctx.item = (bt_item *) realloc(ctx.item, sizeof(bt_item) * n_cap);
+                    if (ctx.item == NULL) {
+                        perror("realloc");
+                        exit(1);
+                    }
+                }
+                ctx.item[n].line = buf + at;
+                ctx.item[n].len = l;
+                ctx.item[n].out = NULL;
+                ctx.item[n].stat = NULL;
+                n++;
+            }
+            at += l + 1;
         }
 
-        /* próximo input */
-        printf("Entrada: ");
-        fgets(m_func, MAX_CHAR, stdin);
-        m_func[strlen(m_func) - 1] = 0;
-        m_func = wo_space(m_func);
+        run_items(&ctx, n, n_thr, json_work);
+        fflush(stdout);
+
+        at = (at < len) ? at : len;
+        memmove(buf, buf + at, len - at);
+        len -= at;
+    }
+
+    mem_release();
+    free(ctx.item);
+    free(buf);
+    return 0;
+}
+
+/* Modo lote: deriva cada linha de in, sem prompts, escrevendo as saídas na ordem da entrada */
+int run_batch(FILE *in, bool tree, bool stat) {
+    bt_src src;
+    src_open(&src, in, false);
+
+    char *line;
+    size_t len;
+    while (src_next(&src, &line, &len)) {
+        batch_line(wo_nspace(line, len), tree, stat);
+
+        /* libera a memória usada pela linha anterior */
+        mem_reset();
     }
 
-    free(m_func);
+    fflush(stdout);
+    mem_release();
+    src_close(&src);
     return 0;
 }
 
+/* Gera o código C de f(x) e df(x) para expr, ou com so compila a biblioteca compartilhada so */
+int run_emit(char *expr, char *so) {
+    int code;
+    deriv_prog *prog = deriv_compile(expr, strlen(expr), DERIV_FUNC, &code);
+    if (prog == NULL) {
+        fprintf(stderr, "error: %s\n", deriv_strerror(code));
+        return 1;
+    }
+
+    long len = 0;
+    if (so != NULL) {
+        code = deriv_build(prog, NULL, so);
+    } else if ((len = deriv_emit(prog, NULL, NULL, 0)) >= 0) {
+        char *text = (char *) malloc(len + 1);
+        if (text == NULL) {
+            perror("malloc failed");
+            exit(1);
+        }
+        deriv_emit(prog, NULL, text, len + 1);
+        fputs(text, stdout);
+        free(text);
+        code = 0;
+    } else {
+        code = (int) len;
+    }
+
+    deriv_prog_free(prog);
+    if (code < 0) {
+        fprintf(stderr, "error: %s\n", deriv_strerror(code));
+        return 1;
+    }
+    return 0;
+}
+
+/* Avalia f(x) e f'(x) em n pontos igualmente espaçados de [a, b] com n_thr threads, um ponto por linha */
+int run_grid(char *expr, char *spec, int n_thr) {
+    double a, b;
+    long n;
+    char end;
+    if ((sscanf(spec, "%lf:%lf:%ld%c", &a, &b, &n, &end) != 3) || (n < 1)) {
+        fprintf(stderr, "error: grade inválida: %s (use a:b:pontos)\n", spec);
+        return 1;
+    }
+
+    int code;
+    deriv_prog *prog = deriv_compile(expr, strlen(expr), DERIV_FUNC, &code);
+    if (prog == NULL) {
+        fprintf(stderr, "error: %s\n", deriv_strerror(code));
+        return 1;
+    }
+
+    double *df = (double *) malloc(sizeof(double) * n);
+    double *f = (double *) malloc(sizeof(double) * n);
+    if ((df == NULL) || (f == NULL)) {
+        perror("malloc failed");
+        exit(1);
+    }
+    deriv_grid(prog, a, b, 0, (size_t) n, (n_thr > 0) ? n_thr : (int) sysconf(_SC_NPROCESSORS_ONLN), df, f);
+
+    double h = (n > 1) ? (b - a) / (double) (n - 1) : 0;
+    long ind;
+    for (ind = 0; ind < n; ind++) {                        // os mesmos pontos de deriv_grid()
+        printf("%.17g\t%.17g\t%.17g\n", (ind == n - 1) && (n > 1) ? b : a + (double) ind * h, f[ind], df[ind]);
+    }
+
+    fflush(stdout);
+    free(df);
+    free(f);
+    deriv_prog_free(prog);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    bool batch = false;                                    // one derivative per input line, no prompts
+    bool json = false;                                     // JSON requests and responses
+    char *sock = NULL;                                     // Unix socket to serve on
+    char *ring = NULL;                                     // shared memory ring to serve on
+    char *emit = NULL;                                     // expression to generate C code for
+    char *so = NULL;                                       // shared object to build it into
+    char *grid = NULL;                                     // a:b:n of the points to evaluate at
+    bool iso = false;                                      // derive in worker processes
+    bool tree = true;                                      // expression tree; -S goes back to the string engine
+    bool stat = false;                                     // per-input statistics on stderr
+    int n_thr = 0;                                         // batch threads; 0 keeps the serial loop
+    double sec = 0;                                        // CPU time limit of each derivation
+    size_t bytes = 0;                                      // memory limit of each derivation
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bc:fg:j:M:mo:r:sStT:u:")) != -1) {
+        if (opt == 'b') {
+            batch = true;
+        } else if (opt == 'c') {
+            emit = optarg;
+        } else if (opt == 'm') {
+            json = true;
+        } else if ((opt == 'M') && (atof(optarg) > 0)) {
+            bytes = (size_t) (atof(optarg) * 1024 * 1024);
+        } else if ((opt == 'j') && (atoi(optarg) > 0)) {
+            n_thr = atoi(optarg);
+        } else if (opt == 'f') {
+            iso = true;
+        } else if (opt == 'g') {
+            grid = optarg;
+        } else if (opt == 'o') {
+            so = optarg;
+        } else if (opt == 'r') {
+            ring = optarg;
+        } else if (opt == 's') {
+            stat = true;
+        } else if (opt == 't') {
+            tree = true;
+        } else if (opt == 'S') {
+            tree = false;
+        } else if ((opt == 'T') && (atof(optarg) > 0)) {
+            sec = atof(optarg);
+        } else if (opt == 'u') {
+            sock = optarg;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int modes = batch + json + (sock != NULL) + (ring != NULL) + (emit != NULL) + (grid != NULL);  // each excludes the others
+    if ((modes > 1) || ((n_thr > 0) && (modes == 0)) || (iso && (modes != 0) && !batch) || ((so != NULL) && (emit == NULL)) ||
+        ((grid != NULL) && (optind != argc - 1))) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    deriv_limit(NULL, sec, bytes);
+
+    if (emit != NULL) {
+        return run_emit(emit, so);
+    }
+
+    if (grid != NULL) {
+        return run_grid(argv[optind], grid, n_thr);
+    }
+
+    if (ring != NULL) {
+        return ring_serve(ring, (n_thr > 0) ? n_thr : (int) sysconf(_SC_NPROCESSORS_ONLN), tree ? 0 : DERIV_STRING);
+    }
+
+    if (sock != NULL) {
+        return serve(sock, (n_thr > 0) ? n_thr : (int) sysconf(_SC_NPROCESSORS_ONLN), tree ? 0 : DERIV_STRING);
+    }
+
+    if (json) {
+        return run_json(n_thr, tree);
+    }
+
+    if (iso) {
+        workers = proc_new((n_thr > 0) ? n_thr : 1, tree ? 0 : DERIV_STRING);
+    }
+
+    if (batch) {
+        FILE *in = stdin;
+        if ((optind < argc) && (strcmp(argv[optind], "-") != 0)) {
+            if ((in = fopen(argv[optind], "r")) == NULL) {
+                perror(argv[optind]);
+                return 1;
+            }
+        }
+
+        int rc = (n_thr > 0) ? run_batch_mt(in, n_thr, tree, stat) : run_batch(in, tree, stat);
+        if (in != stdin) {
+            fclose(in);
+        }
+        if (workers != NULL) {
+            proc_free(workers);
+        }
+        return rc;
+    }
+
+    char *line = NULL;                                     // grown by getline()
+    size_t cap = 0;
+
+    print_header();
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigint;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &sa, NULL);
+
+    /* input inicial */
+    char *m_func = read_input("Input: ", &line, &cap);
+
+    while ((m_func != NULL) && (strcmp(m_func, "exit") != 0)) {
+
+        /* Comando help */
+        if (strcmp(m_func, "help") == 0) {
+            print_help();
+        } else {
+            deriving = 1;
+            print_derivative(m_func, tree, stat);
+            deriving = 0;
+        }
+
+        /* libera a memória usada pela entrada anterior */
+        mem_reset();
+
+        /* próximo input */
+        m_func = read_input("Entrada: ", &line, &cap);
+    }
+
+    if (workers != NULL) {
+        proc_free(workers);
+    }
+    mem_release();
+    free(line);
+    return 0;
+}
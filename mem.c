@@ -0,0 +1,254 @@
+/*
+ * mem.c
+ * per-request memory management
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mem.h"
+
+#define MEM_CHUNK (64 * 1024)                              // bytes of a regular chunk
+#define MEM_KEEP (1024 * 1024)                             // chunk bytes kept across resets
+
+/*
+ * Bump allocator: requests are carved out of large chunks and a reset only rewinds them, so a
+ * long-lived process reuses the same few chunks for every input instead of growing. Allocations
+ * come from the arena selected with mem_use(), by default one of the calling thread's own, so
+ * threads differentiating different inputs never share a chunk.
+ */
+typedef struct mem_chk {
+    struct mem_chk *next;
+    size_t cap;
+    size_t used;
+} mem_chk;
+
+#define MEM_HDR ((sizeof(mem_chk) + 15) & ~(size_t) 15)     // keeps the data 16-byte aligned
+
+struct mem_arena {
+    mem_chk *head;                                         // chunk being filled, older ones follow
+    mem_chk *spare;                                        // rewound chunks of previous requests
+    size_t bytes;                                          // handed out since the last reset
+    char *last;                                            // latest allocation, which mem_grow() extends in place
+    mem_chk *last_chk;                                     // chunk holding last
+    unsigned long gen;                                     // request the arena is serving
+};
+
+static unsigned long mem_gens = 0;                         // generations handed out, shared by all arenas
+static _Thread_local mem_arena mem_own;                    // arena of the calling thread
+static _Thread_local mem_arena *mem_cur = NULL;            // arena in use, or NULL before the first call
+static _Thread_local size_t mem_cap = 0;                   // bytes the arena in use may reach, 0 for no limit
+static _Thread_local void (*mem_over)(void) = NULL;        // called instead of going past mem_cap
+
+/* Numbers a request uniquely across arenas, so caches keyed on mem_epoch() never mix them up. */
+static unsigned long mem_next_gen(void) {
+    return __atomic_add_fetch(&mem_gens, 1, __ATOMIC_RELAXED);
+}
+
+/* Returns the arena in use on this thread. */
+static mem_arena *mem_ar(void) {
+    if (mem_cur == NULL) {
+        mem_own.gen = mem_next_gen();
+        mem_cur = &mem_own;
+    }
+    return mem_cur;
+}
+
+/* Takes a spare chunk of at least cap bytes, or a new one. */
+static mem_chk *mem_chunk(mem_arena *ar, size_t cap) {
+    mem_chk **pt;
+    for (pt = &ar->spare; *pt != NULL; pt = &(*pt)->next) {
+        if ((*pt)->cap >= cap) {
+            mem_chk *chk = *pt;
+            *pt = chk->next;
+            return chk;
+        }
+    }
+
+    mem_chk *chk = (mem_chk *) malloc(MEM_HDR + cap);
+    if (chk == NULL) {
+        perror("mem_alloc");
+        exit(1);
+    }
+    chk->cap = cap;
+    return chk;
+}
+
+/* Carves size bytes out of the current chunk; a block needing its own chunk gets room for reserve. */
+static void *mem_take(size_t size, size_t reserve) {
+    mem_arena *ar = mem_ar();
+    size = (size + 15) & ~(size_t) 15;
+    reserve = (reserve + 15) & ~(size_t) 15;
+    if ((mem_cap > 0) && (ar->bytes + size > mem_cap)) {
+        mem_over();
+    }
+
+    mem_chk *chk = ar->head;
+    if ((chk == NULL) || (chk->used + size > chk->cap)) {
+        int own = (size > MEM_CHUNK / 4);
+        chk = mem_chunk(ar, own ? reserve : MEM_CHUNK);
+        chk->used = 0;
+
+        if (own && (ar->head != NULL)) {                   // a large block keeps the current chunk
+            chk->next = ar->head->next;
+            ar->head->next = chk;
+        } else {
+            chk->next = ar->head;
+            ar->head = chk;
+        }
+    }
+
+    char *pt = (char *) chk + MEM_HDR + chk->used;
+    chk->used += size;
+    ar->bytes += size;
+    ar->last = pt;
+    ar->last_chk = chk;
+
+    return memset(pt, 0, size);
+}
+
+/* Allocates zero-filled memory which lives until the next mem_reset(). */
+void *mem_alloc(size_t size) {
+    return mem_take(size, size);
+}
+
+/*
+ * Resizes a block whose first old bytes are in use to size bytes. The latest allocation grows in
+ * place while its chunk has room; any other block is copied, with room reserved to grow again.
+ */
+void *mem_grow(void *ptr, size_t old, size_t size) {
+    mem_arena *ar = mem_ar();
+    size_t new_r = (size + 15) & ~(size_t) 15;
+
+    if ((ptr != NULL) && (ptr == ar->last)) {
+        size_t off = (char *) ptr - ((char *) ar->last_chk + MEM_HDR);
+        if (off + new_r <= ar->last_chk->cap) {
+            size_t bytes = ar->bytes - (ar->last_chk->used - off) + new_r;
+            if ((mem_cap > 0) && (bytes > mem_cap)) {
+                mem_over();
+            }
+            if (size > old) {
+                memset((char *) ptr + old, 0, new_r - old);
+            }
+            ar->bytes = bytes;
+            ar->last_chk->used = off + new_r;
+            return ptr;
+        }
+    }
+
+    char *pt = (char *) mem_take(size, 2 * size);
+    memcpy(pt, ptr, (old < size) ? old : size);
+    return pt;
+}
+
+/* Releases everything allocated since the previous reset, keeping up to MEM_KEEP bytes of chunks. */
+void mem_reset(void) {
+    mem_arena *ar = mem_ar();
+    size_t kept = 0;
+    mem_chk *chk;
+    for (chk = ar->spare; chk != NULL; chk = chk->next) {
+        kept += chk->cap;
+    }
+
+    while (ar->head != NULL) {
+        chk = ar->head;
+        ar->head = chk->next;
+
+        if (kept + chk->cap <= MEM_KEEP) {
+            chk->next = ar->spare;
+            ar->spare = chk;
+            kept += chk->cap;
+        } else {
+            free(chk);
+        }
+    }
+    ar->bytes = 0;
+    ar->last = NULL;
+    ar->last_chk = NULL;
+    ar->gen = mem_next_gen();
+}
+
+/* Returns all chunks of ar to the system. */
+static void mem_drop(mem_arena *ar) {
+    mem_chk *chk;
+    while ((chk = ar->head) != NULL) {
+        ar->head = chk->next;
+        free(chk);
+    }
+    while ((chk = ar->spare) != NULL) {
+        ar->spare = chk->next;
+        free(chk);
+    }
+}
+
+/* Returns every chunk of the thread's own arena to the system, at exit. */
+void mem_release(void) {
+    mem_drop(&mem_own);
+    memset(&mem_own, 0, sizeof(mem_arena));
+    mem_own.gen = mem_next_gen();
+}
+
+/*
+ * Calls over, which is not expected to return, rather than let the arena in use hand out more
+ * than cap bytes in all; 0 lifts the limit.
+ */
+void mem_limit(size_t cap, void (*over)(void)) {
+    mem_cap = cap;
+    mem_over = over;
+}
+
+/* Bytes handed out to the current request. */
+size_t mem_used(void) {
+    return mem_ar()->bytes;
+}
+
+/* Identifies the current request, so that caches built with mem_alloc() know when they are stale. */
+unsigned long mem_epoch(void) {
+    return mem_ar()->gen;
+}
+
+/* Makes an empty arena, for a caller that wants its memory apart from the thread's own. */
+mem_arena *mem_new(void) {
+    mem_arena *ar = (mem_arena *) calloc(1, sizeof(mem_arena));
+    if (ar != NULL) {
+        ar->gen = mem_next_gen();
+    }
+    return ar;
+}
+
+/* Frees an arena made with mem_new(); it must not be in use. */
+void mem_free(mem_arena *ar) {
+    if (ar != NULL) {
+        mem_drop(ar);
+        free(ar);
+    }
+}
+
+/* Makes ar the arena of this thread's allocations, or its own one for NULL; returns the previous. */
+mem_arena *mem_use(mem_arena *ar) {
+    mem_arena *prev = mem_ar();
+    mem_cur = (ar != NULL) ? ar : &mem_own;
+    return (prev == &mem_own) ? NULL : prev;
+}
@@ -0,0 +1,46 @@
+/*
+ * mem.h
+ * memory functions prototypes
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef MEM_H
+#define MEM_H
+
+#include <stddef.h>
+
+typedef struct mem_arena mem_arena;
+
+void *mem_alloc(size_t size);
+unsigned long mem_epoch(void);
+void mem_free(mem_arena *ar);
+void *mem_grow(void *ptr, size_t old, size_t size);
+void mem_limit(size_t cap, void (*over)(void));
+mem_arena *mem_new(void);
+void mem_release(void);
+void mem_reset(void);
+size_t mem_used(void);
+mem_arena *mem_use(mem_arena *ar);
+
+#endif
@@ -0,0 +1,269 @@
+/*
+ * node.c
+ * Construction and printing of expression trees
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gov.h"
+#include "mem.h"
+#include "node.h"
+#include "struct.h"
+
+static char *fn_str[] = {
+    [nm_none] = "e", [nm_sin] = "sin", [nm_cos] = "cos", [nm_tan] = "tan",
+    [nm_csc] = "csc", [nm_sec] = "sec", [nm_cot] = "cot", [nm_sinh] = "sinh",
+    [nm_cosh] = "cosh", [nm_tanh] = "tanh", [nm_csch] = "csch", [nm_sech] = "sech",
+    [nm_coth] = "coth", [nm_ln] = "ln", [nm_log] = "log", [nm_pi] = "pi"
+};
+
+/*
+ * Every node is interned in a per-request open-addressing table, so that structurally equal
+ * subexpressions are the same node: derivatives share the factors they repeat instead of
+ * copying them, and equality of two subtrees is a pointer comparison. The table is per thread.
+ */
+static _Thread_local struct {
+    unsigned long epoch;                                   // mem_epoch() the table was allocated in
+    node **slot;
+    int cap;
+    int cnt;
+} tab = {0, NULL, 0, 0};
+
+static unsigned long nd_hash(nd_type type, fn_name nm, char *str, int len, node *lhs, node *rhs) {
+    unsigned long h = 1469598103934665603UL;
+    int ind;
+
+    h = (h ^ type) * 1099511628211UL;
+    h = (h ^ nm) * 1099511628211UL;
+    for (ind = 0; ind < len; ind++) {
+        h = (h ^ (unsigned char) str[ind]) * 1099511628211UL;
+    }
+    h = (h ^ (unsigned long) lhs) * 1099511628211UL;
+    h = (h ^ (unsigned long) rhs) * 1099511628211UL;
+
+    return h ^ (h >> 29);
+}
+
+static bool nd_same(node *nd, nd_type type, fn_name nm, char *str, int len, node *lhs, node *rhs) {
+    if ((nd->type != type) || (nd->nm != nm) || (nd->lhs != lhs) || (nd->rhs != rhs)) {
+        return false;
+    }
+    return (type != nd_num) || ((strncmp(nd->num, str, len) == 0) && (nd->num[len] == 0));
+}
+
+/*
+ * Doubles the table, or starts a new one for a new request. The table only changes once the new
+ * one is filled, so a request failing over its memory limit in mem_alloc() leaves it as it was.
+ */
+static void tab_grow(void) {
+    node **old = tab.slot;
+    int old_cap = tab.cap, ind;
+    bool fresh = (tab.epoch != mem_epoch());               // the old table went with mem_reset()
+
+    if (fresh) {
+        old = NULL;
+        old_cap = 0;
+    }
+    int cap = (old_cap == 0) ? 256 : old_cap * 2;
+    node **slot = (node **) mem_alloc(sizeof(node *) * cap);
+
+    for (ind = 0; (old != NULL) && (ind < old_cap); ind++) {
+        if (old[ind] != NULL) {
+            node *nd = old[ind];
+            int len = (nd->num != NULL) ? strlen(nd->num) : 0;
+            unsigned long h = nd_hash(nd->type, nd->nm, nd->num, len, nd->lhs, nd->rhs);
+            while (slot[h & (cap - 1)] != NULL) {
+                h++;
+            }
+            slot[h & (cap - 1)] = nd;
+        }
+    }
+
+    if (fresh) {
+        tab.cnt = 0;
+    }
+    tab.epoch = mem_epoch();
+    tab.slot = slot;
+    tab.cap = cap;
+}
+
+/* Returns the unique node with these fields, creating it on first use. */
+static node *intern(nd_type type, fn_name nm, char *str, int len, node *lhs, node *rhs) {
+    if ((tab.slot == NULL) || (tab.epoch != mem_epoch()) || (2 * (tab.cnt + 1) > tab.cap)) {
+        tab_grow();
+    }
+
+    unsigned long h = nd_hash(type, nm, str, len, lhs, rhs);
+    node **slot;
+    for (slot = tab.slot + (h & (tab.cap - 1)); *slot != NULL; slot = tab.slot + (++h & (tab.cap - 1))) {
+        if (nd_same(*slot, type, nm, str, len, lhs, rhs)) {
+            return *slot;
+        }
+    }
+
+    node *nd = init_node(type, lhs, rhs);
+    nd->nm = nm;
+    if (type == nd_num) {
+        nd->num = (char *) mem_alloc(sizeof(char) * (len + 1));
+        strncpy(nd->num, str, len);
+        nd->val = strtod(nd->num, NULL);
+    }
+    *slot = nd;
+    tab.cnt++;
+
+    return nd;
+}
+
+/* Determines whether the tree depends on x. */
+bool dep_x(node *nd) {
+    return (nd != NULL) && nd->dep;
+}
+
+/* Checks whether the node is the number val. */
+bool is_val(node *nd, double val) {
+    return (nd->type == nd_num) && (nd->val == val);
+}
+
+/* Constant e (nm_none) or pi (nm_pi). */
+node *mk_cst(fn_name nm) {
+    return intern(nd_cst, nm, NULL, 0, NULL, NULL);
+}
+
+node *mk_fn(fn_name nm, node *arg) {
+    return intern(nd_fnc, nm, NULL, 0, arg, NULL);
+}
+
+/* Number spelled by the len first characters of str, kept as written. */
+node *mk_num(char *str, int len) {
+    return intern(nd_num, nm_none, str, len, NULL, NULL);
+}
+
+node *mk_op(nd_type type, node *lhs, node *rhs) {
+    return intern(type, nm_none, NULL, 0, lhs, rhs);
+}
+
+/* Number computed while differentiating or simplifying. */
+node *mk_val(double val) {
+    char str[32];
+    int len = snprintf(str, sizeof(str), "%.15g", val);
+
+    return mk_num(str, len);
+}
+
+node *mk_var() {
+    return intern(nd_var, nm_none, NULL, 0, NULL, NULL);
+}
+
+/* Binding strength of a node when printed; 5 never needs parentheses. */
+static int prec(node *nd) {
+    switch (nd->type) {
+        case nd_add:
+        case nd_sub:
+            return 1;
+        case nd_mul:
+        case nd_div:
+            return 2;
+        case nd_neg:
+            return 3;
+        case nd_pow:
+            return 4;
+        default:
+            return 5;
+    }
+}
+
+/* Leftmost and rightmost leaves, deciding whether two factors can be juxtaposed. */
+static node *leaf(node *nd, bool left) {
+    while ((nd->lhs != NULL) && (nd->type != nd_fnc)) {
+        nd = (left || (nd->rhs == NULL)) ? nd->lhs : nd->rhs;
+    }
+    return nd;
+}
+
+static int put(char *out, int at, char *str) {
+    int len = strlen(str);
+    if (out != NULL) {
+        memcpy(out + at, str, len);
+    }
+    return at + len;
+}
+
+/* Writes nd at out + at, parenthesised when it binds looser than min; returns the end index. */
+static int print(node *nd, char *out, int at, int min) {
+    gov_check();
+
+    if (prec(nd) < min) {
+        at = put(out, at, "(");
+        at = print(nd, out, at, 0);
+        return put(out, at, ")");
+    }
+
+    switch (nd->type) {
+        case nd_add:
+        case nd_sub:
+            at = print(nd->lhs, out, at, 1);
+            at = put(out, at, (nd->type == nd_add) ? "+" : "-");
+            return print(nd->rhs, out, at, (nd->type == nd_add) ? 1 : 2);
+        case nd_mul:
+            at = print(nd->lhs, out, at, 2);
+            if ((nd->rhs->type == nd_neg) || (nd->rhs->type == nd_div) ||   // ex) 2(-x), x(1/y)
+                ((leaf(nd->lhs, false)->type == nd_num) && (leaf(nd->rhs, true)->type == nd_num))) {
+                return print(nd->rhs, out, at, 6);
+            }
+            return print(nd->rhs, out, at, 2);
+        case nd_div:
+            at = print(nd->lhs, out, at, 2);
+            at = put(out, at, "/");
+            return print(nd->rhs, out, at, 4);
+        case nd_neg:
+            at = put(out, at, "-");
+            return print(nd->lhs, out, at, 2);
+        case nd_pow:
+            at = print(nd->lhs, out, at, 5);
+            at = put(out, at, "^");
+            return print(nd->rhs, out, at, 5);
+        case nd_fnc:
+            at = put(out, at, fn_str[nd->nm]);
+            at = put(out, at, "(");
+            at = print(nd->lhs, out, at, 0);
+            return put(out, at, ")");
+        case nd_num:
+            return put(out, at, nd->num);
+        case nd_cst:
+            return put(out, at, fn_str[nd->nm]);
+        default:
+            return put(out, at, "x");
+    }
+}
+
+/* Turns a tree into text with implicit multiplication and as few parentheses as it reads back with. */
+char *node_str(node *nd) {
+    int len = print(nd, NULL, 0, 0);
+    char *str = (char *) mem_alloc(sizeof(char) * (len + 1));
+    print(nd, str, 0, 0);
+
+    return str;
+}
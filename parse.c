@@ -27,6 +27,10 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include "gov.h"
+#include "lex.h"
+#include "mem.h"
+#include "node.h"
 #include "struct.h"
 #include "utility.h"
 
@@ -35,100 +39,22 @@ int n_block(char *str);
 
 /* Checks whether the character at index i is a boundary. */
 bool is_boundary(char *str, int i) {
-    if (i == 0) {
-        return false;
-    } else if (!par_paired(str, i)) {                      // exists unclosed parentheses
-        return false;
-    } else {                                               // all parentheses are paired
-        char ch_0 = str[i], ch_1 = str[i - 1], ch_2 = str[i - 2];
+    lexer lx;
+    token tk;
 
-        if ((ch_0 == '*') || (ch_0 == '/')) {              // explicit boundary
-            return true;
-        } else if (ch_0 == '^') {                          // used as part of exponentiation
-            return false;
-        } else if ((ch_1 == 'i') && (ch_2 == 'p')) {       // pi
-            return true;
-        } else if (ch_1 == 'e') {                          // e
-            if ((ch_2 != 's') && (ch_0 != 'c')) {
-                return true;
-            } else {
-                return false;
-            }
-        } else if ((ch_0 == '.') || (ch_1 == '.')) {       // decimal
-            return false;
-        } else if (ch_0 == '(') {                          // boundary unless used to enclose function arguments
-            if (ch_1 == '^') {
-                return false;
-            } else if ((ch_1 == '+') || (ch_1 == '-')) {   // sign
-                return false;
-            } else if ((ch_1 == ')') || (ch_1 == '*') || (ch_1 == '/')) {
-                return true;
-            } else {
-                char *prev_2 = (char *) malloc(sizeof(char) * 8);
-                char *prev_3 = (char *) malloc(sizeof(char) * 8);
-                char *prev_4 = (char *) malloc(sizeof(char) * 8);
-                strncpy(prev_2, str + i - 2, 2);
-                strncpy(prev_3, str + i - 3, 3);
-                strncpy(prev_4, str + i - 4, 4);
-                
-                if (strcmp(prev_2, "ln") == 0) {
-                    return false;
-                } else if ((strcmp(prev_4, "sinh") == 0) || (strcmp(prev_4, "cosh") == 0) || 
-                           (strcmp(prev_4, "tanh") == 0) || (strcmp(prev_4, "csch") == 0) ||
-                           (strcmp(prev_4, "sech") == 0) || (strcmp(prev_4, "coth") == 0)) {
-                    return false;
-                } else if ((strcmp(prev_3, "sin") == 0) || (strcmp(prev_3, "cos") == 0) || 
-                           (strcmp(prev_3, "tan") == 0) || (strcmp(prev_3, "csc") == 0) ||
-                           (strcmp(prev_3, "sec") == 0) || (strcmp(prev_3, "cot") == 0) ||
-                           (strcmp(prev_3, "log") == 0)) {
-                    return false;
-                } else {
-                    return true;
-                }
-            }
-        } else if (id_ch_tp(ch_0) != id_ch_tp(ch_1)) {     // change in character type
-            if (ch_1 == '^') {
-                return false;
-            } else if ((ch_1 == '+') || (ch_1 == '-')) {   // sign
-                return false;
-            } else if ((ch_0 == 'e') && (ch_1 == 's')) {
-                return false;
-            } else {
-                char *prev_2 = (char *) malloc(sizeof(char) * 8);
-                char *prev_3 = (char *) malloc(sizeof(char) * 8);
-                char *prev_4 = (char *) malloc(sizeof(char) * 8);
-                strncpy(prev_2, str + i - 2, 2);
-                strncpy(prev_3, str + i - 3, 3);
-                strncpy(prev_4, str + i - 4, 4);
-
-                if (strcmp(prev_2, "ln") == 0) {
-                    return false;
-                } else if ((strcmp(prev_4, "sinh") == 0) || (strcmp(prev_4, "cosh") == 0) || 
-                           (strcmp(prev_4, "tanh") == 0) || (strcmp(prev_4, "csch") == 0) ||
-                           (strcmp(prev_4, "sech") == 0) || (strcmp(prev_4, "coth") == 0)) {
-                    return false;
-                } else if ((strcmp(prev_3, "sin") == 0) || (strcmp(prev_3, "cos") == 0) || 
-                           (strcmp(prev_3, "tan") == 0) || (strcmp(prev_3, "csc") == 0) ||
-                           (strcmp(prev_3, "sec") == 0) || (strcmp(prev_3, "cot") == 0) ||
-                           (strcmp(prev_3, "log") == 0)) {
-                    return false;
-                } else {
-                    return true;
-                }
-            }
-        } else if (id_ch_tp(ch_0) == pt_var) {             // id_ch_tp(str[i]) = id_ch_tp(str[i - 1]) = pt_var
-            return true;
-        } else {
-            return false;
+    lex_init(&lx, str);
+    while (lex_next(&lx, &tk) && (tk.pos <= i)) {
+        if (tk.pos == i) {
+            return tk.bd;
         }
     }
+    return false;                                          // inside a name or a number
 }
 
 /* Checks whether the str is a composition of functions. */
 bool is_composite(char *str) {
     /* preserves the original str */
-    char *str_cpy = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-    strcpy(str_cpy, str);
+    char *str_cpy = str_dup(str);
 
     if (id_ch_tp(str_cpy[0]) == pt_sig) {                  // sign
         str_cpy++;
@@ -152,76 +78,35 @@ bool is_composite(char *str) {
     if (ch_tp == pt_var) {                                 // ex) x ^ (2 + 2.43)
         return false;
     } else if (ch_tp == pt_fnc) {                          // ex) sin(cosh(x + 234))
-        if (strncmp(str_cpy, "ln", 2) == 0) {
-            str_cpy += 2;
-
-            while (par_enclosed(str_cpy)) {
-                str_cpy = rm_par(str_cpy);
-            }
-
-            if ((n_term(str_cpy) != 1) || (n_block(str_cpy) != 1)) {
-                return true;
-            } else if (has_func(str_cpy)) {                // already confirmed 'x' exists
-                return true;
-            } else {
-                return false;
-            }
-        } else if ((strncmp(str_cpy, "sinh", 4) == 0) || (strncmp(str_cpy, "cosh", 4) == 0) ||
-                   (strncmp(str_cpy, "tanh", 4) == 0) || (strncmp(str_cpy, "csch", 4) == 0) ||
-                   (strncmp(str_cpy, "sech", 4) == 0) || (strncmp(str_cpy, "coth", 4) == 0)) {
-            str_cpy += 4;
+        fn_name nm;
+        int len = nm_len(str_cpy, &nm);
 
-            while (par_enclosed(str_cpy)) {
-                str_cpy = rm_par(str_cpy);
-            }
+        if (len != 0) {
+            str_cpy += len;
 
-            if ((n_term(str_cpy) != 1) || (n_block(str_cpy) != 1)) {
-                return true;
-            } else if (has_func(str_cpy)) {
-                return true;
-            } else {
-                return false;
-            }
-        } else if ((strncmp(str_cpy, "sin", 3) == 0) || (strncmp(str_cpy, "cos", 3) == 0) ||
-                   (strncmp(str_cpy, "tan", 3) == 0) || (strncmp(str_cpy, "csc", 3) == 0) ||
-                   (strncmp(str_cpy, "sec", 3) == 0) || (strncmp(str_cpy, "cot", 3) == 0) ||
-                   (strncmp(str_cpy, "log", 3) == 0)) {
-            str_cpy += 3;
-
-            while (par_enclosed(str_cpy)) {
-                str_cpy = rm_par(str_cpy);
-            }
+            str_cpy = strip_par(str_cpy);
 
             if ((n_term(str_cpy) != 1) || (n_block(str_cpy) != 1)) {
                 return true;
-            } else if (has_func(str_cpy)) {
+            } else if (has_func(str_cpy)) {                // already confirmed 'x' exists
                 return true;
             } else {
                 return false;
             }
         }
     } else if (ch_tp == pt_par) {                          // ex) (x + sinh(x)) ^ 2
-        int ind = 1, len = strlen(str_cpy);
-        while (ind < len) {
-            if (par_paired(str_cpy, ind)) {
-                break;
-            } else {
-                ind++;
-            }
+        par_idx *idx = index_par(str_cpy);
+        int ind = 1, len = idx->len;
+        while ((ind < len) && (idx->depth[ind] != 0)) {
+            ind++;
         }
         ind--;                                             // str_cpy[ind] = ')'
 
-        char *bef_par = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-        char *aft_par = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-        strncpy(bef_par, str_cpy + 1, ind - 1);            // does not include the enclosing parentheses
-        strcpy(aft_par, str_cpy + ind + 2);                // before ^ including enclosing parentheses
+        char *bef_par = str_ndup(str_cpy + 1, ind - 1);    // does not include the enclosing parentheses
+        char *aft_par = str_dup(str_cpy + ind + 2);        // before ^ including enclosing parentheses
 
-        while (par_enclosed(bef_par)) {                    // x + sinh(x)
-            bef_par = rm_par(bef_par);
-        }
-        while (par_enclosed(aft_par)) {                    // 2
-            aft_par = rm_par(aft_par);
-        }
+        bef_par = strip_par(bef_par);                      // x + sinh(x)
+        aft_par = strip_par(aft_par);                      // 2
 
         if (strpbrk(bef_par, "x") != NULL) {               // x in the base
             if ((n_term(bef_par) != 1) || (n_block(bef_par) != 1)) {
@@ -253,9 +138,7 @@ bool is_composite(char *str) {
             return false;
         }
 
-        while (par_enclosed(pt)) {
-            pt = rm_par(pt);
-        }
+        pt = strip_par(pt);
 
         if (strpbrk(pt, "x") == NULL) {
             return false;
@@ -285,12 +168,15 @@ bool is_delimiter(char *str, int i) {
 
 /* Returns the number of blocks. */
 int n_block(char *str) {
-    int i = 0, block = 1, len = strlen(str);
-    while (i < len) {
-        if (is_boundary(str, i) && (id_bd_tp(str[i]) == im_bd)) {
+    lexer lx;
+    token tk;
+    int block = 1;
+
+    lex_init(&lx, str);
+    while (lex_next(&lx, &tk) && (tk.type != tk_end)) {    // the closing tk_end is not part of str
+        if ((tk.bd) && (tk.type != tk_opr)) {
             block++;
         }
-        i++;
     }
 
     return block;
@@ -298,18 +184,15 @@ int n_block(char *str) {
 
 /* Returns the number of terms. */
 int n_term(char *str) {
-    int i = 0, par = 0, term = 1, len = strlen(str);
-    while (i < len) {
-        if (str[i] == '(') {
-            par++;
-        } else if (str[i] == ')') {
-            par--;
-        }
+    lexer lx;
+    token tk;
+    int term = 1;
 
-        if ((par == 0) && (((str[i] == '+') || (str[i] == '-')) && is_delimiter(str, i))) {
+    lex_init(&lx, str);
+    while (lex_next(&lx, &tk)) {
+        if (tk.delim) {
             term++;
         }
-        i++;
     }
     
     return term;
@@ -321,31 +204,33 @@ block *into_block(char *str) {
     list *mult_head = bl->mult;
     list *divi_head = bl->divi;
 
+    tk_seq *seq = lex(str);
     bool divi = false, mult_1 = true, divi_1 = true;
-    int old_ind = 0, new_ind = 0, len = strlen(str);
+    int ind, old_ind = 0, new_ind;
 
-    while (new_ind <= len) {
-        if (is_boundary(str, new_ind)) {         // when boundary, copy strings and update indices
+    for (ind = 0; ind < seq->n; ind++) {
+        new_ind = seq->tk[ind].pos;
+        if (seq->tk[ind].bd) {                   // when boundary, copy strings and update indices
             if (id_bd_tp(str[new_ind - 1]) != ex_bd) {
                 if (divi) {
                     if (divi_1) {                // the first linked-list node does not need an initialization
-                        strncpy(bl->divi->entry, str + old_ind, new_ind - old_ind);
+                        bl->divi->entry = str_ndup(str + old_ind, new_ind - old_ind);
                         divi_1 = false;
                     } else {                     // the rest do
                         bl->divi->next = init_list();
                         bl->divi = bl->divi->next;
-                        strncpy(bl->divi->entry, str + old_ind, new_ind - old_ind);
+                        bl->divi->entry = str_ndup(str + old_ind, new_ind - old_ind);
                     }
 
                     divi = false;                // turn off the flag when one block has been saved
                 } else {
                     if (mult_1) {                // the first linked-list node does not need an initialization
-                        strncpy(bl->mult->entry, str + old_ind, new_ind - old_ind);
+                        bl->mult->entry = str_ndup(str + old_ind, new_ind - old_ind);
                         mult_1 = false;
                     } else {                     // the rest do
                         bl->mult->next = init_list();
                         bl->mult = bl->mult->next;
-                        strncpy(bl->mult->entry, str + old_ind, new_ind - old_ind);
+                        bl->mult->entry = str_ndup(str + old_ind, new_ind - old_ind);
                     }
                 }
             }
@@ -355,12 +240,10 @@ block *into_block(char *str) {
             }
 
             if (id_bd_tp(str[new_ind]) == ex_bd) {
-                old_ind = ++new_ind;
+                old_ind = new_ind + 1;
             } else {
-                old_ind = new_ind++;
+                old_ind = new_ind;
             }
-        } else {                                 // otherwise, move on
-            new_ind++;
         }
     }
 
@@ -372,61 +255,46 @@ block *into_block(char *str) {
 
 /* Returns a component which stores information of a composition of functions. */
 comp *into_comp(char *str) {
-    char *str_cpy = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-    strcpy(str_cpy, str);
+    char *str_cpy = str_dup(str);
 
     comp *cp = init_comp();
     list *elem_head = cp->elem;
     fn_type fn_tp;
 
     while (((n_term(str_cpy) == 1) && (n_block(str_cpy) == 1)) && (is_composite(str_cpy))) {
-        strcpy(cp->elem->entry, str_cpy);
+        cp->elem->entry = str_dup(str_cpy);
         cp->elem->next = init_list();
         cp->elem = cp->elem->next;
 
         fn_tp = id_fn_tp(str_cpy);
 
-        if (fn_tp == loga) {
+        if ((fn_tp == loga) || (fn_tp == trig) || (fn_tp == hypl)) {
             if (id_ch_tp(str_cpy[0]) == pt_sig) {                    // sign
                 str_cpy++;
             }
 
-            if (strncmp(str_cpy, "ln", 2) == 0) {
-                str_cpy += 2;
-            } else if (strncmp(str_cpy, "log", 3) == 0) {
-                str_cpy += 3;
+            fn_name nm;
+            int len = nm_len(str_cpy, &nm);
+            if (len == 0) {
+                break;
             }
+            str_cpy += len;
         } else if ((fn_tp == poly) || (fn_tp == powr)) {             // x appears before '^'
-            char *pt = strpbrk(str_cpy, "^");
-            while (!par_paired(str_cpy, pt - str_cpy)) {
-                pt = strpbrk(pt + 1, "^");
+            char *pt = top_pbrk(str_cpy, "^");
+            if (pt == NULL) {                                        // ex) -x
+                break;
             }
             *pt = 0;
         } else if (fn_tp == expo) {                                  // x appears after '^'
-            char *pt = strpbrk(str_cpy, "^");
-            while (!par_paired(str_cpy, pt - str_cpy)) {
-                pt = strpbrk(pt + 1, "^");
-            }
+            char *pt = top_pbrk(str_cpy, "^");
             str_cpy = pt + 1;
-        } else if (fn_tp == trig) {
-            if (id_ch_tp(str_cpy[0]) == pt_sig) {
-                str_cpy++;
-            }
-            str_cpy += 3;
-        } else if (fn_tp == hypl) {
-            if (id_ch_tp(str_cpy[0]) == pt_sig) {
-                str_cpy++;
-            }
-            str_cpy += 4;
         } else {
             break;
         }
 
-        while (par_enclosed(str_cpy)) {
-            str_cpy = rm_par(str_cpy);
-        }
+        str_cpy = strip_par(str_cpy);
     }
-    strcpy(cp->elem->entry, str_cpy);                      // inner most component
+    cp->elem->entry = str_dup(str_cpy);                    // inner most component
 
     cp->elem = elem_head;
 
@@ -435,36 +303,144 @@ comp *into_comp(char *str) {
 
 /* Returns a linked-list which stores all the terms. */
 term *into_term(char *str) {
-    bool par;
-    int new_ind = 0, old_ind = 0;
+    int ind, new_ind, old_ind = 0;
     term *tm = init_term();
     list *segm_head = tm->segm;
+    tk_seq *seq = lex(str);
 
-    char *sign;
-    while ((sign = strpbrk(str + new_ind, "+-")) != NULL) {
-        new_ind = sign - str;
-        par = par_paired(str, new_ind);
-
-        if ((par) && (is_delimiter(str, new_ind) == true)) {
-            strncpy(tm->segm->entry, str + old_ind, new_ind - old_ind);
+    for (ind = 0; ind < seq->n; ind++) {
+        if (seq->tk[ind].delim) {
+            new_ind = seq->tk[ind].pos;
+            tm->segm->entry = str_ndup(str + old_ind, new_ind - old_ind);
 
             tm->segm->next = init_list();
             tm->segm = tm->segm->next;
 
-            strncpy(tm->segm->entry, str + new_ind, 1);
+            tm->segm->entry = str_ndup(str + new_ind, 1);
 
             tm->segm->next = init_list();
             tm->segm = tm->segm->next;
 
-            new_ind++;
-            old_ind = new_ind;
-        } else {
-            new_ind++;
+            old_ind = new_ind + 1;
         }
     }
-    strcpy(tm->segm->entry, str + old_ind);
+    tm->segm->entry = str_dup(str + old_ind);
     
     tm->segm = segm_head;
 
     return tm;
 }
+
+/* Recursive descent over the tokens of into_node(); each returns NULL on malformed input. */
+static node *pr_sum(char *str, token **tk);
+static node *pr_signed(char *str, token **tk);
+
+static bool tk_is(char *str, token *tk, char ch) {
+    return (tk->type != tk_end) && (str[tk->pos] == ch);
+}
+
+/* Number, constant, x, parenthesised sum, or function with its argument. */
+static node *pr_atom(char *str, token **tk) {
+    gov_check();
+
+    token *cur = *tk;
+    if (cur->type == tk_end) {
+        return NULL;
+    }
+    (*tk)++;
+
+    if (cur->type == tk_num) {
+        node *nd = mk_num(str + cur->pos, cur->len);
+        char *end;
+        strtod(nd->num, &end);
+        return (*end == 0) ? nd : NULL;                    // ex) 2.3.4
+    } else if (cur->type == tk_var) {
+        return mk_var();
+    } else if (cur->type == tk_cst) {
+        return mk_cst(id_fn_nm(str + cur->pos, cur->len));
+    } else if (tk_is(str, cur, '(')) {
+        node *nd = pr_sum(str, tk);
+        if ((nd == NULL) || !tk_is(str, *tk, ')')) {
+            return NULL;
+        }
+        (*tk)++;
+        return nd;
+    } else if (cur->type == tk_fnc) {
+        node *arg = pr_signed(str, tk);                    // ex) sinx^2 = (sin(x))^2
+        return (arg == NULL) ? NULL : mk_fn(id_fn_nm(str + cur->pos, cur->len), arg);
+    } else {
+        return NULL;
+    }
+}
+
+/* Atom with an optional sign, as the argument of a function or an exponent. */
+static node *pr_signed(char *str, token **tk) {
+    if ((*tk)->type == tk_sig) {
+        bool neg = tk_is(str, (*tk)++, '-');
+        node *nd = pr_atom(str, tk);
+        return ((nd == NULL) || !neg) ? nd : mk_op(nd_neg, nd, NULL);
+    }
+    return pr_atom(str, tk);
+}
+
+/* Signs, then an atom raised to as many exponents as follow it. */
+static node *pr_fact(char *str, token **tk) {
+    if ((*tk)->type == tk_sig) {
+        bool neg = tk_is(str, (*tk)++, '-');
+        node *nd = pr_fact(str, tk);
+        return ((nd == NULL) || !neg) ? nd : mk_op(nd_neg, nd, NULL);
+    }
+
+    node *nd = pr_atom(str, tk);
+    while ((nd != NULL) && ((*tk)->type == tk_pow)) {
+        (*tk)++;
+        node *ex = pr_signed(str, tk);                     // ex) x^-2
+        nd = (ex == NULL) ? NULL : mk_op(nd_pow, nd, ex);
+    }
+    return nd;
+}
+
+/* Factors joined by explicit or implicit boundaries, left to right. */
+static node *pr_prod(char *str, token **tk) {
+    node *nd = pr_fact(str, tk);
+
+    while (nd != NULL) {
+        token *cur = *tk;
+        nd_type type = nd_mul;
+
+        if (cur->type == tk_opr) {                         // explicit boundary
+            type = (str[cur->pos] == '/') ? nd_div : nd_mul;
+            (*tk)++;
+        } else if ((cur->type != tk_num) && (cur->type != tk_var) && (cur->type != tk_cst) &&
+                   (cur->type != tk_fnc) && !tk_is(str, cur, '(')) {
+            break;
+        }
+
+        node *rhs = pr_fact(str, tk);
+        nd = (rhs == NULL) ? NULL : mk_op(type, nd, rhs);
+    }
+    return nd;
+}
+
+/* Terms joined by delimiters. */
+static node *pr_sum(char *str, token **tk) {
+    node *nd = pr_prod(str, tk);
+
+    while ((nd != NULL) && ((*tk)->type == tk_sig)) {
+        nd_type type = tk_is(str, (*tk)++, '+') ? nd_add : nd_sub;
+        node *rhs = pr_prod(str, tk);
+        nd = (rhs == NULL) ? NULL : mk_op(type, nd, rhs);
+    }
+    return nd;
+}
+
+/* Parses str once into an expression tree; NULL if it is not a valid function of x. */
+node *into_node(char *str) {
+    token *tk = lex(str)->tk;
+
+    node *nd = pr_sum(str, &tk);
+    if ((nd == NULL) || (tk->type != tk_end)) {
+        return NULL;
+    }
+    return nd;
+}
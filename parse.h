@@ -37,6 +37,7 @@ int n_block(char *str);
 int n_term(char *str);
 block *into_block(char *str);
 comp *into_comp(char *str);
+node *into_node(char *str);
 term *into_term(char *str);
 
 #endif
@@ -0,0 +1,181 @@
+/*
+ * pool.c
+ * Work-stealing thread pool
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "mem.h"
+#include "pool.h"
+#include "struct.h"
+
+/*
+ * Every thread starts with an even share of the items as a range of indices. The owner takes
+ * items from the front of its range; a thread that runs dry steals the back half of another
+ * thread's range, so a slow item only holds up the thread working on it.
+ */
+typedef struct pl_que {
+    pthread_mutex_t lock;
+    int lo;                                                // next item the owner takes
+    int hi;                                                // end of the range, where thieves take
+} pl_que;
+
+typedef struct pl_ctx {
+    pl_que *que;
+    int n_thr;
+    pool_fn work;
+    void *arg;
+    pthread_mutex_t lock;                                  // guards done and next
+    pthread_cond_t cond;
+    char *done;                                            // items whose work has finished
+    int next;                                              // item the emitting thread waits for
+} pl_ctx;
+
+typedef struct pl_thr {
+    pl_ctx *ctx;
+    int id;
+} pl_thr;
+
+/* Takes the next item of thread id, stealing from the others when its range is empty. */
+static bool pl_take(pl_ctx *ctx, int id, int *ind) {
+    pl_que *own = ctx->que + id;
+
+    pthread_mutex_lock(&own->lock);
+    if (own->lo < own->hi) {
+        *ind = own->lo++;
+        pthread_mutex_unlock(&own->lock);
+        return true;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    int k;
+    for (k = 1; k < ctx->n_thr; k++) {
+        pl_que *vic = ctx->que + (id + k) % ctx->n_thr;
+
+        pthread_mutex_lock(&vic->lock);
+        int left = vic->hi - vic->lo;
+        if (left <= 0) {
+            pthread_mutex_unlock(&vic->lock);
+            continue;
+        }
+        int hi = vic->hi, lo = hi - (left + 1) / 2;
+        vic->hi = lo;
+        pthread_mutex_unlock(&vic->lock);
+
+        pthread_mutex_lock(&own->lock);
+        own->lo = lo + 1;
+        own->hi = hi;
+        pthread_mutex_unlock(&own->lock);
+
+        *ind = lo;
+        return true;
+    }
+
+    return false;                                          // no item is left anywhere
+}
+
+static void *pl_main(void *arg) {
+    pl_thr *thr = (pl_thr *) arg;
+    pl_ctx *ctx = thr->ctx;
+    int ind;
+
+    while (pl_take(ctx, thr->id, &ind)) {
+        ctx->work(ind, ctx->arg);
+
+        pthread_mutex_lock(&ctx->lock);
+        ctx->done[ind] = 1;
+        if (ind == ctx->next) {
+            pthread_cond_signal(&ctx->cond);
+        }
+        pthread_mutex_unlock(&ctx->lock);
+    }
+
+    mem_release();                                         // the arena of this thread
+    return NULL;
+}
+
+/*
+ * Runs work on items 0 to n_item - 1 using n_thr threads, while the calling thread hands each
+ * finished item to emit in index order, or only waits for them all when emit is NULL.
+ */
+void pool_run(int n_item, int n_thr, pool_fn work, pool_fn emit, void *arg) {
+    pl_ctx ctx;
+    ctx.n_thr = (n_thr < 1) ? 1 : n_thr;
+    ctx.work = work;
+    ctx.arg = arg;
+    ctx.next = 0;
+    ctx.que = (pl_que *) malloc(sizeof(pl_que) * ctx.n_thr);
+    ctx.done = (char *) calloc((n_item > 0) ? n_item : 1, sizeof(char));
+    pthread_t *tid = (pthread_t *) malloc(sizeof(pthread_t) * ctx.n_thr);
+    pl_thr *thr = (pl_thr *) malloc(sizeof(pl_thr) * ctx.n_thr);
+    if ((ctx.que == NULL) || (ctx.done == NULL) || (tid == NULL) || (thr == NULL)) {
+        perror("pool_run");
+        exit(1);
+    }
+    pthread_mutex_init(&ctx.lock, NULL);
+    pthread_cond_init(&ctx.cond, NULL);
+
+    int ind;
+    for (ind = 0; ind < ctx.n_thr; ind++) {
+        pthread_mutex_init(&ctx.que[ind].lock, NULL);
+        ctx.que[ind].lo = (int) ((long) n_item * ind / ctx.n_thr);
+        ctx.que[ind].hi = (int) ((long) n_item * (ind + 1) / ctx.n_thr);
+    }
+
+    for (ind = 0; ind < ctx.n_thr; ind++) {
+        thr[ind].ctx = &ctx;
+        thr[ind].id = ind;
+        if (pthread_create(tid + ind, NULL, pl_main, thr + ind) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    for (ind = 0; (emit != NULL) && (ind < n_item); ind++) {
+        pthread_mutex_lock(&ctx.lock);
+        ctx.next = ind;
+        while (!ctx.done[ind]) {
+            pthread_cond_wait(&ctx.cond, &ctx.lock);
+        }
+        pthread_mutex_unlock(&ctx.lock);
+
+        emit(ind, arg);
+    }
+
+    for (ind = 0; ind < ctx.n_thr; ind++) {
+        pthread_join(tid[ind], NULL);
+    }
+    for (ind = 0; ind < ctx.n_thr; ind++) {                // any thread may lock any range until it ends
+        pthread_mutex_destroy(&ctx.que[ind].lock);
+    }
+    pthread_cond_destroy(&ctx.cond);
+    pthread_mutex_destroy(&ctx.lock);
+
+    free(thr);
+    free(tid);
+    free(ctx.done);
+    free(ctx.que);
+}
@@ -0,0 +1,388 @@
+/*
+ * proc.c
+ * Prefork worker process pool
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "derivative.h"
+#include "diff.h"
+#include "mem.h"
+#include "proc.h"
+#include "struct.h"
+
+/*
+ * Each worker is a child process that derives one expression at a time. The parent sends the
+ * length and the bytes of the expression over a socket pair and reads back a pr_rsp followed by
+ * the derivative. A worker that dies mid-request is reaped, reported to the caller as an error and
+ * replaced right away, so an input that crashes the engine costs one fork() instead of all of them.
+ *
+ * The workers are not forked by the parent, which may be running threads by then, and a child of
+ * a threaded process can deadlock on a lock (of malloc, of stdio) another thread held at fork().
+ * proc_new() first forks a spawner while the caller is still single-threaded; the spawner forks
+ * every worker, replacements included, reaps the dead ones and hands the parent its end of each
+ * worker's socket pair (SCM_RIGHTS) over a control socket.
+ */
+typedef struct pr_rsp {
+    int64_t code;                                          // length of the derivative, or DERIV_E*
+    int64_t hit;                                           // diff_stats() of the worker
+    int64_t miss;
+    uint64_t used;                                         // mem_used() of the worker
+} pr_rsp;
+
+typedef struct pr_wk {
+    pid_t pid;
+    int fd;                                                // parent's end of the socket pair
+    bool busy;
+} pr_wk;
+
+typedef struct pr_ctl {
+    pid_t reap;                                            // worker to reap first, or 0
+    int status;                                            // its wait status, in the answer
+    pid_t pid;                                             // the new worker, in the answer
+} pr_ctl;
+
+struct proc_pool {
+    pr_wk *wk;
+    int n_wk;
+    int flags;
+    pid_t sp_pid;                                          // the spawner
+    int sp_fd;                                             // control socket to the spawner
+    pthread_mutex_t mtx;
+    pthread_cond_t idle;
+};
+
+static _Thread_local pr_rsp pr_last;                       // stats of this thread's last request
+
+/* Reads exactly len bytes; false at end of file or on error. */
+static bool pr_read(int fd, void *buf, size_t len) {
+    char *pt = (char *) buf;
+    while (len > 0) {
+        ssize_t got = read(fd, pt, len);
+        if ((got < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        pt += got;
+        len -= got;
+    }
+    return true;
+}
+
+/* Writes exactly len bytes; false if the other end has gone. */
+static bool pr_write(int fd, const void *buf, size_t len) {
+    const char *pt = (const char *) buf;
+    while (len > 0) {
+        ssize_t put = send(fd, pt, len, MSG_NOSIGNAL);
+        if ((put < 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (put <= 0) {
+            return false;
+        }
+        pt += put;
+        len -= put;
+    }
+    return true;
+}
+
+/* Ctrl-C reaches the workers too, where it cancels the request instead of killing them. */
+static void pr_sig(int sig) {
+    (void) sig;
+    deriv_cancel(NULL);
+}
+
+/* Body of a worker process: answers requests on fd until the parent closes it. */
+static void pr_loop(int fd, int flags) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = pr_sig;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &sa, NULL);
+
+    uint64_t len;
+    while (pr_read(fd, &len, sizeof(len))) {
+        char *str = (char *) mem_alloc(len + 1);
+        if (!pr_read(fd, str, len)) {
+            break;
+        }
+        str[len] = 0;
+
+        int code;
+        long hit, miss;
+        char *derv = deriv_str(str, flags, &code);
+        diff_stats(&hit, &miss);
+
+        pr_rsp rsp = {(derv == NULL) ? code : (int64_t) strlen(derv), hit, miss, mem_used()};
+        if (!pr_write(fd, &rsp, sizeof(rsp)) || ((derv != NULL) && !pr_write(fd, derv, rsp.code))) {
+            break;
+        }
+        mem_reset();
+    }
+    _exit(0);                                              // nothing of the parent's to flush
+}
+
+/* Sends ctl over fd, with the descriptor pass unless it is -1. */
+static bool pr_send_ctl(int fd, pr_ctl *ctl, int pass) {
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {ctl, sizeof(pr_ctl)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (pass >= 0) {
+        memset(cbuf, 0, sizeof(cbuf));
+        msg.msg_control = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &pass, sizeof(int));
+    }
+
+    ssize_t put;
+    while (((put = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0) && (errno == EINTR));
+    return put == (ssize_t) sizeof(pr_ctl);
+}
+
+/* Receives a pr_ctl from fd, and the descriptor that came with it into pass (-1 if none). */
+static bool pr_recv_ctl(int fd, pr_ctl *ctl, int *pass) {
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec iov = {ctl, sizeof(pr_ctl)};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    ssize_t got;
+    while (((got = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0) && (errno == EINTR));
+    *pass = -1;
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if ((got > 0) && (cm != NULL) && (cm->cmsg_type == SCM_RIGHTS)) {
+        memcpy(pass, CMSG_DATA(cm), sizeof(int));
+    }
+    return got == (ssize_t) sizeof(pr_ctl);
+}
+
+/* Body of the spawner: forks a worker per request on fd, after reaping the one named in it. */
+static void pr_spawner(int fd, int flags) {
+    signal(SIGINT, SIG_IGN);                               // Ctrl-C is for the workers' requests
+
+    pr_ctl ctl;
+    int none;
+    while (pr_recv_ctl(fd, &ctl, &none)) {
+        ctl.status = 0;
+        if (ctl.reap > 0) {
+            while ((waitpid(ctl.reap, &ctl.status, 0) < 0) && (errno == EINTR));
+        }
+
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+            perror("socketpair");
+            _exit(1);
+        }
+        ctl.pid = fork();
+        if (ctl.pid < 0) {
+            perror("fork error");
+            _exit(1);
+        }
+        if (ctl.pid == 0) { // child
+            close(fd);
+            close(sv[0]);
+            pr_loop(sv[1], flags);
+        }
+
+        close(sv[1]);
+        bool sent = pr_send_ctl(fd, &ctl, sv[0]);
+        close(sv[0]);                                      // or the worker never sees EOF
+        if (!sent) {
+            break;
+        }
+    }
+
+    close(fd);
+    while ((wait(NULL) > 0) || (errno == EINTR));          // the workers exit once the parent is gone
+    _exit(0);
+}
+
+/* Starts worker ind in place of the one that ran there, if any; called with the pool locked. */
+static int pr_spawn(proc_pool *pp, int ind, pid_t reap) {
+    pr_ctl ctl = {reap, 0, 0};
+    int fd;
+    if (!pr_send_ctl(pp->sp_fd, &ctl, -1) || !pr_recv_ctl(pp->sp_fd, &ctl, &fd) || (fd < 0)) {
+        fprintf(stderr, "proc: the spawner has quit\n");
+        exit(1);
+    }
+
+    pp->wk[ind].pid = ctl.pid;
+    pp->wk[ind].fd = fd;
+    return ctl.status;
+}
+
+/* Reaps a dead worker and starts another, with the pool locked; returns the reason for the error. */
+static char *pr_reap(proc_pool *pp, int ind) {
+    pr_wk *wk = pp->wk + ind;
+    close(wk->fd);
+    wk->fd = -1;
+    int status = pr_spawn(pp, ind, wk->pid);
+
+    char buf[64];
+    if (WIFSIGNALED(status)) {
+        snprintf(buf, sizeof(buf), "terminated by signal %d", WTERMSIG(status));
+    } else {
+        snprintf(buf, sizeof(buf), "worker exited with status %d", WEXITSTATUS(status));
+    }
+    char *msg = (char *) mem_alloc(strlen(buf) + 1);
+    strcpy(msg, buf);
+
+    return msg;
+}
+
+/*
+ * Creates a pool of n_proc worker processes deriving with flags (DERIV_STRING). Must be called
+ * before the process starts any thread, as it forks the spawner of the workers.
+ */
+proc_pool *proc_new(int n_proc, int flags) {
+    proc_pool *pp = (proc_pool *) malloc(sizeof(proc_pool));
+    if (pp != NULL) {
+        pp->n_wk = (n_proc < 1) ? 1 : n_proc;
+        pp->wk = (pr_wk *) malloc(sizeof(pr_wk) * pp->n_wk);
+    }
+    if ((pp == NULL) || (pp->wk == NULL)) {
+        perror("proc_new");
+        exit(1);
+    }
+    pp->flags = flags;
+    pthread_mutex_init(&pp->mtx, NULL);
+    pthread_cond_init(&pp->idle, NULL);
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        perror("socketpair");
+        exit(1);
+    }
+    fflush(NULL);                                          // or the spawner's exit could write it again
+    pp->sp_pid = fork();
+    if (pp->sp_pid < 0) {
+        perror("fork error");
+        exit(1);
+    }
+    if (pp->sp_pid == 0) { // child
+        close(sv[0]);
+        pr_spawner(sv[1], flags);
+    }
+    close(sv[1]);
+    pp->sp_fd = sv[0];
+
+    int ind;
+    for (ind = 0; ind < pp->n_wk; ind++) {
+        pp->wk[ind].busy = false;
+        pr_spawn(pp, ind, 0);
+    }
+
+    return pp;
+}
+
+/*
+ * Derives the len characters of str in an idle worker; returns the derivative, or NULL with the
+ * reason in err. Both live in the calling thread's arena. Safe to call from several threads.
+ */
+char *proc_derive(proc_pool *pp, char *str, size_t len, char **err) {
+    pthread_mutex_lock(&pp->mtx);
+    int ind = 0;
+    while (pp->wk[ind].busy) {
+        if (++ind == pp->n_wk) {
+            pthread_cond_wait(&pp->idle, &pp->mtx);
+            ind = 0;
+        }
+    }
+    pr_wk *wk = pp->wk + ind;
+    wk->busy = true;
+    pthread_mutex_unlock(&pp->mtx);
+
+    char *derv = NULL;
+    uint64_t n = len;
+    pr_rsp rsp = {0, 0, 0, 0};
+    pr_last = rsp;
+
+    if (pr_write(wk->fd, &n, sizeof(n)) && pr_write(wk->fd, str, len) && pr_read(wk->fd, &rsp, sizeof(rsp))) {
+        pr_last = rsp;
+        if (rsp.code < 0) {
+            *err = (char *) deriv_strerror(rsp.code);
+        } else {
+            derv = (char *) mem_alloc(rsp.code + 1);
+            if (pr_read(wk->fd, derv, rsp.code)) {
+                derv[rsp.code] = 0;
+            } else {
+                derv = NULL;
+            }
+        }
+    }
+
+    pthread_mutex_lock(&pp->mtx);
+    if ((derv == NULL) && (rsp.code >= 0)) {               // no answer, or a cut one
+        *err = pr_reap(pp, ind);
+    }
+    wk->busy = false;
+    pthread_cond_signal(&pp->idle);
+    pthread_mutex_unlock(&pp->mtx);
+
+    return derv;
+}
+
+/* Stops the workers and frees the pool. */
+void proc_free(proc_pool *pp) {
+    int ind;
+    for (ind = 0; ind < pp->n_wk; ind++) {
+        close(pp->wk[ind].fd);                             // the worker exits at end of file
+    }
+    close(pp->sp_fd);                                      // and the spawner, once it has reaped them
+    while ((waitpid(pp->sp_pid, NULL, 0) < 0) && (errno == EINTR));
+
+    pthread_mutex_destroy(&pp->mtx);
+    pthread_cond_destroy(&pp->idle);
+    free(pp->wk);
+    free(pp);
+}
+
+/* Stats reported by the worker for this thread's last proc_derive(), as diff_stats() and mem_used(). */
+void proc_stats(long *hit, long *miss, size_t *used) {
+    *hit = pr_last.hit;
+    *miss = pr_last.miss;
+    *used = pr_last.used;
+}
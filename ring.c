@@ -0,0 +1,368 @@
+/*
+ * ring.c
+ * Shared-memory ring transport
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "derivative.h"
+#include "mem.h"
+#include "ring.h"
+#include "struct.h"
+#include "utility.h"
+
+#define RING_MAGIC 0x31475244u                             // "DRG1"
+#define RING_SLOTS 64
+#define RING_DATA 4064                                     // request and response bytes of a slot
+
+/*
+ * The server and its clients share a ring of slots in a POSIX shared memory object. A client
+ * takes ticket t from head, only once slot t % n_slot is free for it, and a server thread takes
+ * the same ticket from tail. The slot's seq word tells whose turn it is, as 4 * t plus a state,
+ * and is also the futex both sides sleep on: the client writes the request and sets RG_REQ, the
+ * server overwrites the request with the derivative and sets RG_DONE, and the client reads it and
+ * frees the slot for ticket t + n_slot. No system call is made while the other side is already
+ * waiting or running.
+ *
+ * The client holding a slot leaves its pid there. Whoever waits on a slot whose client died
+ * frees it in the client's place: the server thread when no request came, the next client when
+ * the answer was never collected.
+ */
+enum {RG_FREE, RG_REQ, RG_DONE};
+enum {rg_ok, rg_shut, rg_lost};                            // results of rg_wait()
+
+typedef struct rg_head {
+    uint32_t magic;
+    uint32_t n_slot;
+    uint32_t head;                                         // next ticket of the clients
+    uint32_t tail;                                         // next ticket of the server threads
+    uint32_t stop;                                         // the server has quit
+    char pad[44];
+} rg_head;
+
+typedef struct rg_slot {
+    uint32_t seq;
+    uint32_t wait;                                         // threads sleeping on seq
+    uint32_t len;                                          // bytes of the request
+    int32_t pid;                                           // client holding the slot, or 0
+    int64_t rc;                                            // length of the derivative, or DERIV_E*
+    char data[RING_DATA];
+} rg_slot;
+
+struct deriv_ring {
+    rg_head *hd;
+    rg_slot *slot;
+    size_t size;
+};
+
+static volatile sig_atomic_t rg_quit = 0;
+
+static void rg_sig(int sig) {
+    (void) sig;
+    rg_quit = 1;
+}
+
+/* Sleeps while the slot's seq is still seq, for at most 100 ms. */
+static void rg_sleep(rg_slot *slot, uint32_t seq) {
+    int spin;
+    for (spin = 0; spin < 256; spin++) {
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != seq) {
+            return;
+        }
+    }
+
+    struct timespec ts = {0, 100 * 1000 * 1000};           // a quitting server or a dead client wakes nobody
+    __atomic_add_fetch(&slot->wait, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &slot->seq, FUTEX_WAIT, seq, &ts, NULL, 0);
+    __atomic_sub_fetch(&slot->wait, 1, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Whether the client of the slot, at seq, died without passing it on; sets pid to the one it
+ * held. A client killed between taking its ticket and leaving its pid is taken for dead once the
+ * slot has stayed that way for a second (idle counts the checks).
+ */
+static bool rg_gone(rg_head *hd, rg_slot *slot, uint32_t seq, int32_t *pid, int *idle) {
+    *pid = __atomic_load_n(&slot->pid, __ATOMIC_ACQUIRE);
+    if (*pid > 0) {
+        *idle = 0;
+        return (kill(*pid, 0) < 0) && (errno == ESRCH);
+    }
+
+    uint32_t head = __atomic_load_n(&hd->head, __ATOMIC_ACQUIRE);
+    bool taken = ((int32_t) (4 * head - (seq - seq % 4)) > 0);
+    *idle = taken ? *idle + 1 : 0;
+    return *idle > 10;
+}
+
+/* Frees the slot of a dead client, at seq, for the ticket n_slot later; one waiter does it. */
+static void rg_reclaim(rg_head *hd, rg_slot *slot, uint32_t seq, int32_t pid) {
+    uint32_t next = seq - seq % 4 + 4 * hd->n_slot + RG_FREE;
+    if (__atomic_compare_exchange_n(&slot->seq, &seq, next, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+        __atomic_compare_exchange_n(&slot->pid, &pid, 0, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+        syscall(SYS_futex, &slot->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+/*
+ * Waits until the slot's seq is want. Returns rg_shut if the server quits first, and rg_lost,
+ * with the dead client's pid, if seq stays at lost after its client died.
+ */
+static int rg_wait(rg_head *hd, rg_slot *slot, uint32_t want, uint32_t lost, int32_t *pid) {
+    uint32_t seq;
+    int idle = 0;
+    while ((seq = __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST)) != want) {
+        if (__atomic_load_n(&hd->stop, __ATOMIC_ACQUIRE)) {
+            return rg_shut;
+        }
+        if ((seq == lost) && rg_gone(hd, slot, seq, pid, &idle)) {
+            return rg_lost;
+        }
+        rg_sleep(slot, seq);
+    }
+    return rg_ok;
+}
+
+/* Passes the slot on by setting its seq, waking whoever sleeps on it. */
+static void rg_set(rg_slot *slot, uint32_t seq) {
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&slot->wait, __ATOMIC_SEQ_CST) > 0) {
+        syscall(SYS_futex, &slot->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+}
+
+typedef struct rg_srv {
+    deriv_ring *ring;
+    int flags;
+} rg_srv;
+
+static void *rg_work(void *arg) {
+    rg_srv *srv = (rg_srv *) arg;
+    rg_head *hd = srv->ring->hd;
+
+    while (!__atomic_load_n(&hd->stop, __ATOMIC_ACQUIRE)) {
+        uint32_t t = __atomic_fetch_add(&hd->tail, 1, __ATOMIC_RELAXED);
+        rg_slot *slot = srv->ring->slot + (t % hd->n_slot);
+        int32_t pid;
+        int st = rg_wait(hd, slot, 4 * t + RG_REQ, 4 * t + RG_FREE, &pid);
+        if (st == rg_shut) {
+            break;
+        } else if (st == rg_lost) {                        // no request will come
+            rg_reclaim(hd, slot, 4 * t + RG_FREE, pid);
+            continue;
+        }
+
+        int err;
+        size_t len = (slot->len < RING_DATA) ? slot->len : RING_DATA;
+        char *derv = deriv_str(wo_nspace(slot->data, len), srv->flags, &err);
+        if (derv == NULL) {
+            slot->rc = err;
+        } else if (strlen(derv) >= RING_DATA) {            // never handed back cut short
+            slot->rc = DERIV_ESPACE;
+        } else {
+            size_t n = strlen(derv);
+            slot->rc = (int64_t) n;
+            memcpy(slot->data, derv, n + 1);
+        }
+        mem_reset();
+
+        rg_set(slot, 4 * t + RG_DONE);
+    }
+
+    mem_release();
+    return NULL;
+}
+
+/* Serves the ring in the shared memory object name with n_thr threads until SIGINT or SIGTERM. */
+int ring_serve(char *name, int n_thr, int flags) {
+    deriv_ring ring;
+    ring.size = sizeof(rg_head) + sizeof(rg_slot) * RING_SLOTS;
+
+    shm_unlink(name);                                      // clients of a previous server start over
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if ((fd < 0) || (ftruncate(fd, ring.size) < 0)) {
+        perror(name);
+        return 1;
+    }
+    void *pt = mmap(NULL, ring.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pt == MAP_FAILED) {
+        perror(name);
+        shm_unlink(name);
+        return 1;
+    }
+    ring.hd = (rg_head *) pt;
+    ring.slot = (rg_slot *) (ring.hd + 1);
+
+    uint32_t ind;
+    for (ind = 0; ind < RING_SLOTS; ind++) {
+        ring.slot[ind].seq = 4 * ind + RG_FREE;
+    }
+    ring.hd->n_slot = RING_SLOTS;
+    __atomic_store_n(&ring.hd->magic, RING_MAGIC, __ATOMIC_RELEASE);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = rg_sig;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    rg_srv srv = {&ring, flags};
+    n_thr = (n_thr < 1) ? 1 : n_thr;
+    pthread_t *tid = (pthread_t *) malloc(sizeof(pthread_t) * n_thr);
+    if (tid == NULL) {
+        perror("ring_serve");
+        exit(1);
+    }
+    int thr;
+    for (thr = 0; thr < n_thr; thr++) {
+        if (pthread_create(tid + thr, NULL, rg_work, &srv) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    while (!rg_quit) {
+        pause();
+    }
+
+    __atomic_store_n(&ring.hd->stop, 1, __ATOMIC_RELEASE);
+    for (ind = 0; ind < RING_SLOTS; ind++) {
+        syscall(SYS_futex, &ring.slot[ind].seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+    for (thr = 0; thr < n_thr; thr++) {
+        pthread_join(tid[thr], NULL);
+    }
+
+    free(tid);
+    munmap(pt, ring.size);
+    shm_unlink(name);
+    return 0;
+}
+
+/*
+ * Differentiates input through the ring server, like deriv_differentiate(). Requests longer than
+ * a slot, and derivatives too long for one, get DERIV_ESPACE; DERIV_ESHUT means the server has
+ * quit.
+ */
+long deriv_ring_call(deriv_ring *ring, const char *input, size_t len, char *out, size_t cap) {
+    rg_head *hd = ring->hd;
+    if (len > RING_DATA) {
+        return DERIV_ESPACE;
+    }
+
+    uint32_t t;
+    rg_slot *slot;
+    int idle = 0;
+    while (true) {                                         // a ticket is only taken with its slot free
+        t = __atomic_load_n(&hd->head, __ATOMIC_ACQUIRE);
+        slot = ring->slot + (t % hd->n_slot);
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST);
+        int32_t pid;
+
+        if (seq == 4 * t + RG_FREE) {
+            if (__atomic_compare_exchange_n(&hd->head, &t, t + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+                break;
+            }
+        } else if (__atomic_load_n(&hd->stop, __ATOMIC_ACQUIRE)) {
+            return DERIV_ESHUT;
+        } else if ((seq == 4 * (t - hd->n_slot) + RG_DONE) && rg_gone(hd, slot, seq, &pid, &idle)) {
+            rg_reclaim(hd, slot, seq, pid);                // its answer will never be collected
+        } else {
+            rg_sleep(slot, seq);
+        }
+    }
+    __atomic_store_n(&slot->pid, (int32_t) getpid(), __ATOMIC_SEQ_CST);
+    memcpy(slot->data, input, len);
+    slot->len = len;
+    rg_set(slot, 4 * t + RG_REQ);
+
+    int32_t pid;
+    if (rg_wait(hd, slot, 4 * t + RG_DONE, 4 * t + RG_DONE, &pid) != rg_ok) {
+        return DERIV_ESHUT;
+    }
+    long rc = (long) slot->rc;
+    if ((rc >= 0) && (cap > 0)) {
+        size_t n = ((size_t) rc < cap) ? (size_t) rc : cap - 1;
+        memcpy(out, slot->data, n);
+        out[n] = 0;
+    }
+    __atomic_store_n(&slot->pid, 0, __ATOMIC_SEQ_CST);
+    rg_set(slot, 4 * (t + hd->n_slot) + RG_FREE);
+
+    return rc;
+}
+
+/* Unmaps a ring opened with deriv_ring_open(). */
+void deriv_ring_close(deriv_ring *ring) {
+    if (ring != NULL) {
+        munmap(ring->hd, ring->size);
+        free(ring);
+    }
+}
+
+/* Maps the ring a server made with -r name; returns NULL if there is none. */
+deriv_ring *deriv_ring_open(const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    deriv_ring *ring = (deriv_ring *) malloc(sizeof(deriv_ring));
+    void *pt = MAP_FAILED;
+    if ((ring != NULL) && (fstat(fd, &st) == 0) && ((size_t) st.st_size >= sizeof(rg_head))) {
+        pt = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (pt == MAP_FAILED) {
+        free(ring);
+        return NULL;
+    }
+    ring->hd = (rg_head *) pt;
+    ring->slot = (rg_slot *) (ring->hd + 1);
+    ring->size = st.st_size;
+
+    if ((__atomic_load_n(&ring->hd->magic, __ATOMIC_ACQUIRE) != RING_MAGIC) ||
+        (ring->size < sizeof(rg_head) + sizeof(rg_slot) * ring->hd->n_slot)) {
+        deriv_ring_close(ring);
+        return NULL;
+    }
+    return ring;
+}
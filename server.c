@@ -0,0 +1,465 @@
+/*
+ * server.c
+ * Unix socket server
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE                                        // accept4()
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "json.h"
+#include "mem.h"
+#include "server.h"
+#include "struct.h"
+
+/*
+ * The server speaks the JSON lines of the machine mode on a Unix socket. One thread multiplexes
+ * every connection with epoll: it splits the input into request lines, queues them for a fixed
+ * pool of workers and writes back the responses the workers hand over through an eventfd.
+ * Responses of a connection come back as they finish, so clients match them by "id". A
+ * connection is not read while it has responses waiting to be sent, or SV_BUSY_MAX requests
+ * with the workers, so a client that does not read them or pipelines without end stops being
+ * served rather than growing the server; one that sends a line longer than SV_IN_MAX, or lets
+ * SV_OUT_MAX bytes of responses pile up, is closed.
+ */
+#define SV_IN_MAX (1 << 20)                                // longest request line
+#define SV_OUT_MAX (16 << 20)                              // responses a connection may leave unread
+#define SV_BUSY_MAX 64                                     // requests of a connection queued at once
+
+typedef struct sv_conn {
+    int fd;                                                // -1 once closed
+    char *in;                                              // input not yet split into requests
+    size_t in_len;
+    size_t in_cap;
+    char *out;                                             // responses not yet sent
+    size_t out_at;
+    size_t out_len;
+    size_t out_cap;
+    int busy;                                              // requests handed to the workers
+    bool eof;                                              // the client will send nothing else
+    unsigned int ev;                                       // events epoll watches for
+    struct sv_conn *dead;                                  // next closed connection to free
+} sv_conn;
+
+typedef struct sv_job {
+    struct sv_job *next;
+    sv_conn *conn;
+    char *line;
+    size_t len;
+    char *rsp;
+} sv_job;
+
+typedef struct sv_que {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    sv_job *head;
+    sv_job *tail;
+} sv_que;
+
+static sv_que sv_todo = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL};
+static sv_que sv_done = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL};
+static sv_conn *sv_dead = NULL;                            // closed, freed after the current epoll batch
+static int sv_efd = -1;                                    // tells the epoll loop responses are ready
+static int sv_flags = 0;
+static bool sv_end = false;                                // workers stop once the queue is empty
+static volatile sig_atomic_t sv_stop = 0;                  // set by SIGINT and SIGTERM
+
+static void sv_sig(int sig) {
+    (void) sig;
+    sv_stop = 1;
+}
+
+static void *sv_alloc(void *ptr, size_t size) {
+    if ((ptr = realloc(ptr, size)) == NULL) {
+        perror("serve");
+        exit(1);
+    }
+    return ptr;
+}
+
+static void sv_push(sv_que *que, sv_job *job) {
+    job->next = NULL;
+
+    pthread_mutex_lock(&que->lock);
+    if (que->tail != NULL) {
+        que->tail->next = job;
+    } else {
+        que->head = job;
+    }
+    que->tail = job;
+    pthread_cond_signal(&que->cond);
+    pthread_mutex_unlock(&que->lock);
+}
+
+static void *sv_work(void *arg) {
+    (void) arg;
+
+    while (true) {
+        pthread_mutex_lock(&sv_todo.lock);
+        while ((sv_todo.head == NULL) && !sv_end) {
+            pthread_cond_wait(&sv_todo.cond, &sv_todo.lock);
+        }
+        sv_job *job = sv_todo.head;
+        if (job == NULL) {
+            pthread_mutex_unlock(&sv_todo.lock);
+            break;
+        }
+        if ((sv_todo.head = job->next) == NULL) {
+            sv_todo.tail = NULL;
+        }
+        pthread_mutex_unlock(&sv_todo.lock);
+
+        job->rsp = js_rsp(job->line, job->len, sv_flags);
+        mem_reset();
+
+        sv_push(&sv_done, job);
+        uint64_t one = 1;
+        if (write(sv_efd, &one, sizeof(one)) < 0) {
+            perror("eventfd");
+        }
+    }
+
+    mem_release();
+    return NULL;
+}
+
+/* Closes the connection; its memory goes after the current batch of events, see sv_reap(). */
+static void sv_close(int ep, sv_conn *conn) {
+    if (conn->fd >= 0) {
+        epoll_ctl(ep, EPOLL_CTL_DEL, conn->fd, NULL);
+        close(conn->fd);
+        conn->fd = -1;
+        conn->dead = sv_dead;
+        sv_dead = conn;
+    }
+}
+
+/* Frees the closed connections the workers hold no request of. */
+static void sv_reap(void) {
+    sv_conn **pt = &sv_dead;
+    while (*pt != NULL) {
+        sv_conn *conn = *pt;
+        if (conn->busy > 0) {
+            pt = &conn->dead;
+            continue;
+        }
+        *pt = conn->dead;
+        free(conn->in);
+        free(conn->out);
+        free(conn);
+    }
+}
+
+/* Sends what the connection has to send and updates the events it waits for. */
+static void sv_flush(int ep, sv_conn *conn) {
+    while ((conn->fd >= 0) && (conn->out_at < conn->out_len)) {
+        ssize_t n = send(conn->fd, conn->out + conn->out_at, conn->out_len - conn->out_at, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn->out_at += n;
+        } else if ((n < 0) && (errno == EINTR)) {
+            continue;
+        } else if ((n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            break;
+        } else {
+            sv_close(ep, conn);
+        }
+    }
+    if (conn->fd < 0) {
+        return;
+    }
+
+    bool full = (conn->out_at < conn->out_len);
+    if (!full) {
+        conn->out_at = 0;
+        conn->out_len = 0;
+    }
+    if (conn->eof && (conn->busy == 0) && (conn->in_len == 0) && !full) {
+        sv_close(ep, conn);                                // everything asked has been answered
+        return;
+    }
+
+    bool more = !conn->eof && !full && (conn->busy < SV_BUSY_MAX);
+    unsigned int ev = (more ? EPOLLIN : 0) | (full ? EPOLLOUT : 0);
+    if (ev != conn->ev) {
+        struct epoll_event e_ev;
+        e_ev.events = ev;
+        e_ev.data.ptr = conn;
+        epoll_ctl(ep, EPOLL_CTL_MOD, conn->fd, &e_ev);
+        conn->ev = ev;
+    }
+}
+
+/*
+ * Queues the complete request lines of the connection, and the last one after end of input, until
+ * SV_BUSY_MAX of them are with the workers; the rest wait in the buffer.
+ */
+static void sv_split(sv_conn *conn) {
+    size_t at = 0;
+    while ((at < conn->in_len) && (conn->busy < SV_BUSY_MAX)) {
+        char *nl = (char *) memchr(conn->in + at, '\n', conn->in_len - at);
+        if ((nl == NULL) && !conn->eof) {
+            break;
+        }
+        size_t len = (nl != NULL) ? (size_t) (nl - (conn->in + at)) : conn->in_len - at;
+
+        size_t sp = 0;
+        char *pt = conn->in + at;
+        while ((sp < len) && ((pt[sp] == ' ') || (pt[sp] == '\t') || (pt[sp] == '\r'))) {
+            sp++;
+        }
+        if (sp < len) {                                    // blank lines get no response
+            sv_job *job = (sv_job *) sv_alloc(NULL, sizeof(sv_job));
+            job->conn = conn;
+            job->line = (char *) sv_alloc(NULL, len);
+            memcpy(job->line, conn->in + at, len);
+            job->len = len;
+            job->rsp = NULL;
+            conn->busy++;
+            sv_push(&sv_todo, job);
+        }
+        at += len + 1;
+    }
+
+    at = (at < conn->in_len) ? at : conn->in_len;
+    memmove(conn->in, conn->in + at, conn->in_len - at);
+    conn->in_len -= at;
+}
+
+/* Reads what the client has sent so far. */
+static void sv_read(int ep, sv_conn *conn) {
+    while (!conn->eof && (conn->out_at == conn->out_len) && (conn->busy < SV_BUSY_MAX)) {  // see sv_flush()
+        if (conn->in_len == conn->in_cap) {
+            sv_split(conn);                                // makes room of the complete lines
+            if (conn->busy >= SV_BUSY_MAX) {
+                break;                                     // read on once answers come back
+            }
+        }
+        if ((conn->in_len == conn->in_cap) && (conn->in_cap >= SV_IN_MAX)) {
+            sv_close(ep, conn);                            // a line no request can be that long
+            return;
+        }
+        if (conn->in_len == conn->in_cap) {
+            conn->in_cap = (conn->in_cap == 0) ? 4096 : conn->in_cap * 2;
+            conn->in = (char *) sv_alloc(conn->in, conn->in_cap);
+        }
+
+        ssize_t n = read(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len);
+        if (n > 0) {
+            conn->in_len += n;
+        } else if (n == 0) {
+            conn->eof = true;
+        } else if (errno == EINTR) {
+            continue;
+        } else if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            sv_close(ep, conn);
+            return;
+        }
+    }
+
+    sv_split(conn);
+    sv_flush(ep, conn);                                    // after end of input, only answers are awaited
+}
+
+/* Hands the finished responses to their connections. */
+static void sv_answer(int ep) {
+    uint64_t cnt;
+    if (read(sv_efd, &cnt, sizeof(cnt)) < 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&sv_done.lock);
+    sv_job *job = sv_done.head;
+    sv_done.head = NULL;
+    sv_done.tail = NULL;
+    pthread_mutex_unlock(&sv_done.lock);
+
+    while (job != NULL) {
+        sv_job *next = job->next;
+        sv_conn *conn = job->conn;
+        conn->busy--;
+
+        size_t len = strlen(job->rsp);
+        if ((conn->fd >= 0) && (conn->out_len - conn->out_at + len > SV_OUT_MAX)) {
+            sv_close(ep, conn);                            // the client is not reading its answers
+        }
+        if (conn->fd >= 0) {                               // a closed connection drops its answers
+            sv_split(conn);                                // lines held back by SV_BUSY_MAX
+            if (conn->out_len + len > conn->out_cap) {
+                conn->out_cap = (2 * conn->out_cap > conn->out_len + len) ? 2 * conn->out_cap : conn->out_len + len;
+                conn->out = (char *) sv_alloc(conn->out, conn->out_cap);
+            }
+            memcpy(conn->out + conn->out_len, job->rsp, len);
+            conn->out_len += len;
+            sv_flush(ep, conn);
+        }
+
+        free(job->line);
+        free(job->rsp);
+        free(job);
+        job = next;
+    }
+}
+
+/* Opens the listening socket at path, replacing a stale socket left there. */
+static int sv_listen(char *path) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: path too long\n", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    struct stat st;
+    if ((stat(path, &st) == 0) && S_ISSOCK(st.st_mode)) {
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if ((fd < 0) || (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) || (listen(fd, SOMAXCONN) < 0)) {
+        perror(path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+/* Serves requests on the Unix socket at path with n_thr workers until SIGINT or SIGTERM. */
+int serve(char *path, int n_thr, int flags) {
+    int lfd = sv_listen(path);
+    if (lfd < 0) {
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sv_sig;                                // no SA_RESTART: epoll_pwait() must return
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    sigset_t stop, wait;                                   // blocked but while waiting, or a signal
+    sigemptyset(&stop);                                    // between the test of sv_stop and the
+    sigaddset(&stop, SIGINT);                              // wait would go unnoticed; the workers
+    sigaddset(&stop, SIGTERM);                             // inherit the mask and never take them
+    pthread_sigmask(SIG_BLOCK, &stop, &wait);
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    sv_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if ((ep < 0) || (sv_efd < 0)) {
+        perror("serve");
+        return 1;
+    }
+    sv_flags = flags;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;                                    // the listening socket
+    epoll_ctl(ep, EPOLL_CTL_ADD, lfd, &ev);
+    ev.data.ptr = &sv_efd;
+    epoll_ctl(ep, EPOLL_CTL_ADD, sv_efd, &ev);
+
+    n_thr = (n_thr < 1) ? 1 : n_thr;
+    pthread_t *tid = (pthread_t *) sv_alloc(NULL, sizeof(pthread_t) * n_thr);
+    int ind;
+    for (ind = 0; ind < n_thr; ind++) {
+        if (pthread_create(tid + ind, NULL, sv_work, NULL) != 0) {
+            perror("pthread_create");
+            exit(1);
+        }
+    }
+
+    struct epoll_event evs[64];
+    while (!sv_stop) {
+        int n = epoll_pwait(ep, evs, 64, -1, &wait);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_pwait");
+            break;
+        }
+
+        for (ind = 0; ind < n; ind++) {
+            if (evs[ind].data.ptr == NULL) {
+                int fd;
+                while ((fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    sv_conn *conn = (sv_conn *) sv_alloc(NULL, sizeof(sv_conn));
+                    memset(conn, 0, sizeof(sv_conn));
+                    conn->fd = fd;
+                    conn->ev = EPOLLIN;
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = conn;
+                    epoll_ctl(ep, EPOLL_CTL_ADD, fd, &ev);
+                }
+            } else if (evs[ind].data.ptr == &sv_efd) {
+                sv_answer(ep);
+            } else {
+                sv_conn *conn = (sv_conn *) evs[ind].data.ptr;
+                if (conn->fd < 0) {
+                    continue;
+                }
+                if (!conn->eof && (evs[ind].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                    sv_read(ep, conn);
+                } else if (evs[ind].events & (EPOLLHUP | EPOLLERR)) {
+                    sv_close(ep, conn);                    // gone before reading its answers
+                } else if (evs[ind].events & EPOLLOUT) {
+                    sv_flush(ep, conn);
+                }
+            }
+        }
+        sv_reap();
+    }
+
+    pthread_mutex_lock(&sv_todo.lock);
+    sv_end = true;
+    pthread_cond_broadcast(&sv_todo.cond);
+    pthread_mutex_unlock(&sv_todo.lock);
+    for (ind = 0; ind < n_thr; ind++) {
+        pthread_join(tid[ind], NULL);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &wait, NULL);
+    free(tid);
+    close(sv_efd);
+    close(ep);
+    close(lfd);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,292 @@
+/*
+ * simd.c
+ * Vector kernels of the bytecode interpreter
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "simd.h"
+#include "struct.h"
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+/*
+ * The arithmetic instructions of the interpreter (vm_add, vm_sub, vm_mul, vm_div and vm_neg) run
+ * here over a block of registers, 4 or 8 doubles (8 or 16 floats) per instruction with AVX2 or
+ * AVX-512, chosen once from the CPU. Each lane is rounded exactly as the scalar operation would,
+ * and the tail of a block goes through the scalar loop, so every kernel gives the same bits. The
+ * functions stay with libm, one lane at a time, since no vector library matches it bit for bit.
+ */
+
+/* One lane of op, with the operand order of the vector kernels so that even a NaN comes out the same. */
+static double sc_op(vm_op op, double a, double b) {
+#ifdef __SSE2__
+    __m128d va = _mm_set_sd(a), vb = _mm_set_sd(b);
+    switch (op) {
+        case vm_add:
+            return _mm_cvtsd_f64(_mm_add_sd(va, vb));
+        case vm_sub:
+            return _mm_cvtsd_f64(_mm_sub_sd(va, vb));
+        case vm_mul:
+            return _mm_cvtsd_f64(_mm_mul_sd(va, vb));
+        case vm_div:
+            return _mm_cvtsd_f64(_mm_div_sd(va, vb));
+        default:
+            return _mm_cvtsd_f64(_mm_xor_pd(va, _mm_set_sd(-0.0)));
+    }
+#else
+    switch (op) {
+        case vm_add:
+            return a + b;
+        case vm_sub:
+            return a - b;
+        case vm_mul:
+            return a * b;
+        case vm_div:
+            return a / b;
+        default:
+            return -a;
+    }
+#endif
+}
+
+static float sc_opf(vm_op op, float a, float b) {
+#ifdef __SSE2__
+    __m128 va = _mm_set_ss(a), vb = _mm_set_ss(b);
+    switch (op) {
+        case vm_add:
+            return _mm_cvtss_f32(_mm_add_ss(va, vb));
+        case vm_sub:
+            return _mm_cvtss_f32(_mm_sub_ss(va, vb));
+        case vm_mul:
+            return _mm_cvtss_f32(_mm_mul_ss(va, vb));
+        case vm_div:
+            return _mm_cvtss_f32(_mm_div_ss(va, vb));
+        default:
+            return _mm_cvtss_f32(_mm_xor_ps(va, _mm_set_ss(-0.0f)));
+    }
+#else
+    switch (op) {
+        case vm_add:
+            return a + b;
+        case vm_sub:
+            return a - b;
+        case vm_mul:
+            return a * b;
+        case vm_div:
+            return a / b;
+        default:
+            return -a;
+    }
+#endif
+}
+
+/* Scalar kernel of op over n elements, for the tail of a block and for CPUs without AVX2. */
+static void sc_run(vm_op op, double *d, const double *a, const double *b, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        d[i] = sc_op(op, a[i], (op == vm_neg) ? 0 : b[i]);
+    }
+}
+
+static void sc_runf(vm_op op, float *d, const float *a, const float *b, size_t n) {
+    size_t i;
+    for (i = 0; i < n; i++) {
+        d[i] = sc_opf(op, a[i], (op == vm_neg) ? 0 : b[i]);
+    }
+}
+
+#ifdef __x86_64__
+
+__attribute__((target("avx2")))
+static void avx2_run(vm_op op, double *d, const double *a, const double *b, size_t n) {
+    size_t i = 0;
+    __m256d sign = _mm256_set1_pd(-0.0);
+
+    for (; i + 4 <= n; i += 4) {
+        __m256d va = _mm256_loadu_pd(a + i);
+        __m256d vb = (op == vm_neg) ? sign : _mm256_loadu_pd(b + i);
+        switch (op) {
+            case vm_add:
+                va = _mm256_add_pd(va, vb);
+                break;
+            case vm_sub:
+                va = _mm256_sub_pd(va, vb);
+                break;
+            case vm_mul:
+                va = _mm256_mul_pd(va, vb);
+                break;
+            case vm_div:
+                va = _mm256_div_pd(va, vb);
+                break;
+            default:
+                va = _mm256_xor_pd(va, vb);                // flips the sign, as -a does
+                break;
+        }
+        _mm256_storeu_pd(d + i, va);
+    }
+    _mm256_zeroupper();                                    // libm and the tail use legacy SSE
+    sc_run(op, d + i, a + i, (op == vm_neg) ? b : b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void avx2_runf(vm_op op, float *d, const float *a, const float *b, size_t n) {
+    size_t i = 0;
+    __m256 sign = _mm256_set1_ps(-0.0f);
+
+    for (; i + 8 <= n; i += 8) {
+        __m256 va = _mm256_loadu_ps(a + i);
+        __m256 vb = (op == vm_neg) ? sign : _mm256_loadu_ps(b + i);
+        switch (op) {
+            case vm_add:
+                va = _mm256_add_ps(va, vb);
+                break;
+            case vm_sub:
+                va = _mm256_sub_ps(va, vb);
+                break;
+            case vm_mul:
+                va = _mm256_mul_ps(va, vb);
+                break;
+            case vm_div:
+                va = _mm256_div_ps(va, vb);
+                break;
+            default:
+                va = _mm256_xor_ps(va, vb);
+                break;
+        }
+        _mm256_storeu_ps(d + i, va);
+    }
+    _mm256_zeroupper();
+    sc_runf(op, d + i, a + i, (op == vm_neg) ? b : b + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_run(vm_op op, double *d, const double *a, const double *b, size_t n) {
+    size_t i = 0;
+    __m512i sign = _mm512_set1_epi64((long long) 1 << 63);
+
+    for (; i + 8 <= n; i += 8) {
+        __m512d va = _mm512_loadu_pd(a + i);
+        switch (op) {
+            case vm_add:
+                va = _mm512_add_pd(va, _mm512_loadu_pd(b + i));
+                break;
+            case vm_sub:
+                va = _mm512_sub_pd(va, _mm512_loadu_pd(b + i));
+                break;
+            case vm_mul:
+                va = _mm512_mul_pd(va, _mm512_loadu_pd(b + i));
+                break;
+            case vm_div:
+                va = _mm512_div_pd(va, _mm512_loadu_pd(b + i));
+                break;
+            default:                                       // AVX-512F has no floating-point xor
+                va = _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(va), sign));
+                break;
+        }
+        _mm512_storeu_pd(d + i, va);
+    }
+    _mm256_zeroupper();                                    // libm and the tail use legacy SSE
+    sc_run(op, d + i, a + i, (op == vm_neg) ? b : b + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+static void avx512_runf(vm_op op, float *d, const float *a, const float *b, size_t n) {
+    size_t i = 0;
+    __m512i sign = _mm512_set1_epi32((int) 0x80000000u);
+
+    for (; i + 16 <= n; i += 16) {
+        __m512 va = _mm512_loadu_ps(a + i);
+        switch (op) {
+            case vm_add:
+                va = _mm512_add_ps(va, _mm512_loadu_ps(b + i));
+                break;
+            case vm_sub:
+                va = _mm512_sub_ps(va, _mm512_loadu_ps(b + i));
+                break;
+            case vm_mul:
+                va = _mm512_mul_ps(va, _mm512_loadu_ps(b + i));
+                break;
+            case vm_div:
+                va = _mm512_div_ps(va, _mm512_loadu_ps(b + i));
+                break;
+            default:
+                va = _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(va), sign));
+                break;
+        }
+        _mm512_storeu_ps(d + i, va);
+    }
+    _mm256_zeroupper();
+    sc_runf(op, d + i, a + i, (op == vm_neg) ? b : b + i, n - i);
+}
+
+#endif
+
+static const simd_isa simd_all[] = {
+#ifdef __x86_64__
+    {"avx512", avx512_run, avx512_runf},
+    {"avx2", avx2_run, avx2_runf},
+#endif
+    {"scalar", sc_run, sc_runf}
+};
+
+#define SIMD_N ((int) (sizeof(simd_all) / sizeof(simd_all[0])))
+
+static const simd_isa *simd_cur = NULL;
+
+/*
+ * Returns the widest kernels the CPU runs. The environment variable DERIV_SIMD, set to avx2 or
+ * scalar, caps the choice, to compare the kernels on one machine.
+ */
+const simd_isa *simd_pick(void) {
+    const simd_isa *isa = __atomic_load_n(&simd_cur, __ATOMIC_ACQUIRE);
+    if (isa != NULL) {
+        return isa;
+    }
+
+    const char *cap = getenv("DERIV_SIMD");
+    bool skip = (cap != NULL);                             // until the capped kernel is reached
+    int ind;
+
+    for (ind = 0; ind < SIMD_N - 1; ind++) {
+        isa = simd_all + ind;
+        if (skip && (strcmp(cap, isa->name) != 0)) {
+            continue;
+        }
+        skip = false;
+#ifdef __x86_64__
+        __builtin_cpu_init();
+        if ((strcmp(isa->name, "avx512") == 0) ? __builtin_cpu_supports("avx512f") : __builtin_cpu_supports("avx2")) {
+            break;
+        }
+#endif
+    }
+    isa = simd_all + ind;                                  // the scalar kernels when nothing wider fits
+
+    __atomic_store_n(&simd_cur, isa, __ATOMIC_RELEASE);    // racing callers store the same kernels
+    return isa;
+}
@@ -25,25 +25,28 @@
  * SOFTWARE.
  */
 
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include "gov.h"
+#include "mem.h"
+#include "node.h"
 #include "parse.h"
 #include "struct.h"
 #include "simplify.h"
 #include "utility.h"
 
 char *simp_input(char *str) {
-    char *str_cpy = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-    strcpy(str_cpy, str);
+    gov_check();
+
+    char *str_cpy = str_dup(str);
 
     /* begins by removing enclosing parentheses */
-    while (par_enclosed(str_cpy)) {
-        str_cpy = rm_par(str_cpy);
-    }
+    str_cpy = strip_par(str_cpy);
 
     fn_type fn_tp = id_fn_tp(str_cpy);
     int num_tm = n_term(str_cpy), num_bl = n_block(str_cpy);
-    char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR);
+    str_bld rt_str = bld_new("");
 
     if ((num_tm == 1) && (num_bl == 1)) {
         if (is_composite(str_cpy)) {
@@ -52,52 +55,46 @@ char *simp_input(char *str) {
 
             size_t len;
             char *pt;
-            char *temp_1 = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-            char *temp_2 = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-            char *temp_3 = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-            strcpy(temp_1, rev->entry);
+            char *temp_2 = str_dup("");
+            char *temp_3 = str_dup("");
+            char *temp_1 = str_dup(rev->entry);
 
             if ((n_term(rev->entry) != 1) || (n_block(rev->entry) != 1)) {
                 temp_1 = simp_input(rev->entry);
             } else {
-                pt = strpbrk(temp_1, "^");
-                while (!par_paired(temp_1, pt - temp_1)) {
-                    pt = strpbrk(pt + 1, "^");
-                }
+                pt = top_pbrk(temp_1, "^");
 
                 if (pt != NULL) {
-                    char *bef = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-                    char *aft = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
                 
                     *(pt++) = 0;
-                    strcpy(bef, temp_1);
-                    strcpy(aft, pt);
+                    char *bef = str_dup(temp_1);
+                    char *aft = str_dup(pt);
 
                     bef = simp_input(bef);
                     aft = simp_input(aft);
 
-                    strcpy(temp_1, "");
+                    temp_1 = str_dup("");
                     if ((n_term(bef) != 1) || (n_block(bef) != 1)) {
-                        strcat(temp_1, "(");
-                        strcat(temp_1, bef);
-                        strcat(temp_1, ")");
+                        temp_1 = str_cat(temp_1, "(");
+                        temp_1 = str_cat(temp_1, bef);
+                        temp_1 = str_cat(temp_1, ")");
                     } else {
-                        strcat(temp_1, bef);
+                        temp_1 = str_cat(temp_1, bef);
                     }
-                    strcat(temp_1, "^");
+                    temp_1 = str_cat(temp_1, "^");
                     if ((n_term(aft) != 1) || (n_block(aft) != 1)) {
-                        strcat(temp_1, "(");
-                        strcat(temp_1, aft);
-                        strcat(temp_1, ")");
+                        temp_1 = str_cat(temp_1, "(");
+                        temp_1 = str_cat(temp_1, aft);
+                        temp_1 = str_cat(temp_1, ")");
                     } else {
-                        strcat(temp_1, aft);
+                        temp_1 = str_cat(temp_1, aft);
                     }
                 } else {
                     pt = strpbrk(temp_1, "x");
                     while (((*(pt - 1) == '(') && (*(pt + 1) == ')')) &&
                            ((*(pt - 2) == '(') && (*(pt + 2) == ')'))) {
-                        strcpy(pt - 1, pt);
-                        strcpy(pt + 1, pt + 2);
+                        memmove(pt - 1, pt, strlen(pt) + 1);
+                        memmove(pt + 1, pt + 2, strlen(pt + 2) + 1);
 
                         pt = strpbrk(temp_1, "x");
                     }
@@ -105,26 +102,23 @@ char *simp_input(char *str) {
             }
 
             while (rev->next != NULL) {
-                while (par_enclosed(rev->entry)) {
-                    rev->entry = rm_par(rev->entry);
-                }
+                rev->entry = strip_par(rev->entry);
 
                 len = strlen(rev->entry);
                 pt = strstr(rev->next->entry, rev->entry);
 
-                strncpy(temp_2, rev->next->entry, pt - rev->next->entry);
-                temp_2[pt - rev->next->entry] = 0;
+                temp_2 = str_ndup(rev->next->entry, pt - rev->next->entry);
 
-                strcpy(temp_3, pt + len);
-                strcat(temp_2, temp_1);
-                strcat(temp_2, temp_3);
+                temp_3 = str_dup(pt + len);
+                temp_2 = str_cat(temp_2, temp_1);
+                temp_2 = str_cat(temp_2, temp_3);
 
                 len = strlen(temp_1);
                 pt = strstr(temp_2, temp_1);
                 while (((*(pt - 1) == '(') && (*(pt + len) == ')')) &&
                        ((*(pt - 2) == '(') && (*(pt + len + 1) == ')'))) {
-                    strcpy(pt - 1, pt);
-                    strcpy(pt + len, pt + len + 1);
+                    memmove(pt - 1, pt, strlen(pt) + 1);
+                    memmove(pt + len, pt + len + 1, strlen(pt + len + 1) + 1);
 
                     pt = strstr(temp_2, temp_1);
                 }
@@ -143,101 +137,98 @@ char *simp_input(char *str) {
                 }
 
                 if (exp_bef) {
-                    char *temp_4 = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+                    char *temp_4 = str_dup("");
                     if (*(pt - 1) == '(') {
                         pt -= 3;                           // before the '^'
                     } else {
                         pt -= 2;
                     }
-                    strcpy(temp_4, pt + 1);
+                    temp_4 = str_dup(pt + 1);
 
                     int ind = 0;
-                    while (!par_paired(pt - ind, ind + 1)) {
-                        ind++;
+                    if (*pt == ')') {                      // base spans back to the paired '('
+                        par_idx *idx = index_par(temp_2);
+                        if (idx->match[pt - temp_2] != -1) {
+                            ind = (pt - temp_2) - idx->match[pt - temp_2];
+                        }
                     }
                     len = ind + 1;
                     pt -= ind;
 
-                    strncpy(temp_3, pt, len);
-                    while (par_enclosed(temp_3)) {
-                        temp_3 = rm_par(temp_3);
-                    }
+                    temp_3 = str_ndup(pt, len);
+                    temp_3 = strip_par(temp_3);
                     temp_3 = simp_input(temp_3);
 
-                    strcpy(temp_2, "");
+                    temp_2 = str_dup("");
                     if ((n_term(temp_3) != 1) || (n_block(temp_3) != 1)) {
-                        strcat(temp_2, "(");
-                        strcat(temp_2, temp_3);
-                        strcat(temp_2, ")");
+                        temp_2 = str_cat(temp_2, "(");
+                        temp_2 = str_cat(temp_2, temp_3);
+                        temp_2 = str_cat(temp_2, ")");
                     } else {
-                        strcat(temp_2, temp_3);
+                        temp_2 = str_cat(temp_2, temp_3);
                     }
-                    strcat(temp_2, temp_4);
+                    temp_2 = str_cat(temp_2, temp_4);
                 } else if (exp_aft) {
-                    char *temp_4 = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+                    char *temp_4 = str_dup("");
                     if (*(pt - 1) == '(') {
                         pt += len + 2;                     // after the '^'
                     } else {
                         pt += len + 1;
                     }
-                    strncpy(temp_4, temp_2, pt - temp_2);
+                    temp_4 = str_ndup(temp_2, pt - temp_2);
 
-                    while (par_enclosed(pt)) {
-                        pt = rm_par(pt);
-                    }
+                    pt = strip_par(pt);
                     pt = simp_input(pt);
 
-                    strcpy(temp_2, temp_4);
+                    temp_2 = str_dup(temp_4);
                     if ((n_term(pt) != 1) || (n_block(pt) != 1)) {
-                        strcat(temp_2, "(");
-                        strcat(temp_2, pt);
-                        strcat(temp_2, ")");
+                        temp_2 = str_cat(temp_2, "(");
+                        temp_2 = str_cat(temp_2, pt);
+                        temp_2 = str_cat(temp_2, ")");
                     } else {
-                        strcat(temp_2, pt);
+                        temp_2 = str_cat(temp_2, pt);
                     }
                 }
 
-                strcpy(temp_1, temp_2);
+                temp_1 = str_dup(temp_2);
 
                 rev = rev->next;
             }
-            strcpy(rt_str, temp_1);
+            rt_str = bld_new(temp_1);
 
-            return rt_str;
+            return rt_str.str;
         } else if ((fn_tp == expo) || (fn_tp == powr) ||
                    ((fn_tp == poly) && (strcmp(str_cpy, "x") != 0))) {
-            char *pt = strpbrk(str_cpy, "^");
-            while (!par_paired(str_cpy, pt - str_cpy)) {
-                pt = strpbrk(pt + 1, "^");
+            char *pt = top_pbrk(str_cpy, "^");
+            if (pt == NULL) {                              // ex) -x
+                return str_cpy;
             }
             *pt = 0;
 
-            char *bef = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-            char *aft = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-            strcpy(bef, str_cpy);
-            strcpy(aft, pt + 1);
+            char *bef = str_dup(str_cpy);
+            char *aft = str_dup(pt + 1);
 
             bef = simp_input(bef);
             aft = simp_input(aft);
 
-            strcpy(rt_str, "");
+            rt_str = bld_new("");
             if ((n_term(bef) != 1) || (n_block(bef) != 1)) {
-                strcat(rt_str, "(");
-                strcat(rt_str, bef);
-                strcat(rt_str, ")");
+                bld_cat(&rt_str, "(");
+                bld_cat(&rt_str, bef);
+                bld_cat(&rt_str, ")");
             } else {
-                strcat(rt_str, bef);
+                bld_cat(&rt_str, bef);
             }
-            strcat(rt_str, "^");
+            bld_cat(&rt_str, "^");
             if ((n_term(aft) != 1) || (n_block(aft) != 1)) {
-                strcat(rt_str, "(");
-                strcat(rt_str, aft);
-                strcat(rt_str, ")");
+                bld_cat(&rt_str, "(");
+                bld_cat(&rt_str, aft);
+                bld_cat(&rt_str, ")");
             } else {
-                strcat(rt_str, aft);
+                bld_cat(&rt_str, aft);
             }
 
-            return rt_str;            
+            return rt_str.str;            
         } else {
             return str_cpy;
         }
@@ -245,29 +236,29 @@ char *simp_input(char *str) {
         term *tm = into_term(str_cpy);
         bool op = false;
 
-        strcpy(rt_str, "");
+        rt_str = bld_new("");
         while (tm->segm != NULL) {
             if (!op) {
                 tm->segm->entry = simp_input(tm->segm->entry);
                 
                 if (n_term(tm->segm->entry) == 1) {
-                    strcat(rt_str, tm->segm->entry);
+                    bld_cat(&rt_str, tm->segm->entry);
                 } else {
-                    strcat(rt_str, "(");
-                    strcat(rt_str, tm->segm->entry);
-                    strcat(rt_str, ")");
+                    bld_cat(&rt_str, "(");
+                    bld_cat(&rt_str, tm->segm->entry);
+                    bld_cat(&rt_str, ")");
                 }
 
                 op = true;
             } else {
-                strcat(rt_str, tm->segm->entry);
+                bld_cat(&rt_str, tm->segm->entry);
 
                 op = false;
             }
             tm->segm = tm->segm->next;
         }
 
-        return rt_str;
+        return rt_str.str;
     } else if (num_bl != 1) {
         block *bl = into_block(str_cpy);
         list *mult_head = bl->mult;
@@ -286,66 +277,61 @@ char *simp_input(char *str) {
         }
 
         while (mult_curr != NULL) {
-            while (par_enclosed(mult_curr->entry)) {
-                mult_curr->entry = rm_par(mult_curr->entry);
-            }
+            mult_curr->entry = strip_par(mult_curr->entry);
             mult_curr = mult_curr->next;
         }
         mult_curr = mult_head;
         while (divi_curr != NULL) {
-            while (par_enclosed(divi_curr->entry)) {
-                divi_curr->entry = rm_par(divi_curr->entry);
-            }
+            divi_curr->entry = strip_par(divi_curr->entry);
             divi_curr = divi_curr->next;
         }
         divi_curr = divi_head;
 
-        strcpy(rt_str, "");
+        rt_str = bld_new("");
         while (mult_curr != NULL) {
             mult_curr->entry = simp_input(mult_curr->entry);
             if (n_term(mult_curr->entry) == 1) {
-                strcat(rt_str, mult_curr->entry);
+                bld_cat(&rt_str, mult_curr->entry);
             } else {
-                strcat(rt_str, "(");
-                strcat(rt_str, mult_curr->entry);
-                strcat(rt_str, ")");
+                bld_cat(&rt_str, "(");
+                bld_cat(&rt_str, mult_curr->entry);
+                bld_cat(&rt_str, ")");
             }
 
             if (mult_curr->next != NULL) {
-                strcat(rt_str, "*");
+                bld_cat(&rt_str, "*");
             }
             mult_curr = mult_curr->next;
         }
         if (n_divi != 0) {
             while (divi_curr != NULL) {
-                strcat(rt_str, "/");
+                bld_cat(&rt_str, "/");
                 divi_curr->entry = simp_input(divi_curr->entry);
                 if ((n_term(divi_curr->entry) == 1) && (n_block(divi_curr->entry) == 1)) {
-                    strcat(rt_str, divi_curr->entry);
+                    bld_cat(&rt_str, divi_curr->entry);
                 } else {
-                    strcat(rt_str, "(");
-                    strcat(rt_str, divi_curr->entry);
-                    strcat(rt_str, ")");
+                    bld_cat(&rt_str, "(");
+                    bld_cat(&rt_str, divi_curr->entry);
+                    bld_cat(&rt_str, ")");
                 }
 
                 divi_curr = divi_curr->next;
             }
         }
 
-        return rt_str;
+        return rt_str.str;
     }
 }
 
 char *simp_output(char *str) {
-    char *str_cpy = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-    strcpy(str_cpy, str);
+    gov_check();
 
-    while (par_enclosed(str_cpy)) {
-        str_cpy = rm_par(str_cpy);
-    }
+    char *str_cpy = str_dup(str);
+
+    str_cpy = strip_par(str_cpy);
 
     int num_tm = n_term(str_cpy), num_bl = n_block(str_cpy);
-    char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+    str_bld rt_str = bld_new("");
     
     if ((num_tm == 1) && (num_bl == 1)) {
         if (is_composite(str_cpy)) {
@@ -354,33 +340,29 @@ char *simp_output(char *str) {
 
             size_t len;
             char *pt;
-            char *temp_1 = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-            char *temp_2 = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-            char *temp_3 = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
+            char *temp_2 = str_dup("");
+            char *temp_3 = str_dup("");
 
-            strcpy(temp_1, rev->entry);
+            char *temp_1 = str_dup(rev->entry);
             while (rev->next != NULL) {
-                while (par_enclosed(rev->entry)) {
-                    rev->entry = rm_par(rev->entry);
-                }
+                rev->entry = strip_par(rev->entry);
 
                 len = strlen(rev->entry);
                 pt = strstr(rev->next->entry, rev->entry);
                 temp_1 = simp_output(temp_1);
 
-                strncpy(temp_2, rev->next->entry, pt - rev->next->entry);
-                temp_2[pt - rev->next->entry] = 0;
+                temp_2 = str_ndup(rev->next->entry, pt - rev->next->entry);
 
-                strcpy(temp_3, pt + len);
-                strcat(temp_2, temp_1);
-                strcat(temp_2, temp_3);
+                temp_3 = str_dup(pt + len);
+                temp_2 = str_cat(temp_2, temp_1);
+                temp_2 = str_cat(temp_2, temp_3);
 
-                strcpy(temp_1, temp_2);
+                temp_1 = str_dup(temp_2);
                 rev = rev->next;
             }
-            strcpy(rt_str, temp_1);
+            rt_str = bld_new(temp_1);
 
-            return rt_str;
+            return rt_str.str;
         } else {
             return str_cpy;
         }
@@ -388,48 +370,45 @@ char *simp_output(char *str) {
         term *tm = into_term(str_cpy);
         bool op = false;
 
-        char *prev_sig = (char *) malloc(sizeof(char) * 4);
-        strcpy(rt_str, "");
+        char *prev_sig = (char *) mem_alloc(sizeof(char) * 4);
+        rt_str = bld_new("");
         while (tm->segm != NULL) {
             if (!op) {
-                while (par_enclosed(tm->segm->entry)) {
-                    tm->segm->entry = rm_par(tm->segm->entry);
-                }
+                tm->segm->entry = strip_par(tm->segm->entry);
                 tm->segm->entry = simp_output(tm->segm->entry);
 
                 if ((strcmp(tm->segm->entry, "0") != 0) && (strcmp(tm->segm->entry, "(0)") != 0) &&
                     (strcmp(tm->segm->entry, "") != 0)) {
-                    strcat(rt_str, prev_sig);
+                    bld_cat(&rt_str, prev_sig);
 
                     ch_type ch_tp = id_ch_tp(*tm->segm->entry);
                     if (ch_tp == pt_sig) {
-                        strcat(rt_str, "(");
-                        strcat(rt_str, tm->segm->entry);
-                        strcat(rt_str, ")");
+                        bld_cat(&rt_str, "(");
+                        bld_cat(&rt_str, tm->segm->entry);
+                        bld_cat(&rt_str, ")");
                     } else {
-                        strcat(rt_str, tm->segm->entry);
+                        bld_cat(&rt_str, tm->segm->entry);
                     }
                 }
 
                 op = true;
             } else {
-                strcpy(prev_sig, tm->segm->entry);
+                prev_sig = str_dup(tm->segm->entry);
 
                 op = false;
             }
             tm->segm = tm->segm->next;
         }
 
-        ch_type ch_tp = id_ch_tp(*(rt_str + strlen(rt_str) - 1));
-        if (ch_tp == pt_sig) {
-            *(rt_str + strlen(rt_str) - 1) = 0;
+        if ((rt_str.len > 0) && (id_ch_tp(rt_str.str[rt_str.len - 1]) == pt_sig)) {
+            rt_str.str[--rt_str.len] = 0;
         }
 
-        if (strcmp(rt_str, "") == 0) {
+        if (rt_str.len == 0) {
             return "0";
         }
         
-        return rt_str;
+        return rt_str.str;
     } else if (num_bl != 1) {
         block *bl = into_block(str_cpy);
         list *mult_head = bl->mult;
@@ -447,7 +426,7 @@ char *simp_output(char *str) {
             divi_curr = divi_head;
         }
 
-        strcpy(rt_str, "");
+        rt_str = bld_new("");
         while (mult_curr != NULL) {
             mult_curr->entry = simp_output(mult_curr->entry);
 
@@ -457,34 +436,33 @@ char *simp_output(char *str) {
 
             if (strcmp(mult_curr->entry, "1") != 0) {
                 if ((n_term(mult_curr->entry) != 1) || (n_block(mult_curr->entry) != 1)) {
-                    strcat(rt_str, "(");
-                    strcat(rt_str, mult_curr->entry);
-                    strcat(rt_str, ")");
+                    bld_cat(&rt_str, "(");
+                    bld_cat(&rt_str, mult_curr->entry);
+                    bld_cat(&rt_str, ")");
                 } else {
                     ch_type ch_tp = id_ch_tp(*mult_curr->entry);
                     fn_type fn_tp = id_fn_tp(mult_curr->entry);
                     if ((fn_tp == expo) || (fn_tp == powr) || 
                         ((fn_tp == poly) && (strcmp(mult_curr->entry, "x") != 0))) {
-                        strcat(rt_str, "(");
-                        strcat(rt_str, mult_curr->entry);
-                        strcat(rt_str, ")");
+                        bld_cat(&rt_str, "(");
+                        bld_cat(&rt_str, mult_curr->entry);
+                        bld_cat(&rt_str, ")");
                     } else if (ch_tp == pt_sig) {
-                        strcat(rt_str, "(");
-                        strcat(rt_str, mult_curr->entry);
-                        strcat(rt_str, ")");
+                        bld_cat(&rt_str, "(");
+                        bld_cat(&rt_str, mult_curr->entry);
+                        bld_cat(&rt_str, ")");
                     } else {
-                        strcat(rt_str, mult_curr->entry);
+                        bld_cat(&rt_str, mult_curr->entry);
                     }
                 }
             } else if (n_mult == 1) {
-                strcat(rt_str, mult_curr->entry);
+                bld_cat(&rt_str, mult_curr->entry);
             }
             mult_curr = mult_curr->next;
         }
 
         if (n_divi != 0) {
-            char *divi_str = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-            strcpy(divi_str, "");
+            str_bld divi_str = bld_new("");
 
             while (divi_curr != NULL) {
                 divi_curr->entry = simp_output(divi_curr->entry);
@@ -495,43 +473,170 @@ char *simp_output(char *str) {
 
                 if (strcmp(divi_curr->entry, "1") != 0) {
                     if ((n_term(divi_curr->entry) != 1) || (n_block(divi_curr->entry) != 1)) {
-                        strcat(divi_str, "(");
-                        strcat(divi_str, divi_curr->entry);
-                        strcat(divi_str, ")");
+                        bld_cat(&divi_str, "(");
+                        bld_cat(&divi_str, divi_curr->entry);
+                        bld_cat(&divi_str, ")");
                     } else {
                         ch_type ch_tp = id_ch_tp(*divi_curr->entry);
                         fn_type fn_tp = id_fn_tp(divi_curr->entry);
                         if ((fn_tp == expo) || (fn_tp == powr) || 
                             ((fn_tp == poly) && (strcmp(divi_curr->entry, "x") != 0))) {
-                            strcat(divi_str, "(");
-                            strcat(divi_str, divi_curr->entry);
-                            strcat(divi_str, ")");
+                            bld_cat(&divi_str, "(");
+                            bld_cat(&divi_str, divi_curr->entry);
+                            bld_cat(&divi_str, ")");
                         } else if (ch_tp == pt_sig) {
-                            strcat(divi_str, "(");
-                            strcat(divi_str, divi_curr->entry);
-                            strcat(divi_str, ")");
+                            bld_cat(&divi_str, "(");
+                            bld_cat(&divi_str, divi_curr->entry);
+                            bld_cat(&divi_str, ")");
                         } else {
-                            strcat(divi_str, divi_curr->entry);
+                            bld_cat(&divi_str, divi_curr->entry);
                         }
                     }
                 } else if (n_divi == 1) {
-                    strcat(divi_str, divi_curr->entry);
+                    bld_cat(&divi_str, divi_curr->entry);
                 }
                 divi_curr = divi_curr->next;
             }
 
-            if (strcmp(divi_str, "") != 0) {
-                strcat(rt_str, "/");
-                if ((n_term(divi_str) != 1) || (n_block(divi_str) != 1)) {
-                    strcat(rt_str, "(");
-                    strcat(rt_str, divi_str);
-                    strcat(rt_str, ")");
+            if (divi_str.len != 0) {
+                bld_cat(&rt_str, "/");
+                if ((n_term(divi_str.str) != 1) || (n_block(divi_str.str) != 1)) {
+                    bld_cat(&rt_str, "(");
+                    bld_cat(&rt_str, divi_str.str);
+                    bld_cat(&rt_str, ")");
                 } else {
-                    strcat(rt_str, divi_str);
+                    bld_cat(&rt_str, divi_str.str);
                 }
             }
         }
 
-        return rt_str;
+        return rt_str.str;
+    }
+}
+
+/* Folds two numbers, leaving a negative result as the negation of its magnitude. */
+static node *fold(double val) {
+    return (val < 0) ? mk_op(nd_neg, mk_val(-val), NULL) : mk_val(val);
+}
+
+/* Reads a number or a negated number. */
+static bool num_val(node *nd, double *val) {
+    if (nd->type == nd_num) {
+        *val = nd->val;
+        return true;
+    } else if ((nd->type == nd_neg) && (nd->lhs->type == nd_num)) {
+        *val = -nd->lhs->val;
+        return true;
+    }
+    return false;
+}
+
+/* One rewrite of nd over its simplified operands, see simp_node(). */
+static node *simp_once(node *nd) {
+    if (nd->type == nd_fnc) {
+        node *arg = simp_node(nd->lhs);
+        return (arg == nd->lhs) ? nd : mk_fn(nd->nm, arg);
+    } else if (nd->lhs == NULL) {                          // leaf
+        return nd;
+    }
+
+    node *lhs = simp_node(nd->lhs);
+    node *rhs = (nd->rhs != NULL) ? simp_node(nd->rhs) : NULL;
+    double a = 0, b = 0;
+    bool num = (rhs != NULL) && num_val(lhs, &a) && num_val(rhs, &b);
+
+    switch (nd->type) {
+        case nd_add:
+            if (is_val(lhs, 0)) {
+                return rhs;
+            } else if (is_val(rhs, 0)) {
+                return lhs;
+            } else if (num) {
+                return fold(a + b);
+            } else if (lhs == rhs) {                       // shared subtree, a+a = 2a
+                return simp_node(mk_op(nd_mul, mk_val(2), lhs));
+            } else if (rhs->type == nd_neg) {              // a+(-b) = a-b
+                return simp_node(mk_op(nd_sub, lhs, rhs->lhs));
+            }
+            break;
+        case nd_sub:
+            if (is_val(rhs, 0)) {
+                return lhs;
+            } else if (lhs == rhs) {
+                return mk_val(0);
+            } else if (is_val(lhs, 0)) {
+                return simp_node(mk_op(nd_neg, rhs, NULL));
+            } else if (num) {
+                return fold(a - b);
+            } else if (rhs->type == nd_neg) {              // a-(-b) = a+b
+                return mk_op(nd_add, lhs, rhs->lhs);
+            }
+            break;
+        case nd_mul:
+            if (is_val(lhs, 0) || is_val(rhs, 0)) {
+                return mk_val(0);
+            } else if (is_val(lhs, 1)) {
+                return rhs;
+            } else if (is_val(rhs, 1)) {
+                return lhs;
+            } else if (num) {
+                return fold(a * b);
+            } else if ((lhs->type == nd_neg) || (rhs->type == nd_neg)) {     // sign in front
+                node *l = (lhs->type == nd_neg) ? lhs->lhs : lhs;
+                node *r = (rhs->type == nd_neg) ? rhs->lhs : rhs;
+                node *lr = simp_node(mk_op(nd_mul, l, r));
+                return ((lhs->type == nd_neg) == (rhs->type == nd_neg)) ? lr : simp_node(mk_op(nd_neg, lr, NULL));
+            } else if ((rhs->type == nd_div) && is_val(rhs->lhs, 1)) {          // a(1/b) = a/b
+                return simp_node(mk_op(nd_div, lhs, rhs->rhs));
+            } else if (lhs->type == nd_div) {                          // (a/b)c = ac/b
+                return simp_node(mk_op(nd_div, mk_op(nd_mul, lhs->lhs, rhs), lhs->rhs));
+            } else if ((rhs->type == nd_num) && (lhs->type != nd_num)) {    // coefficient in front, ex) x2 = 2x
+                return simp_node(mk_op(nd_mul, rhs, lhs));
+            } else if ((lhs->type == nd_num) && (rhs->type == nd_mul) && (rhs->lhs->type == nd_num)) {
+                return simp_node(mk_op(nd_mul, mk_val(lhs->val * rhs->lhs->val), rhs->rhs));
+            }
+            break;
+        case nd_div:
+            if (is_val(lhs, 0)) {
+                return mk_val(0);
+            } else if (is_val(rhs, 1)) {
+                return lhs;
+            } else if (lhs == rhs) {
+                return mk_val(1);
+            } else if (num && (b != 0) && (fmod(a, b) == 0)) {
+                return fold(a / b);
+            } else if (lhs->type == nd_neg) {              // sign in front
+                return simp_node(mk_op(nd_neg, mk_op(nd_div, lhs->lhs, rhs), NULL));
+            }
+            break;
+        case nd_pow:
+            if (is_val(rhs, 0) || is_val(lhs, 1)) {
+                return mk_val(1);
+            } else if (is_val(rhs, 1)) {
+                return lhs;
+            }
+            break;
+        default:                                           // nd_neg
+            if (lhs->type == nd_neg) {
+                return lhs->lhs;
+            } else if (is_val(lhs, 0)) {
+                return lhs;
+            }
+            return (lhs == nd->lhs) ? nd : mk_op(nd_neg, lhs, NULL);
+    }
+
+    if ((lhs == nd->lhs) && (rhs == nd->rhs)) {
+        return nd;
+    }
+    return mk_op(nd->type, lhs, rhs);
+}
+
+/* Removes the 0s and 1s differentiation leaves behind and folds arithmetic on numbers, bottom-up. */
+node *simp_node(node *nd) {
+    gov_check();
+
+    if (nd->simp == NULL) {                                // shared nodes are simplified once
+        nd->simp = simp_once(nd);
     }
+    return nd->simp;
 }
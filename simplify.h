@@ -28,7 +28,10 @@
 #ifndef SIMPLIFY_H
 #define SIMPLIFY_H
 
+#include "struct.h"
+
 char *simp_input(char *str);
+node *simp_node(node *nd);
 char *simp_output(char *str);
 
 #endif
@@ -26,34 +26,50 @@
  */
 
 #include <stdlib.h>
+#include "mem.h"
 #include "struct.h"
 
 list *init_list() {
-    list *ls = (list *) malloc(sizeof(list));
-    ls->entry = (char *) malloc(sizeof(char) * (MAX_CHAR / 8));
+    list *ls = (list *) mem_alloc(sizeof(list) + sizeof(char));
+    ls->entry = (char *) (ls + 1);                         // empty until a str_dup() replaces it
     ls->next = NULL;
 
     return ls;
 }
 
 comp *init_comp() {
-    comp *cp = (comp *) malloc(sizeof(comp));
+    comp *cp = (comp *) mem_alloc(sizeof(comp));
     cp->elem = init_list();
     
     return cp;
 }
 
 term *init_term() {
-    term *tm = (term *) malloc(sizeof(term));
+    term *tm = (term *) mem_alloc(sizeof(term));
     tm->segm = init_list();
 
     return tm;
 }
 
 block *init_block() {
-    block *bl = (block *) malloc(sizeof(block));
+    block *bl = (block *) mem_alloc(sizeof(block));
     bl->mult = init_list();
     bl->divi = init_list();
 
     return bl;
 }
+
+node *init_node(nd_type type, node *lhs, node *rhs) {
+    node *nd = (node *) mem_alloc(sizeof(node));
+    nd->type = type;
+    nd->nm = nm_none;
+    nd->num = NULL;
+    nd->val = 0;
+    nd->lhs = lhs;
+    nd->rhs = rhs;
+    nd->dep = (type == nd_var) || ((lhs != NULL) && lhs->dep) || ((rhs != NULL) && rhs->dep);
+    nd->simp = NULL;
+    nd->diff = NULL;
+
+    return nd;
+}
@@ -28,12 +28,16 @@
 #ifndef STRUCT_H
 #define STRUCT_H
 
-#define MAX_CHAR 2048
-
 typedef enum {false, true} bool;
 typedef enum {im_bd, ex_bd} bd_type;
 typedef enum {pt_cst, pt_fnc, pt_opr, pt_par, pt_sig, pt_var} ch_type;
 typedef enum {cnst, expo, hypl, loga, poly, powr, trig} fn_type;
+typedef enum {nm_none, nm_sin, nm_cos, nm_tan, nm_csc, nm_sec, nm_cot,
+              nm_sinh, nm_cosh, nm_tanh, nm_csch, nm_sech, nm_coth, nm_ln, nm_log, nm_pi} fn_name;
+typedef enum {nd_add, nd_cst, nd_div, nd_fnc, nd_mul, nd_neg, nd_num, nd_pow, nd_sub, nd_var} nd_type;
+typedef enum {tk_cst, tk_end, tk_fnc, tk_num, tk_opr, tk_par, tk_pow, tk_sig, tk_unk, tk_var} tk_type;
+typedef enum {vm_add, vm_sub, vm_mul, vm_div, vm_neg, vm_pow, vm_sin, vm_cos, vm_tan, vm_csc, vm_sec, vm_cot,
+              vm_sinh, vm_cosh, vm_tanh, vm_csch, vm_sech, vm_coth, vm_ln, vm_log} vm_op;
 
 typedef struct list {
     char *entry;
@@ -53,9 +57,64 @@ typedef struct block {
     struct list *divi;
 } block;
 
+typedef struct token {
+    tk_type type;
+    int pos;                                               // index of the first character
+    int len;
+    int depth;                                             // unclosed '(' before the token
+    bool bd;                                               // a boundary falls on the first character
+    bool delim;                                            // a '+' or '-' delimiting two terms
+} token;
+
+typedef struct tk_seq {
+    int n;                                                 // including the closing tk_end
+    struct token *tk;
+} tk_seq;
+
+typedef struct node {
+    nd_type type;
+    fn_name nm;                                            // function of an nd_fnc; nm_pi or nm_none (e) for an nd_cst
+    char *num;                                             // an nd_num as written
+    double val;                                            // value of an nd_num
+    struct node *lhs;                                      // also the operand of nd_neg and nd_fnc
+    struct node *rhs;
+    bool dep;                                              // depends on x
+    struct node *simp;                                     // simp_node() of the node, once known
+    struct node *diff;                                     // diff_node() of the node, once known
+} node;
+
+typedef struct lexer {
+    char *str;
+    int len;
+    int ind;                                               // start of the next token
+    int par;                                               // unclosed '(' so far
+    int last;                                              // class of the last character other than '*' and '/'
+    bool first;                                            // nothing but '*' and '/' seen so far
+} lexer;
+
+typedef struct par_idx {
+    int len;
+    int *depth;                                            // unclosed '(' before each index
+    int *match;                                            // index of the paired parenthesis, or -1
+} par_idx;
+
+typedef struct vm_ins {
+    vm_op op;
+    int dst;                                               // register written
+    int a;                                                 // registers read; vm_neg and functions only read a
+    int b;
+} vm_ins;
+
+typedef struct str_bld {
+    char *str;                                             // always terminated
+    size_t len;                                            // strlen(str), kept so appends skip the scan
+    size_t cap;                                            // bytes usable at str
+} str_bld;
+
 list *init_list();
 term *init_term();
 comp *init_comp();
 block *init_block();
+node *init_node(nd_type type, node *lhs, node *rhs);
 
 #endif
@@ -0,0 +1,736 @@
+/*
+ * check.c
+ * Tests of the library, the ring server and the socket server, run by make check
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <dlfcn.h>    // dlclose()
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "derivative.h"
+#include "struct.h"
+
+#define CK_CASES 1024
+#define CK_OUT (1 << 16)                                   // room for every derivative of the tests
+#define CK_PTS 64                                          // points of the value tests
+#define CK_GRID 1000
+#define CK_BUILD 16                                        // programs compiled with deriv_build()
+#define CK_RING_DATA 4064                                  // RING_DATA of ring.c
+#define CK_SLOW 3.0                                        // seconds a limited request may take at most
+
+typedef struct ck_case {
+    char *expr;
+    char *tree;                                            // derivative by the default engine, or "error: ..."
+    char *str;                                             // the same by the string engine
+    deriv_prog *prog;                                      // expr compiled with DERIV_FUNC, or NULL
+} ck_case;
+
+static ck_case cases[CK_CASES];
+static int n_case = 0;
+static int n_fail = 0;
+static const char *bin;                                    // the derivative program
+
+static double pts[CK_PTS];
+static double *ref;                                        // df and f at pts by the scalar kernels, per case
+static float *ref_f;                                       // the same in single precision
+
+/* Prints the result of a test of cnt items, bad of which failed. */
+static void ck_report(const char *name, int bad, int cnt) {
+    if (bad == 0) {
+        printf("ok    %s (%d)\n", name, cnt);
+    } else {
+        printf("FAIL  %s: %d of %d\n", name, bad, cnt);
+        n_fail++;
+    }
+}
+
+/* Prints the result of a call expected to fail with want, which took sec seconds. */
+static void ck_code(const char *name, long got, long want, double sec) {
+    if ((got == want) && (sec <= CK_SLOW)) {
+        printf("ok    %s\n", name);
+    } else {
+        printf("FAIL  %s: %ld (%s) after %.2f s\n", name, got, (got < 0) ? deriv_strerror(got) : "no error", sec);
+        n_fail++;
+    }
+}
+
+/* Seconds since the first call. */
+static double ck_now(void) {
+    static struct timespec t_0;
+    struct timespec t;
+    if (t_0.tv_sec == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &t_0);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (double) (t.tv_sec - t_0.tv_sec) + (double) (t.tv_nsec - t_0.tv_nsec) / 1e9;
+}
+
+/* Whether a and b are the same double, any nan matching any other. */
+static bool ck_same(double a, double b) {
+    return (isnan(a) && isnan(b)) || (memcmp(&a, &b, sizeof(a)) == 0);
+}
+
+/* Whether a and b are the same float, any nan matching any other. */
+static bool ck_same_f(float a, float b) {
+    return (isnan(a) && isnan(b)) || (memcmp(&a, &b, sizeof(a)) == 0);
+}
+
+/* Whether a and b agree to the rounding of two differently written formulas. */
+static bool ck_close(double a, double b) {
+    return fabs(a - b) <= 1e-6 * fmax(1, fmax(fabs(a), fabs(b)));
+}
+
+/* Writes the result rc of a derivation into out as the program prints it. */
+static char *ck_text(long rc, char *out) {
+    if (rc < 0) {
+        snprintf(out, CK_OUT, "error: %s", deriv_strerror(rc));
+    }
+    return out;
+}
+
+/* Returns fn(fn(...fn(x)...)), nested depth times. */
+static char *ck_nest(const char *fn, int depth) {
+    size_t n_fn = strlen(fn);
+    char *str = (char *) malloc((n_fn + 2) * depth + 2);
+    char *pt = str;
+    int ind;
+
+    for (ind = 0; ind < depth; ind++) {
+        memcpy(pt, fn, n_fn);
+        pt += n_fn;
+        *pt++ = '(';
+    }
+    *pt++ = 'x';
+    memset(pt, ')', depth);
+    pt[depth] = 0;
+    return str;
+}
+
+/* Returns sin(1*x+1)*sin(2*x+2)*... with cnt factors. */
+static char *ck_prod(int cnt) {
+    char *str = (char *) malloc(32 * cnt);
+    size_t len = 0;
+    int ind;
+
+    for (ind = 1; ind <= cnt; ind++) {
+        len += sprintf(str + len, "%ssin(%d*x+%d)", (ind > 1) ? "*" : "", ind, ind);
+    }
+    return str;
+}
+
+/* Reads the cases of path, one "expression<tab>derivative<tab>derivative by -S" per line. */
+static void ck_load(const char *path) {
+    FILE *in = fopen(path, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    int err;
+
+    if (in == NULL) {
+        perror(path);
+        exit(1);
+    }
+    while (((len = getline(&line, &cap, in)) > 0) && (n_case < CK_CASES)) {
+        if (line[len - 1] == '\n') {
+            line[len - 1] = 0;
+        }
+        char *tree = strchr(line, '\t');
+        char *str = (tree != NULL) ? strchr(tree + 1, '\t') : NULL;
+        if (str == NULL) {
+            continue;
+        }
+        *tree++ = 0;
+        *str++ = 0;
+        cases[n_case].expr = strdup(line);
+        cases[n_case].tree = strdup(tree);
+        cases[n_case].str = strdup(str);
+        cases[n_case].prog = deriv_compile(line, strlen(line), DERIV_FUNC, &err);
+        n_case++;
+    }
+    free(line);
+    fclose(in);
+}
+
+/* Evaluates every case at pts with the kernels picked in this process, into df and f, then dff and ff. */
+static void ck_eval(double *df, double *f, float *dff, float *ff) {
+    float pts_f[CK_PTS];
+    int ind;
+
+    for (ind = 0; ind < CK_PTS; ind++) {
+        pts_f[ind] = (float) pts[ind];
+    }
+    for (ind = 0; ind < n_case; ind++) {
+        if (cases[ind].prog != NULL) {
+            deriv_eval(cases[ind].prog, pts, CK_PTS, df + ind * CK_PTS, f + ind * CK_PTS);
+            deriv_evalf(cases[ind].prog, pts_f, CK_PTS, dff + ind * CK_PTS, ff + ind * CK_PTS);
+        }
+    }
+}
+
+/*
+ * Computes the reference values with the scalar kernels. The kernels are picked once per process,
+ * at the first evaluation, so the reference comes from a child that caps them before it.
+ */
+static void ck_scalar(void) {
+    size_t n = (size_t) n_case * CK_PTS;
+    ref = (double *) calloc(2 * n, sizeof(double));
+    ref_f = (float *) calloc(2 * n, sizeof(float));
+
+    FILE *tmp = tmpfile();
+    pid_t pid = fork();
+    if (pid == 0) {
+        setenv("DERIV_SIMD", "scalar", 1);
+        ck_eval(ref, ref + n, ref_f, ref_f + n);
+        fwrite(ref, sizeof(double), 2 * n, tmp);
+        fwrite(ref_f, sizeof(float), 2 * n, tmp);
+        fflush(tmp);
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    rewind(tmp);
+    if ((fread(ref, sizeof(double), 2 * n, tmp) != 2 * n) || (fread(ref_f, sizeof(float), 2 * n, tmp) != 2 * n)) {
+        fprintf(stderr, "check: no reference values\n");
+        exit(1);
+    }
+    fclose(tmp);
+}
+
+/* Central difference of the function of prog at x with step h. */
+static double ck_diff(const deriv_prog *prog, double x, double h) {
+    double at[2] = {x - h, x + h}, df[2], f[2];
+    deriv_eval(prog, at, 2, df, f);
+    return (f[1] - f[0]) / (2 * h);
+}
+
+/*
+ * Whether the derivative of cs, as compiled and as printed by the default engine, agrees with the
+ * string engine at the first 16 points, or else with finite differences of the function. *off
+ * tells whether the string engine was off or gave a result the parser does not take.
+ */
+static bool ck_agree(ck_case *cs, bool *off) {
+    double df[16], f_tree[16], f_str[16], tmp[16];
+    int i, err;
+
+    deriv_prog *p_tree = deriv_compile(cs->tree, strlen(cs->tree), DERIV_FUNC, &err);
+    deriv_prog *p_str = deriv_compile(cs->str, strlen(cs->str), DERIV_FUNC, &err);
+    bool ok = (p_tree != NULL);
+    *off = (p_str == NULL);
+    if (ok) {
+        deriv_eval(cs->prog, pts, 16, df, tmp);
+        deriv_eval(p_tree, pts, 16, tmp, f_tree);
+        if (p_str != NULL) {
+            deriv_eval(p_str, pts, 16, tmp, f_str);
+        }
+    }
+
+    for (i = 0; ok && (i < 16); i++) {
+        if (!isfinite(df[i]) || (fabs(df[i]) > 1e8)) {
+            continue;
+        }
+        if (!ck_close(df[i], f_tree[i])) {
+            printf("      %s at %g: %.17g, printed %.17g\n", cs->expr, pts[i], df[i], f_tree[i]);
+            ok = false;
+        } else if ((p_str == NULL) || !ck_close(df[i], f_str[i])) {
+            double h = 1e-4 * fmax(1, fabs(pts[i]));
+            double fd_1 = ck_diff(cs->prog, pts[i], h), fd_2 = ck_diff(cs->prog, pts[i], h / 4);
+            double fd = fd_2 + (fd_2 - fd_1) / 15;         // Richardson extrapolation of the two
+            *off = true;
+            if (fabs(fd_1 - fd_2) > 1e-3 * fmax(1, fabs(fd_2))) {
+                continue;                                  // near a pole, where differences say nothing
+            }
+            if (fabs(df[i] - fd) > 1e-4 * fmax(1, fabs(fd))) {
+                printf("      %s at %g: %.17g, finite differences %.17g\n", cs->expr, pts[i], df[i], fd);
+                ok = false;
+            }
+        }
+    }
+
+    deriv_prog_free(p_tree);
+    deriv_prog_free(p_str);
+    return ok;
+}
+
+/* Compares both engines with the expected derivatives, and with each other at a few points. */
+static void ck_engines(void) {
+    deriv_ctx *tree = deriv_new(0);
+    deriv_ctx *str = deriv_new(DERIV_STRING);
+    char *out = (char *) malloc(CK_OUT);
+    int bad_tree = 0, bad_str = 0, bad_num = 0, n_num = 0, n_off = 0;
+    int ind;
+    bool off;
+
+    for (ind = 0; ind < n_case; ind++) {
+        ck_case *cs = cases + ind;
+        long rc = deriv_differentiate(tree, cs->expr, strlen(cs->expr), out, CK_OUT);
+        if (strcmp(ck_text(rc, out), cs->tree) != 0) {
+            printf("      %s\n        got  %s\n        want %s\n", cs->expr, out, cs->tree);
+            bad_tree++;
+        }
+        rc = deriv_differentiate(str, cs->expr, strlen(cs->expr), out, CK_OUT);
+        if (strcmp(ck_text(rc, out), cs->str) != 0) {
+            printf("      %s -S\n        got  %s\n        want %s\n", cs->expr, out, cs->str);
+            bad_str++;
+        }
+
+        if ((cs->prog == NULL) || (strncmp(cs->tree, "error: ", 7) == 0)) {
+            continue;
+        }
+        n_num++;
+        if (!ck_agree(cs, &off)) {
+            bad_num++;
+        }
+        n_off += off;
+    }
+
+    ck_report("default engine, expected derivatives", bad_tree, n_case);
+    ck_report("string engine, expected derivatives", bad_str, n_case);
+    ck_report("default engine against the string engine, values", bad_num, n_num);
+    printf("      of them %d where the string engine is off, by finite differences\n", n_off);
+    free(out);
+    deriv_free(tree);
+    deriv_free(str);
+}
+
+/* Cancels the request of the context arg after 100 ms. */
+static void *ck_cancel(void *arg) {
+    usleep(100000);
+    deriv_cancel((deriv_ctx *) arg);
+    return NULL;
+}
+
+/* Makes every call fail with its DERIV_E* code; the ring's DERIV_ESPACE and DERIV_ESHUT are in ck_ring(). */
+static void ck_errors(void) {
+    deriv_ctx *ctx = deriv_new(0);
+    char *out = (char *) malloc(CK_OUT);
+    char *deep = ck_nest("sin", 8000);
+    double t_0;
+    long rc;
+
+    ck_code("DERIV_EPAREN", deriv_differentiate(ctx, "(x", 2, out, CK_OUT), DERIV_EPAREN, 0);
+    ck_code("DERIV_EINVAL", deriv_differentiate(ctx, "sqrt", 4, out, CK_OUT), DERIV_EINVAL, 0);
+    ck_code("DERIV_ENOMEM", deriv_differentiate(NULL, "x", 1, out, CK_OUT), DERIV_ENOMEM, 0);
+
+    const char input[] = "sin(x)x^2";
+    size_t off[3] = {0, 6, 9};
+    long stat[2];
+    size_t out_off[2];
+    char *small = out;
+    deriv_bulk(ctx, input, off, 2, &small, 8, out_off, stat);
+    ck_code("DERIV_ESPACE", stat[1], DERIV_ESPACE, 0);
+
+    deriv_limit(ctx, 0.2, 0);
+    t_0 = ck_now();
+    rc = deriv_differentiate(ctx, deep, strlen(deep), out, CK_OUT);
+    ck_code("DERIV_ETIME", rc, DERIV_ETIME, ck_now() - t_0);
+
+    deriv_limit(ctx, 0, 1 << 20);
+    t_0 = ck_now();
+    rc = deriv_differentiate(ctx, deep, strlen(deep), out, CK_OUT);
+    ck_code("DERIV_ELIMIT", rc, DERIV_ELIMIT, ck_now() - t_0);
+
+    deriv_limit(ctx, 0, 0);
+    pthread_t thr;
+    pthread_create(&thr, NULL, ck_cancel, ctx);
+    t_0 = ck_now();
+    rc = deriv_differentiate(ctx, deep, strlen(deep), out, CK_OUT);
+    ck_code("DERIV_ECANCEL", rc, DERIV_ECANCEL, ck_now() - t_0);
+    pthread_join(thr, NULL);
+
+    char *deeper = ck_nest("", 400000);
+    t_0 = ck_now();
+    rc = deriv_differentiate(ctx, deeper, strlen(deeper), out, CK_OUT);
+    ck_code("DERIV_EDEEP", rc, DERIV_EDEEP, ck_now() - t_0);
+    free(deeper);
+
+    char *cc = getenv("CC");
+    cc = (cc != NULL) ? strdup(cc) : NULL;
+    setenv("CC", "false", 1);
+    ck_code("DERIV_EBUILD", deriv_build(cases[0].prog, "ck", "/tmp/deriv-check.so"), DERIV_EBUILD, 0);
+    if (cc != NULL) {
+        setenv("CC", cc, 1);
+        free(cc);
+    } else {
+        unsetenv("CC");
+    }
+
+    free(deep);
+    free(out);
+    deriv_free(ctx);
+}
+
+/* Runs cases through deriv_bulk() under a memory limit one item exceeds, which must not upset the others. */
+static void ck_bulk(void) {
+    deriv_ctx *ctx = deriv_new(0);
+    char *deep = ck_nest("sin", 4000);
+    size_t len = strlen(deep), n = (size_t) n_case + 1, ind;
+    char *input = (char *) malloc(len + 64 * n);
+    size_t *off = (size_t *) malloc((n + 1) * sizeof(size_t));
+    size_t *out_off = (size_t *) malloc(n * sizeof(size_t));
+    long *stat = (long *) malloc(n * sizeof(long));
+    char *out = NULL, *txt = (char *) malloc(CK_OUT);
+    int bad = 0;
+
+    off[0] = 0;
+    for (ind = 0; ind < n; ind++) {
+        const char *item = (ind == n / 2) ? deep : cases[(ind < n / 2) ? ind : ind - 1].expr;
+        memcpy(input + off[ind], item, strlen(item));
+        off[ind + 1] = off[ind] + strlen(item);
+    }
+
+    char elimit[64];
+    snprintf(elimit, sizeof(elimit), "error: %s", deriv_strerror(DERIV_ELIMIT));
+    deriv_limit(ctx, 0, 1 << 20);
+    deriv_bulk(ctx, input, off, n, &out, 0, out_off, stat);
+    for (ind = 0; ind < n; ind++) {
+        const char *want = (ind == n / 2) ? elimit : cases[(ind < n / 2) ? ind : ind - 1].tree;
+        strcpy(txt, out + out_off[ind]);
+        if (strcmp(ck_text(stat[ind], txt), want) != 0) {
+            printf("      item %zu: %s, not %s\n", ind, txt, want);
+            bad++;
+        }
+    }
+    ck_report("deriv_bulk() around a request over the memory limit", bad, (int) n);
+
+    free(txt);
+    free(stat);
+    free(out_off);
+    free(off);
+    free(input);
+    free(deep);
+    deriv_free(ctx);
+}
+
+/* Starts the derivative program with option opt arg and two threads. */
+static pid_t ck_spawn(const char *opt, const char *arg) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl(bin, bin, opt, arg, "-j", "2", (char *) NULL);
+        perror(bin);
+        _exit(127);
+    }
+    return pid;
+}
+
+/* Stops a server started by ck_spawn(). */
+static void ck_stop(pid_t pid) {
+    int status;
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+}
+
+/* Sends the cases and a long product to a ring server, then calls it once more after it quit. */
+static void ck_ring(const char *prod, const char *prod_df) {
+    char name[64];
+    snprintf(name, sizeof(name), "/deriv-check-%d", (int) getpid());
+    pid_t pid = ck_spawn("-r", name);
+    deriv_ring *ring = NULL;
+    int ind, bad = 0;
+
+    for (ind = 0; (ind < 500) && (ring == NULL); ind++) {
+        if ((ring = deriv_ring_open(name)) == NULL) {
+            usleep(10000);
+        }
+    }
+    if (ring == NULL) {
+        ck_report("ring server, no ring", 1, 1);
+        ck_stop(pid);
+        return;
+    }
+
+    char *out = (char *) malloc(CK_OUT);
+    for (ind = 0; ind < n_case; ind++) {
+        long rc = deriv_ring_call(ring, cases[ind].expr, strlen(cases[ind].expr), out, CK_OUT);
+        if (strcmp(ck_text(rc, out), cases[ind].tree) != 0) {
+            printf("      %s\n        got  %s\n        want %s\n", cases[ind].expr, out, cases[ind].tree);
+            bad++;
+        }
+    }
+    ck_report("ring server, expected derivatives", bad, n_case);
+
+    long rc = deriv_ring_call(ring, prod, strlen(prod), out, CK_OUT);
+    long want = (strlen(prod_df) >= CK_RING_DATA) ? DERIV_ESPACE : (long) strlen(prod_df);
+    ck_code("ring server, derivative past a slot: DERIV_ESPACE", rc, want, 0);
+    char *wide = ck_prod(400);                             // past a slot already as input
+    ck_code("ring server, input past a slot: DERIV_ESPACE", deriv_ring_call(ring, wide, strlen(wide), out, CK_OUT), DERIV_ESPACE, 0);
+    free(wide);
+
+    ck_stop(pid);
+    ck_code("DERIV_ESHUT", deriv_ring_call(ring, "x", 1, out, CK_OUT), DERIV_ESHUT, 0);
+    deriv_ring_close(ring);
+    free(out);
+}
+
+typedef struct ck_conn {
+    int fd;
+    const char *prod;
+} ck_conn;
+
+/* Writes a request per case and one for the long product, then ends the connection's input. */
+static void *ck_send(void *arg) {
+    ck_conn *conn = (ck_conn *) arg;
+    char *req = (char *) malloc(CK_OUT);
+    int ind;
+
+    for (ind = 0; ind <= n_case; ind++) {
+        int len = snprintf(req, CK_OUT, "{\"id\": %d, \"expr\": \"%s\"}\n", ind, (ind < n_case) ? cases[ind].expr : conn->prod);
+        char *pt = req;
+        while (len > 0) {
+            ssize_t done = write(conn->fd, pt, len);
+            if (done <= 0) {
+                break;
+            }
+            pt += done;
+            len -= done;
+        }
+    }
+    shutdown(conn->fd, SHUT_WR);
+    free(req);
+    return NULL;
+}
+
+/* Copies the JSON string value of key in rsp, unquoted, to out; returns false for null or no key. */
+static bool ck_field(const char *rsp, const char *key, char *out) {
+    const char *pt = strstr(rsp, key);
+    if ((pt == NULL) || (pt[strlen(key)] != '"')) {
+        return false;
+    }
+    for (pt += strlen(key) + 1; (*pt != '"') && (*pt != 0); pt++) {
+        if ((*pt == '\\') && (pt[1] != 0)) {
+            pt++;
+        }
+        *out++ = *pt;
+    }
+    *out = 0;
+    return true;
+}
+
+/* Pipelines the cases and the long product to a socket server and checks every answer. */
+static void ck_server(const char *prod, const char *prod_df) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/deriv-check-%d.sock", (int) getpid());
+    pid_t pid = ck_spawn("-u", addr.sun_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0), ind;
+
+    for (ind = 0; ind < 500; ind++) {
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+            break;
+        }
+        usleep(10000);
+    }
+    if (ind == 500) {
+        ck_report("socket server, no connection", 1, 1);
+        close(fd);
+        ck_stop(pid);
+        return;
+    }
+
+    ck_conn conn = {fd, prod};
+    pthread_t thr;
+    pthread_create(&thr, NULL, ck_send, &conn);
+
+    size_t cap = CK_OUT, len = 0;
+    char *buf = (char *) malloc(cap);
+    ssize_t got;
+    while ((got = read(fd, buf + len, cap - len - 1)) > 0) {
+        len += got;
+        if (cap - len < 4096) {
+            buf = (char *) realloc(buf, cap *= 2);
+        }
+    }
+    buf[len] = 0;
+    pthread_join(thr, NULL);
+    close(fd);
+    ck_stop(pid);
+
+    char *seen = (char *) calloc(n_case + 1, 1);
+    char *out = (char *) malloc(CK_OUT);
+    int bad = 0;
+    char *line, *save;
+    for (line = strtok_r(buf, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+        int id = -1;
+        if ((sscanf(line, "{\"id\":%d", &id) != 1) || (id < 0) || (id > n_case) || seen[id]) {
+            printf("      bad response %.80s\n", line);
+            bad++;
+            continue;
+        }
+        seen[id] = 1;
+        if (!ck_field(line, "\"derivative\":", out)) {
+            strcpy(out, "error: ");
+            ck_field(line, "\"error\":", out + 7);
+        }
+        const char *want = (id < n_case) ? cases[id].tree : prod_df;
+        if (strcmp(out, want) != 0) {
+            printf("      %s\n        got  %.200s\n        want %.200s\n", (id < n_case) ? cases[id].expr : "long product", out, want);
+            bad++;
+        }
+    }
+    for (ind = 0; ind <= n_case; ind++) {
+        bad += !seen[ind];
+    }
+    ck_report("socket server, pipelined derivatives past a ring slot", bad, n_case + 1);
+
+    free(out);
+    free(seen);
+    free(buf);
+}
+
+/* Compares the SIMD kernels, the JIT, deriv_grid() and deriv_build() with the scalar kernels. */
+static void ck_values(void) {
+    size_t n = (size_t) n_case * CK_PTS;
+    double *df = (double *) malloc(2 * n * sizeof(double));
+    float *dff = (float *) malloc(2 * n * sizeof(float));
+    int bad_vm = 0, bad_f = 0, bad_jit = 0, bad_grid = 0, bad_cc = 0, n_prog = 0, n_jit = 0, n_cc = 0;
+    int ind, i;
+
+    ck_eval(df, df + n, dff, dff + n);
+    for (ind = 0; ind < n_case; ind++) {
+        if (cases[ind].prog == NULL) {
+            continue;
+        }
+        n_prog++;
+        size_t at = (size_t) ind * CK_PTS;
+        for (i = 0; i < CK_PTS; i++) {
+            if (!ck_same(df[at + i], ref[at + i]) || !ck_same(df[n + at + i], ref[n + at + i])) {
+                printf("      %s at %g: %.17g, scalar %.17g\n", cases[ind].expr, pts[i], df[at + i], ref[at + i]);
+                bad_vm++;
+                break;
+            }
+        }
+        for (i = 0; i < CK_PTS; i++) {
+            if (!ck_same_f(dff[at + i], ref_f[at + i]) || !ck_same_f(dff[n + at + i], ref_f[n + at + i])) {
+                printf("      %s at %g: %.9g, scalar %.9g\n", cases[ind].expr, pts[i], dff[at + i], ref_f[at + i]);
+                bad_f++;
+                break;
+            }
+        }
+
+        deriv_fn fn_df = deriv_jit(cases[ind].prog, 0);
+        deriv_fn fn_f = deriv_jit(cases[ind].prog, 1);
+        if ((fn_df != NULL) && (fn_f != NULL)) {
+            n_jit++;
+            for (i = 0; i < CK_PTS; i++) {
+                if (!ck_same(fn_df(pts[i]), ref[at + i]) || !ck_same(fn_f(pts[i]), ref[n + at + i])) {
+                    printf("      %s at %g: %.17g, scalar %.17g\n", cases[ind].expr, pts[i], fn_df(pts[i]), ref[at + i]);
+                    bad_jit++;
+                    break;
+                }
+            }
+        }
+
+        double g_df[CK_GRID], g_f[CK_GRID], x[CK_GRID], e_df[CK_GRID], e_f[CK_GRID];
+        double h = 4.0 / (CK_GRID - 1);
+        for (i = 0; i < CK_GRID; i++) {
+            x[i] = -2 + (double) i * h;
+        }
+        x[CK_GRID - 1] = 2;
+        deriv_grid(cases[ind].prog, -2, 2, 0, CK_GRID, 3, g_df, g_f);
+        deriv_eval(cases[ind].prog, x, CK_GRID, e_df, e_f);
+        for (i = 0; i < CK_GRID; i++) {
+            if (!ck_same(g_df[i], e_df[i]) || !ck_same(g_f[i], e_f[i])) {
+                printf("      %s at %g: %.17g, deriv_eval() %.17g\n", cases[ind].expr, x[i], g_df[i], e_df[i]);
+                bad_grid++;
+                break;
+            }
+        }
+
+        if (n_cc < CK_BUILD) {
+            char path[64];
+            deriv_fn so_df, so_f;
+            snprintf(path, sizeof(path), "/tmp/deriv-check-%d.so", (int) getpid());
+            void *so = (deriv_build(cases[ind].prog, "ck", path) == 0) ? deriv_load(path, "ck", &so_df, &so_f) : NULL;
+            unlink(path);
+            n_cc++;
+            if (so == NULL) {
+                printf("      %s: not built\n", cases[ind].expr);
+                bad_cc++;
+                continue;
+            }
+            for (i = 0; i < CK_PTS; i++) {
+                if (!ck_same(so_df(pts[i]), ref[at + i]) || !ck_same(so_f(pts[i]), ref[n + at + i])) {
+                    printf("      %s at %g: %.17g, scalar %.17g\n", cases[ind].expr, pts[i], so_df(pts[i]), ref[at + i]);
+                    bad_cc++;
+                    break;
+                }
+            }
+            dlclose(so);
+        }
+    }
+
+    ck_report("deriv_eval() against the scalar kernels", bad_vm, n_prog);
+    ck_report("deriv_evalf() against the scalar kernels", bad_f, n_prog);
+    ck_report("deriv_jit() against the scalar kernels", bad_jit, n_jit);
+    ck_report("deriv_grid() against deriv_eval()", bad_grid, n_prog);
+    ck_report("deriv_build() against the scalar kernels", bad_cc, n_cc);
+    free(dff);
+    free(df);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s derivative test/derivs.txt\n", argv[0]);
+        return 1;
+    }
+    bin = argv[1];
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    int ind;
+    for (ind = 0; ind < CK_PTS - 8; ind++) {
+        pts[ind] = -3.1 + 0.113 * ind;
+    }
+    double special[8] = {0.0, -0.0, 1e-300, 1e300, INFINITY, -INFINITY, NAN, M_PI / 2};
+    memcpy(pts + CK_PTS - 8, special, sizeof(special));
+
+    ck_load(argv[2]);
+    ck_scalar();                                           // before any evaluation here picks the kernels
+
+    char *prod = ck_prod(40);
+    char *prod_df = (char *) malloc(CK_OUT);
+    deriv_ctx *ctx = deriv_new(0);
+    ck_text(deriv_differentiate(ctx, prod, strlen(prod), prod_df, CK_OUT), prod_df);
+    deriv_free(ctx);
+
+    ck_engines();
+    ck_errors();
+    ck_bulk();
+    ck_ring(prod, prod_df);
+    ck_server(prod, prod_df);
+    ck_values();
+
+    printf("%s\n", (n_fail == 0) ? "all tests passed" : "some tests failed");
+    return (n_fail == 0) ? 0 : 1;
+}
@@ -27,9 +27,38 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include "gov.h"
+#include "lex.h"
+#include "mem.h"
 #include "struct.h"
 #include "utility.h"
 
+/* Appends src to the builder, doubling its capacity when it runs out; the text stays terminated. */
+void bld_cat(str_bld *bld, char *src) {
+    size_t n = strlen(src);
+
+    if (bld->len + n + 1 > bld->cap) {
+        size_t cap = 2 * bld->cap;
+        if (cap < bld->len + n + 1) {
+            cap = bld->len + n + 1;
+        }
+        bld->str = (char *) mem_grow(bld->str, bld->len + 1, cap);
+        bld->cap = cap;
+    }
+    memcpy(bld->str + bld->len, src, n + 1);
+    bld->len += n;
+}
+
+/* Starts a builder holding a copy of str. */
+str_bld bld_new(char *str) {
+    str_bld bld;
+    bld.len = strlen(str);
+    bld.cap = bld.len + 1;
+    bld.str = str_ndup(str, bld.len);
+
+    return bld;
+}
+
 /* Determines whether the constant parameter has trailing decimals. */
 bool has_dec(char *str) {
     if ((strpbrk(str, ".") != NULL) || (strpbrk(str, "/") != NULL) ||
@@ -43,18 +72,16 @@ bool has_dec(char *str) {
 
 /* Determines whether str contains a function. */
 bool has_func(char *str) {
-    if ((strstr(str, "^") != NULL) || (strstr(str, "ln") != NULL) ||
-        (strstr(str, "log") != NULL) || (strstr(str, "sin") != NULL) || 
-        (strstr(str, "cos") != NULL) || (strstr(str, "tan") != NULL) || 
-        (strstr(str, "csc") != NULL) || (strstr(str, "sec") != NULL) || 
-        (strstr(str, "cot") != NULL) || (strstr(str, "sinh") != NULL) || 
-        (strstr(str, "cosh") != NULL) || (strstr(str, "tanh") != NULL) || 
-        (strstr(str, "csch") != NULL) || (strstr(str, "sech") != NULL) || 
-        (strstr(str, "coth") != NULL)) {
-        return true;
-    } else {
-        return false;
+    fn_name nm;
+    while (*str != 0) {
+        if (*str == '^') {
+            return true;
+        } else if ((nm_len(str, &nm) != 0) && (nm != nm_pi)) {
+            return true;
+        }
+        str++;
     }
+    return false;
 }
 
 /* Determines whether any node in a list contains the variable x. */
@@ -97,26 +124,16 @@ ch_type id_ch_tp(char ch) {
 
 /* Identifies the type of the outer-most function. */
 fn_type id_fn_tp(char *str) {
-    char *str_cpy = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-    strcpy(str_cpy, str);                                  // to avoid modifying the original str
+    char *str_cpy = str_dup(str);                          // to avoid modifying the original str
 
-    while (par_enclosed(str_cpy)) {
-        str_cpy = rm_par(str_cpy);
-    }
+    str_cpy = strip_par(str_cpy);
 
     char *pt = strpbrk(str_cpy, "x");
     if (pt == NULL) {
         return cnst;
     }
 
-    pt = strpbrk(str_cpy, "^");
-    while (pt != NULL) {
-        if (!par_paired(str_cpy, pt - str_cpy)) {
-            pt = strpbrk(pt + 1, "^");
-        } else {
-            break;
-        }
-    }
+    pt = top_pbrk(str_cpy, "^");
 
     if (pt != NULL) {                                      // has '^'
         if (strpbrk(pt, "x") != NULL) {                    // x appears after the '^'
@@ -127,9 +144,7 @@ fn_type id_fn_tp(char *str) {
             if (id_ch_tp(str_cpy[0]) == pt_sig) {
                 str_cpy++;
             }
-            while (par_enclosed(str_cpy)) {                // str truncated
-                str_cpy = rm_par(str_cpy);
-            }
+            str_cpy = strip_par(str_cpy);                  // str truncated
 
             if (strpbrk(str_cpy, "x") == NULL) {           // no x found
                 return cnst;
@@ -142,26 +157,14 @@ fn_type id_fn_tp(char *str) {
             }
         }
     } else {                                               // no '^'
-        while (par_enclosed(str_cpy)) {
-            str_cpy = rm_par(str_cpy);
-        }
+        str_cpy = strip_par(str_cpy);
 
-        pt = strpbrk(str_cpy, "lsct");
-        while (!par_paired(str_cpy, pt - str_cpy)) {
-            pt = strpbrk(pt + 1, "lsct");
-        }
+        pt = top_pbrk(str_cpy, "lsct");
 
         if (pt != NULL) {
-            if ((strncmp(pt, "ln", 2) == 0) || (strncmp(pt, "log", 3) == 0)) {
-                return loga;
-            } else if ((strncmp(pt, "sinh", 4) == 0) || (strncmp(pt, "cosh", 4) == 0) ||
-                       (strncmp(pt, "tanh", 4) == 0) || (strncmp(pt, "csch", 4) == 0) ||
-                       (strncmp(pt, "sech", 4) == 0) || (strncmp(pt, "coth", 4) == 0)) {
-                return hypl;
-            } else if ((strncmp(pt, "sin", 3) == 0) || (strncmp(pt, "cos", 3) == 0) ||
-                       (strncmp(pt, "tan", 3) == 0) || (strncmp(pt, "csc", 3) == 0) ||
-                       (strncmp(pt, "sec", 3) == 0) || (strncmp(pt, "cot", 3) == 0)) {
-                return trig;
+            fn_name nm;
+            if (nm_len(pt, &nm) != 0) {
+                return id_nm_tp(nm);
             }
         } else {
             return poly;
@@ -169,6 +172,37 @@ fn_type id_fn_tp(char *str) {
     }
 }
 
+/* Indexes the parentheses of str in a single pass. */
+par_idx *index_par(char *str) {
+    int len = strlen(str);
+    par_idx *idx = (par_idx *) mem_alloc(sizeof(par_idx));
+    idx->len = len;
+    idx->depth = (int *) mem_alloc(sizeof(int) * (len + 1));
+    idx->match = (int *) mem_alloc(sizeof(int) * (len + 1));
+
+    int *open = (int *) mem_alloc(sizeof(int) * (len + 1));  // stack of unmatched '('
+    int ind, top = 0, par = 0;
+    for (ind = 0; ind < len; ind++) {
+        idx->depth[ind] = par;
+        idx->match[ind] = -1;
+
+        if (str[ind] == '(') {
+            open[top++] = ind;
+            par++;
+        } else if (str[ind] == ')') {
+            if (top > 0) {
+                idx->match[ind] = open[--top];
+                idx->match[idx->match[ind]] = ind;
+            }
+            par--;
+        }
+    }
+    idx->depth[len] = par;
+    idx->match[len] = -1;
+
+    return idx;
+}
+
 /* Converts an integer to a str. */
 char *int_str(int n) {
     bool neg;
@@ -180,7 +214,7 @@ char *int_str(int n) {
     }
 
     char *pt;
-    char *str = (char *) malloc(sizeof(char) * 128);
+    char *str = (char *) mem_alloc(sizeof(char) * 128);
     if (neg) {
         strcpy(str, "-");
         pt = str + 1;
@@ -220,8 +254,46 @@ int n_list(list* ls) {
     return n;
 }
 
+/*
+ * Counts the pairs of redundant parentheses enclosing str, the ones par_enclosed() would find
+ * stripping them one by one, in a single scan. Pair j (from 0) is redundant when the running
+ * count of open parentheses stays above j from str[j] to just before its closing one, so the
+ * minimum over the innermost candidate's span is taken first and widened pair by pair.
+ */
+int n_par(char *str) {
+    gov_check();
+
+    int len = strlen(str), lvl = 0, ind;
+    while ((2 * (lvl + 1) <= len) && (str[lvl] == '(') && (str[len - 1 - lvl] == ')')) {
+        lvl++;
+    }
+    if (lvl == 0) {
+        return 0;
+    }
+
+    int par = lvl - 1, low = len;                          // open count before str[lvl - 1]
+    for (ind = lvl - 1; ind <= len - 1 - lvl; ind++) {
+        par += (str[ind] == '(') ? 1 : ((str[ind] == ')') ? -1 : 0);
+        low = (par < low) ? par : low;
+    }
+
+    int cnt = lvl, j;
+    for (j = lvl - 1; j >= 0; j--) {
+        if (j < lvl - 1) {                                 // the span gains str[j] and one more ')'
+            low = (j + 1 < low) ? j + 1 : low;
+            low = (par - (lvl - 1 - j) < low) ? par - (lvl - 1 - j) : low;
+        }
+        if (low <= j) {
+            cnt = j;
+        }
+    }
+    return cnt;
+}
+
 /* Examines whether str is redundantly enclosed by parentheses. */
 bool par_enclosed(char *str) {
+    gov_check();
+
     if (str[0] == '(') {
         int len = strlen(str);
         if (str[len - 1] == ')') {
@@ -273,7 +345,7 @@ list *rev_list(list *ls) {
 
     while (ls != NULL) {
         list *rev = init_list();
-        strcpy(rev->entry, ls->entry);
+        rev->entry = str_dup(ls->entry);
 
         if (rev_curr != NULL) {
             rev->next = rev_curr;
@@ -286,19 +358,24 @@ list *rev_list(list *ls) {
     return rev_curr;
 }
 
-/* Removes a pair of redundant parentheses enclosing str. */
-char *rm_par(char *str) {
-    char *str_cpy = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-    strcpy(str_cpy, str);
+/* Appends src to dst, which grows in place when it is the latest allocation; returns dst. */
+char *str_cat(char *dst, char *src) {
+    size_t len = strlen(dst), n = strlen(src);
+
+    dst = (char *) mem_grow(dst, len + 1, len + n + 1);
+    memcpy(dst + len, src, n + 1);
+
+    return dst;
+}
 
-    str_cpy[strlen(str_cpy) - 1] = 0;
-    return str_cpy + 1;
+/* Copies str into a buffer of its own length. */
+char *str_dup(char *str) {
+    return str_ndup(str, strlen(str));
 }
 
 /* Converts a str into an int. */
 int str_int(char *str) {
-    char *str_cpy = (char *) malloc(sizeof(char) * MAX_CHAR / 8);
-    strcpy(str_cpy, str);
+    char *str_cpy = str_dup(str);
 
     bool neg = false;
     if (str_cpy[0] == '-') {
@@ -319,18 +396,70 @@ int str_int(char *str) {
     }
 }
 
-/* Removes all blank spaces in str. */
-char *wo_space(char *str) {
-    int ind = 0, fill = 0, len = strlen(str);
-    char *rt_str = (char *) malloc(sizeof(char) * MAX_CHAR);
+/* Copies at most the first n characters of str and terminates the copy. */
+char *str_ndup(char *str, size_t n) {
+    n = strnlen(str, n);
+
+    char *str_cpy = (char *) mem_alloc(sizeof(char) * (n + 1));
+    memcpy(str_cpy, str, n);
+
+    return str_cpy;
+}
 
-    while (ind < len) {
-        char ch;
-        if ((ch = str[ind++]) != ' ') {
-            rt_str[fill++] = ch;
+/* Removes every pair of redundant parentheses enclosing str with one copy; str itself if none. */
+char *strip_par(char *str) {
+    int cnt = n_par(str);
+    return (cnt == 0) ? str : str_ndup(str + cnt, strlen(str) - 2 * cnt);
+}
+
+/* Returns the first character of set in str that is not enclosed by parentheses. */
+char *top_pbrk(char *str, char *set) {
+    gov_check();
+
+    int par = 0;
+
+    while (*str != 0) {
+        if ((par == 0) && (strchr(set, *str) != NULL)) {
+            return str;
+        }
+
+        if (*str == '(') {
+            par++;
+        } else if (*str == ')') {
+            par--;
+        }
+        str++;
+    }
+
+    return NULL;
+}
+
+/* Strips, in place, all but the outermost pair of redundant parentheses enclosing str. */
+void trim_par(char *str) {
+    int cnt = n_par(str) - 1;
+    if (cnt > 0) {
+        size_t len = strlen(str) - 2 * cnt;
+        memmove(str, str + cnt, len);
+        str[len] = 0;
+    }
+}
+
+/* Copies the first n characters of str, which need not be terminated, without spaces. */
+char *wo_nspace(char *str, size_t n) {
+    size_t ind, fill = 0;
+    char *rt_str = (char *) mem_alloc(sizeof(char) * (n + 1));
+
+    for (ind = 0; ind < n; ind++) {
+        if (str[ind] != ' ') {
+            rt_str[fill++] = str[ind];
         }
     }
     rt_str[fill] = 0;
 
     return rt_str;
 }
+
+/* Removes all blank spaces in str. */
+char *wo_space(char *str) {
+    return wo_nspace(str, strlen(str));
+}
@@ -28,19 +28,29 @@
 #ifndef UTILITY_H
 #define UTILITY_H
 
+void bld_cat(str_bld *bld, char *src);
+str_bld bld_new(char *str);
 bool has_dec(char *str);
 bool has_func(char *str);
 bool has_var(list *ls);
 bd_type id_bd_tp(char ch);
 ch_type id_ch_tp(char ch);
 fn_type id_fn_tp(char *str);
+par_idx *index_par(char *str);
 char *int_str(int n);
 int n_list(list *ls);
+int n_par(char *str);
 bool par_enclosed(char *str);
 bool par_paired(char *str, int i);
 list *rev_list(list *ls);
-char *rm_par(char *str);
+char *str_cat(char *dst, char *src);
+char *str_dup(char *str);
 int str_int(char *str);
+char *str_ndup(char *str, size_t n);
+char *strip_par(char *str);
+char *top_pbrk(char *str, char *set);
+void trim_par(char *str);
+char *wo_nspace(char *str, size_t n);
 char *wo_space(char *str);
 
 #endif
@@ -0,0 +1,612 @@
+/*
+ * vm.c
+ * Bytecode compiler and interpreter
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "derivative.h"
+#include "jit.h"
+#include "mem.h"
+#include "node.h"
+#include "pool.h"
+#include "simd.h"
+#include "struct.h"
+#include "vm.h"
+
+#define VM_BLOCK 256                                       // x values an instruction is applied to at a time
+#define VM_STACK 8192                                      // doubles of registers kept on the stack
+#define VM_CHUNK 4096                                      // grid points per item of deriv_grid(), 32 KiB of each output
+
+/*
+ * A program is a list of three-address instructions over registers of doubles. Compiling walks
+ * the expression tree once per distinct node, which the interning in node.c already shares, so a
+ * subexpression common to f and f' is computed once; subtrees that do not depend on x are folded
+ * into constant registers. Registers are reused once their last reader has run. The interpreter
+ * applies each instruction to a block of VM_BLOCK points before moving to the next one, so the
+ * dispatch is paid once per block rather than once per point, and the arithmetic of a block runs
+ * in the vector kernels of simd.c.
+ */
+enum {vb_cst, vb_var, vb_ins};
+
+typedef struct vm_bld {
+    node **key;                                            // nodes compiled so far, hashed on the pointer
+    int *id;                                               // value of each key
+    int cap;
+    int cnt;
+    int *tp;                                               // vb_cst, vb_var or vb_ins, for each value
+    double *val;                                           // of a vb_cst
+    int n_val;
+    int cap_val;
+    vm_ins *ins;                                           // over values rather than registers
+    int n_ins;
+    int cap_ins;
+} vm_bld;
+
+/* Applies a function or vm_neg to a. */
+static double vm_fn(vm_op op, double a) {
+    switch (op) {
+        case vm_neg:
+            return -a;
+        case vm_sin:
+            return sin(a);
+        case vm_cos:
+            return cos(a);
+        case vm_tan:
+            return tan(a);
+        case vm_csc:
+            return 1 / sin(a);
+        case vm_sec:
+            return 1 / cos(a);
+        case vm_cot:
+            return 1 / tan(a);
+        case vm_sinh:
+            return sinh(a);
+        case vm_cosh:
+            return cosh(a);
+        case vm_tanh:
+            return tanh(a);
+        case vm_csch:
+            return 1 / sinh(a);
+        case vm_sech:
+            return 1 / cosh(a);
+        case vm_coth:
+            return 1 / tanh(a);
+        case vm_ln:
+            return log(a);
+        default:
+            return log10(a);
+    }
+}
+
+/* Applies an operator to a and b. */
+static double vm_bin(vm_op op, double a, double b) {
+    switch (op) {
+        case vm_add:
+            return a + b;
+        case vm_sub:
+            return a - b;
+        case vm_mul:
+            return a * b;
+        case vm_div:
+            return a / b;
+        default:
+            return pow(a, b);
+    }
+}
+
+/* Instruction computing nd, which is not a leaf; a square is a product, exact and far cheaper. */
+static vm_op vm_opcode(node *nd) {
+    switch (nd->type) {
+        case nd_add:
+            return vm_add;
+        case nd_sub:
+            return vm_sub;
+        case nd_mul:
+            return vm_mul;
+        case nd_div:
+            return vm_div;
+        case nd_pow:
+            return is_val(nd->rhs, 2) ? vm_mul : vm_pow;
+        case nd_neg:
+            return vm_neg;
+        default:
+            return vm_sin + (nd->nm - nm_sin);
+    }
+}
+
+/* Value of a tree that does not depend on x, computed as the interpreter would. */
+static double vm_fold(node *nd) {
+    switch (nd->type) {
+        case nd_num:
+            return nd->val;
+        case nd_cst:
+            return (nd->nm == nm_pi) ? M_PI : M_E;
+        case nd_neg:
+        case nd_fnc:
+            return vm_fn(vm_opcode(nd), vm_fold(nd->lhs));
+        default: {
+            double a = vm_fold(nd->lhs);
+            double b = ((nd->type == nd_pow) && is_val(nd->rhs, 2)) ? a : vm_fold(nd->rhs);
+            return vm_bin(vm_opcode(nd), a, b);
+        }
+    }
+}
+
+/* Slot of nd in the node map. */
+static int vb_slot(vm_bld *vb, node *nd) {
+    uintptr_t h = ((uintptr_t) nd >> 4) * 2654435761u;
+    while ((vb->key[h & (vb->cap - 1)] != NULL) && (vb->key[h & (vb->cap - 1)] != nd)) {
+        h++;
+    }
+    return h & (vb->cap - 1);
+}
+
+/* Records that nd computes value id, doubling the map when it is half full. */
+static void vb_put(vm_bld *vb, node *nd, int id) {
+    if (2 * (vb->cnt + 1) > vb->cap) {
+        node **key = vb->key;
+        int *ids = vb->id, cap = vb->cap, ind;
+
+        vb->cap = (cap == 0) ? 64 : 2 * cap;
+        vb->key = (node **) mem_alloc(sizeof(node *) * vb->cap);
+        vb->id = (int *) mem_alloc(sizeof(int) * vb->cap);
+        for (ind = 0; ind < cap; ind++) {
+            if (key[ind] != NULL) {
+                int slot = vb_slot(vb, key[ind]);
+                vb->key[slot] = key[ind];
+                vb->id[slot] = ids[ind];
+            }
+        }
+    }
+
+    int slot = vb_slot(vb, nd);
+    vb->key[slot] = nd;
+    vb->id[slot] = id;
+    vb->cnt++;
+}
+
+/* Adds a value of type tp, with val for a vb_cst. */
+static int vb_new(vm_bld *vb, int tp, double val) {
+    if (vb->n_val == vb->cap_val) {
+        int cap = (vb->cap_val == 0) ? 64 : 2 * vb->cap_val;
+        vb->tp = (int *) mem_grow(vb->tp, sizeof(int) * vb->cap_val, sizeof(int) * cap);
+        vb->val = (double *) mem_grow(vb->val, sizeof(double) * vb->cap_val, sizeof(double) * cap);
+        vb->cap_val = cap;
+    }
+    vb->tp[vb->n_val] = tp;
+    vb->val[vb->n_val] = val;
+
+    return vb->n_val++;
+}
+
+/* Compiles nd, once; returns its value. */
+static int vb_node(vm_bld *vb, node *nd) {
+    if (vb->cap > 0) {
+        int slot = vb_slot(vb, nd);
+        if (vb->key[slot] == nd) {
+            return vb->id[slot];
+        }
+    }
+
+    int id;
+    if (nd->type == nd_var) {
+        id = vb_new(vb, vb_var, 0);
+    } else if (!dep_x(nd)) {
+        id = vb_new(vb, vb_cst, vm_fold(nd));
+    } else {
+        int a = vb_node(vb, nd->lhs), b = -1;
+        if ((nd->type == nd_pow) && is_val(nd->rhs, 2)) {
+            b = a;
+        } else if (nd->rhs != NULL) {
+            b = vb_node(vb, nd->rhs);
+        }
+
+        if (vb->n_ins == vb->cap_ins) {
+            int cap = (vb->cap_ins == 0) ? 64 : 2 * vb->cap_ins;
+            vb->ins = (vm_ins *) mem_grow(vb->ins, sizeof(vm_ins) * vb->cap_ins, sizeof(vm_ins) * cap);
+            vb->cap_ins = cap;
+        }
+        id = vb_new(vb, vb_ins, 0);
+        vm_ins ins = {vm_opcode(nd), id, a, b};
+        vb->ins[vb->n_ins++] = ins;
+    }
+
+    vb_put(vb, nd, id);
+    return id;
+}
+
+/*
+ * Compiles df and, unless it is NULL, f into a program which lives outside the arena. Returns
+ * NULL when out of memory.
+ */
+deriv_prog *vm_build(node *df, node *f) {
+    vm_bld *vb = (vm_bld *) mem_alloc(sizeof(vm_bld));
+    int out[2] = {vb_node(vb, df), (f != NULL) ? vb_node(vb, f) : -1};
+
+    deriv_prog *prog = (deriv_prog *) malloc(sizeof(deriv_prog));
+    if (prog == NULL) {
+        return NULL;
+    }
+    prog->code = NULL;
+    prog->jit[0] = NULL;
+    prog->jit[1] = NULL;
+    prog->ins = (vm_ins *) malloc(sizeof(vm_ins) * (vb->n_ins + 1));
+    prog->cst = (double *) malloc(sizeof(double) * (vb->n_val + 1));
+    if ((prog->ins == NULL) || (prog->cst == NULL)) {
+        deriv_prog_free(prog);
+        return NULL;
+    }
+
+    /* register of each value, last instruction reading it, and registers holding no live value */
+    int *reg = (int *) mem_alloc(sizeof(int) * vb->n_val);
+    int *last = (int *) mem_alloc(sizeof(int) * vb->n_val);
+    int *free_r = (int *) mem_alloc(sizeof(int) * vb->n_val);
+    int n_free = 0, ind, val;
+
+    prog->n_cst = 0;
+    for (val = 0; val < vb->n_val; val++) {
+        if (vb->tp[val] == vb_cst) {
+            prog->cst[prog->n_cst] = vb->val[val];
+            reg[val] = prog->n_cst++;
+        }
+        last[val] = -1;
+    }
+    for (val = 0; val < vb->n_val; val++) {
+        if (vb->tp[val] == vb_var) {
+            reg[val] = prog->n_cst;
+        }
+    }
+    prog->n_reg = prog->n_cst + 1;
+
+    for (ind = 0; ind < vb->n_ins; ind++) {
+        last[vb->ins[ind].a] = ind;
+        if (vb->ins[ind].b >= 0) {
+            last[vb->ins[ind].b] = ind;
+        }
+    }
+    for (ind = 0; ind < 2; ind++) {
+        if (out[ind] >= 0) {
+            last[out[ind]] = vb->n_ins;                    // outputs are read after the last instruction
+        }
+    }
+
+    for (ind = 0; ind < vb->n_ins; ind++) {
+        vm_ins ins = vb->ins[ind];
+        if ((vb->tp[ins.a] == vb_ins) && (last[ins.a] == ind)) {
+            free_r[n_free++] = reg[ins.a];
+        }
+        if ((ins.b >= 0) && (ins.b != ins.a) && (vb->tp[ins.b] == vb_ins) && (last[ins.b] == ind)) {
+            free_r[n_free++] = reg[ins.b];
+        }
+        reg[ins.dst] = (n_free > 0) ? free_r[--n_free] : prog->n_reg++;
+
+        prog->ins[ind].op = ins.op;
+        prog->ins[ind].dst = reg[ins.dst];
+        prog->ins[ind].a = reg[ins.a];
+        prog->ins[ind].b = (ins.b >= 0) ? reg[ins.b] : -1;
+    }
+    prog->n_ins = vb->n_ins;
+    prog->out[0] = reg[out[0]];
+    prog->out[1] = (out[1] >= 0) ? reg[out[1]] : -1;
+
+    return prog;
+}
+
+/*
+ * Marks in need the instructions output out depends on, the others computing only the other
+ * output. live has room for n_reg flags and need for n_ins.
+ */
+void vm_live(const deriv_prog *prog, int out, char *live, char *need) {
+    int ind;
+    memset(live, 0, prog->n_reg);
+    live[out] = 1;
+    for (ind = prog->n_ins - 1; ind >= 0; ind--) {         // registers are reused, so liveness runs backwards
+        const vm_ins *ins = prog->ins + ind;
+        need[ind] = live[ins->dst];
+        if (need[ind]) {
+            live[ins->dst] = 0;
+            live[ins->a] = 1;
+            if (ins->b >= 0) {
+                live[ins->b] = 1;
+            }
+        }
+    }
+}
+
+/* Runs the program on the m points of a block, whose registers are blk doubles apart. */
+static void vm_block(const deriv_prog *prog, const simd_isa *isa, double *reg, size_t blk, size_t m) {
+    size_t i;
+    int ind;
+
+    #define VM_EACH(expr) for (i = 0; i < m; i++) { d[i] = (expr); } break
+
+    for (ind = 0; ind < prog->n_ins; ind++) {
+        const vm_ins *ins = prog->ins + ind;
+        double *d = reg + ins->dst * blk;
+        double *a = reg + ins->a * blk;
+        double *b = reg + ((ins->b >= 0) ? ins->b : 0) * blk;
+
+        switch (ins->op) {
+            case vm_add:
+            case vm_sub:
+            case vm_mul:
+            case vm_div:
+            case vm_neg:
+                isa->run(ins->op, d, a, b, m);
+                break;
+            /* powers, exponentials, logarithms, trig and hyperbolic functions: libm, lane by lane */
+            case vm_pow: VM_EACH(pow(a[i], b[i]));
+            case vm_sin: VM_EACH(sin(a[i]));
+            case vm_cos: VM_EACH(cos(a[i]));
+            case vm_tan: VM_EACH(tan(a[i]));
+            case vm_csc: VM_EACH(1 / sin(a[i]));
+            case vm_sec: VM_EACH(1 / cos(a[i]));
+            case vm_cot: VM_EACH(1 / tan(a[i]));
+            case vm_sinh: VM_EACH(sinh(a[i]));
+            case vm_cosh: VM_EACH(cosh(a[i]));
+            case vm_tanh: VM_EACH(tanh(a[i]));
+            case vm_csch: VM_EACH(1 / sinh(a[i]));
+            case vm_sech: VM_EACH(1 / cosh(a[i]));
+            case vm_coth: VM_EACH(1 / tanh(a[i]));
+            case vm_ln: VM_EACH(log(a[i]));
+            default: VM_EACH(log10(a[i]));
+        }
+    }
+}
+
+/* The same in single precision. */
+static void vm_blockf(const deriv_prog *prog, const simd_isa *isa, float *reg, size_t blk, size_t m) {
+    size_t i;
+    int ind;
+
+    for (ind = 0; ind < prog->n_ins; ind++) {
+        const vm_ins *ins = prog->ins + ind;
+        float *d = reg + ins->dst * blk;
+        float *a = reg + ins->a * blk;
+        float *b = reg + ((ins->b >= 0) ? ins->b : 0) * blk;
+
+        switch (ins->op) {
+            case vm_add:
+            case vm_sub:
+            case vm_mul:
+            case vm_div:
+            case vm_neg:
+                isa->runf(ins->op, d, a, b, m);
+                break;
+            case vm_pow: VM_EACH(powf(a[i], b[i]));
+            case vm_sin: VM_EACH(sinf(a[i]));
+            case vm_cos: VM_EACH(cosf(a[i]));
+            case vm_tan: VM_EACH(tanf(a[i]));
+            case vm_csc: VM_EACH(1 / sinf(a[i]));
+            case vm_sec: VM_EACH(1 / cosf(a[i]));
+            case vm_cot: VM_EACH(1 / tanf(a[i]));
+            case vm_sinh: VM_EACH(sinhf(a[i]));
+            case vm_cosh: VM_EACH(coshf(a[i]));
+            case vm_tanh: VM_EACH(tanhf(a[i]));
+            case vm_csch: VM_EACH(1 / sinhf(a[i]));
+            case vm_sech: VM_EACH(1 / coshf(a[i]));
+            case vm_coth: VM_EACH(1 / tanhf(a[i]));
+            case vm_ln: VM_EACH(logf(a[i]));
+            default: VM_EACH(log10f(a[i]));
+        }
+    }
+
+    #undef VM_EACH
+}
+
+/* Takes room for the registers of a block of blk points of size bytes each, on the stack if it fits. */
+static void *vm_regs(const deriv_prog *prog, size_t blk, size_t size, double *stack) {
+    if (prog->n_reg * blk * size <= sizeof(double) * VM_STACK) {
+        return stack;
+    }
+
+    void *reg = malloc(prog->n_reg * blk * size);
+    if (reg == NULL) {
+        perror("deriv_eval");
+        exit(1);
+    }
+    return reg;
+}
+
+/*
+ * Evaluates a program of deriv_compile() at the n points of x: f'(x[i]) goes to df[i] and, when
+ * the program was compiled with DERIV_FUNC and f is not NULL, f(x[i]) to f[i]. The arithmetic runs
+ * on the widest vector unit of the CPU, with the same results as the scalar code. A program can
+ * be evaluated by several threads at the same time.
+ */
+void deriv_eval(const deriv_prog *prog, const double *x, size_t n, double *df, double *f) {
+    const simd_isa *isa = simd_pick();
+    size_t blk = (n < VM_BLOCK) ? n : VM_BLOCK, at, m, i;
+    double stack[VM_STACK];
+    int ind;
+
+    if (n == 0) {
+        return;
+    }
+    double *reg = (double *) vm_regs(prog, blk, sizeof(double), stack);
+    for (ind = 0; ind < prog->n_cst; ind++) {
+        for (i = 0; i < blk; i++) {
+            reg[ind * blk + i] = prog->cst[ind];
+        }
+    }
+
+    for (at = 0; at < n; at += m) {
+        m = (n - at < blk) ? n - at : blk;
+        memcpy(reg + prog->n_cst * blk, x + at, sizeof(double) * m);
+        vm_block(prog, isa, reg, blk, m);
+
+        memcpy(df + at, reg + prog->out[0] * blk, sizeof(double) * m);
+        if ((f != NULL) && (prog->out[1] >= 0)) {
+            memcpy(f + at, reg + prog->out[1] * blk, sizeof(double) * m);
+        }
+    }
+
+    if (reg != stack) {
+        free(reg);
+    }
+}
+
+/*
+ * Evaluates a program like deriv_eval(), in single precision: twice the points per vector
+ * instruction, for uses that can afford float results. Constants folded at compile time are
+ * computed in double and rounded.
+ */
+void deriv_evalf(const deriv_prog *prog, const float *x, size_t n, float *df, float *f) {
+    const simd_isa *isa = simd_pick();
+    size_t blk = (n < VM_BLOCK) ? n : VM_BLOCK, at, m, i;
+    double stack[VM_STACK];
+    int ind;
+
+    if (n == 0) {
+        return;
+    }
+    float *reg = (float *) vm_regs(prog, blk, sizeof(float), stack);
+    for (ind = 0; ind < prog->n_cst; ind++) {
+        for (i = 0; i < blk; i++) {
+            reg[ind * blk + i] = (float) prog->cst[ind];
+        }
+    }
+
+    for (at = 0; at < n; at += m) {
+        m = (n - at < blk) ? n - at : blk;
+        memcpy(reg + prog->n_cst * blk, x + at, sizeof(float) * m);
+        vm_blockf(prog, isa, reg, blk, m);
+
+        memcpy(df + at, reg + prog->out[0] * blk, sizeof(float) * m);
+        if ((f != NULL) && (prog->out[1] >= 0)) {
+            memcpy(f + at, reg + prog->out[1] * blk, sizeof(float) * m);
+        }
+    }
+
+    if ((void *) reg != (void *) stack) {
+        free(reg);
+    }
+}
+
+/*
+ * deriv_grid() cuts the grid into chunks of VM_CHUNK points, from the first cache line boundary of
+ * df on, so that no two threads write the same line of df, nor of f when both arrays share their
+ * alignment. The pool hands every thread a contiguous run of chunks, so each thread first touches,
+ * and on NUMA machines places, the pages it writes. Point i is always a + i * h, whichever thread
+ * computes it, and deriv_eval() returns the same for a point whatever its place in a block, so the
+ * results do not depend on the number of threads.
+ */
+typedef struct vm_grid {
+    const deriv_prog *prog;
+    double a;
+    double h;
+    double last;                                           // the exact value of the last point
+    size_t n;
+    size_t first;                                          // end of chunk 0, at a cache line of df
+    double *df;
+    double *f;
+} vm_grid;
+
+/* Evaluates chunk ind of a grid. */
+static void vm_chunk(int ind, void *arg) {
+    vm_grid *gr = (vm_grid *) arg;
+    double x[VM_CHUNK + 8];                                // chunk 0 can be up to 7 points longer
+    size_t lo = (ind == 0) ? 0 : gr->first + (size_t) (ind - 1) * VM_CHUNK;
+    size_t hi = gr->first + (size_t) ind * VM_CHUNK, i;
+    if (hi > gr->n) {
+        hi = gr->n;
+    }
+
+    for (i = lo; i < hi; i++) {
+        x[i - lo] = gr->a + (double) i * gr->h;
+    }
+    if (hi == gr->n) {
+        x[hi - 1 - lo] = gr->last;
+    }
+    deriv_eval(gr->prog, x, hi - lo, gr->df + lo, (gr->f != NULL) ? gr->f + lo : NULL);
+}
+
+/*
+ * Evaluates a program of deriv_compile() on the grid a, a + step, a + 2 step... up to b or, with
+ * step 0, on n points spread evenly over [a, b], both ends included, using n_thr threads. Results
+ * go to df and f as with deriv_eval(), at most n of them, and are the same for any n_thr. Returns
+ * the number of points of the grid, which past n means df was too small, or DERIV_EINVAL for a
+ * negative or nan step.
+ */
+long deriv_grid(const deriv_prog *prog, double a, double b, double step, size_t n, int n_thr, double *df, double *f) {
+    vm_grid gr;
+    size_t cnt = n;
+
+    if (step != 0) {
+        double q = floor((b - a) / step);
+        if (!(step > 0) || !(q < 1e15)) {                  // also nan, and grids no array could hold
+            return DERIV_EINVAL;
+        }
+        cnt = (q >= 0) ? (size_t) q + 1 : 0;
+        while ((cnt > 0) && (a + (double) (cnt - 1) * step > b)) {  // the division may round either way
+            cnt--;
+        }
+        while ((q >= 0) && (a + (double) cnt * step <= b)) {
+            cnt++;
+        }
+        gr.h = step;
+        gr.n = (cnt < n) ? cnt : n;
+        gr.last = a + (double) (gr.n - 1) * step;
+    } else {
+        gr.h = (n > 1) ? (b - a) / (double) (n - 1) : 0;
+        gr.n = n;
+        gr.last = (n > 1) ? b : a;
+    }
+    if (gr.n == 0) {
+        return (long) cnt;
+    }
+
+    gr.prog = prog;
+    gr.a = a;
+    gr.df = df;
+    gr.f = ((f != NULL) && (prog->out[1] >= 0)) ? f : NULL;
+    gr.first = (64 - (uintptr_t) df % 64) % 64 / sizeof(double) + VM_CHUNK;
+
+    int n_item = (gr.n > gr.first) ? (int) ((gr.n - gr.first + VM_CHUNK - 1) / VM_CHUNK) + 1 : 1;
+    if ((n_thr <= 1) || (n_item == 1)) {
+        int ind;
+        for (ind = 0; ind < n_item; ind++) {
+            vm_chunk(ind, &gr);
+        }
+    } else {
+        pool_run(n_item, (n_thr < n_item) ? n_thr : n_item, vm_chunk, NULL, &gr);
+    }
+
+    return (long) cnt;
+}
+
+/* Frees a program of deriv_compile(). */
+void deriv_prog_free(deriv_prog *prog) {
+    if (prog != NULL) {
+        jit_free(prog);
+        free(prog->ins);
+        free(prog->cst);
+        free(prog);
+    }
+}
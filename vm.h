@@ -0,0 +1,49 @@
+/*
+ * vm.h
+ * Bytecode compiler and interpreter prototypes
+ * 
+ * Copyright (c) 2015 J. G. da Silva <carauma.com>
+ *
+ * MIT License
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef VM_H
+#define VM_H
+
+#include "derivative.h"
+#include "struct.h"
+
+struct deriv_prog {
+    vm_ins *ins;
+    int n_ins;
+    double *cst;                                           // values of registers 0 to n_cst - 1
+    int n_cst;
+    int n_reg;                                             // register n_cst holds x, the rest are temporaries
+    int out[2];                                            // registers of f' and f; out[1] is -1 without DERIV_FUNC
+    void *code;                                            // native code of deriv_jit(), or NULL
+    size_t code_size;
+    deriv_fn jit[2];
+};
+
+deriv_prog *vm_build(node *df, node *f);
+void vm_live(const deriv_prog *prog, int out, char *live, char *need);
+
+#endif